@@ -0,0 +1,110 @@
+#ifndef CGL_APP_CONFIG_H
+#define CGL_APP_CONFIG_H
+
+#include <string>
+
+#include "util/image.h"
+
+namespace CGL {
+
+using std::string;
+
+struct AppConfig {
+
+  AppConfig () {
+
+    pathtracer_ns_aa = 1;
+    pathtracer_max_ray_depth = 1;
+    pathtracer_accumulate_bounces = true;
+    pathtracer_ns_area_light = 1;
+
+    pathtracer_ns_diff = 1;
+    pathtracer_ns_glsy = 1;
+    pathtracer_ns_refr = 1;
+
+    pathtracer_num_threads = 0;
+    pathtracer_envmap = NULL;
+    pathtracer_envmap_path = "";
+
+    pathtracer_samples_per_patch = 32;
+    pathtracer_max_tolerance = 0.05f;
+    pathtracer_direct_hemisphere_sample = false;
+
+    pathtracer_filename = "";
+    pathtracer_lensRadius = 0.0;
+    pathtracer_focalDistance = 4.7;
+
+    pathtracer_ns_light_bvh = 0;
+
+    pathtracer_progressive = false;
+    pathtracer_time_budget = 0;
+
+    pathtracer_denoise = false;
+    pathtracer_aovs = "";
+    pathtracer_render_cost = false;
+
+    pathtracer_tile_size = 32;
+    pathtracer_tile_order = "raster";
+    pathtracer_stats_path = "";
+    pathtracer_thread_placement = "none";
+
+    pathtracer_hdr_output = "";
+
+    pathtracer_checkpoint_path = "";
+    pathtracer_checkpoint_interval = 60;
+    pathtracer_resume = false;
+
+    pathtracer_high_precision = false;
+    pathtracer_tonemap = "linear";
+  }
+
+  size_t pathtracer_ns_aa;
+  size_t pathtracer_max_ray_depth;
+  bool pathtracer_accumulate_bounces; // whether we accumulate light bounce or only sample from the last bounce
+  size_t pathtracer_ns_area_light;
+
+  size_t pathtracer_ns_diff;
+  size_t pathtracer_ns_glsy;
+  size_t pathtracer_ns_refr;
+
+  size_t pathtracer_num_threads;
+  EnvironmentMap* pathtracer_envmap;
+  string pathtracer_envmap_path; // used to cache the envmap sampling tables
+
+  float pathtracer_max_tolerance;
+  size_t pathtracer_samples_per_patch;
+
+  bool pathtracer_direct_hemisphere_sample;
+
+  string pathtracer_filename;
+
+  double pathtracer_lensRadius;
+  double pathtracer_focalDistance;
+
+  size_t pathtracer_ns_light_bvh;
+
+  bool pathtracer_progressive;    // render in passes of increasing spp
+  double pathtracer_time_budget;  // seconds, 0 renders up to pathtracer_ns_aa
+
+  bool pathtracer_denoise;
+  string pathtracer_aovs;         // comma separated AOV names, see pathtracer/aov.h
+  bool pathtracer_render_cost;    // write a per-pixel render cost heatmap
+
+  size_t pathtracer_tile_size;
+  string pathtracer_tile_order;   // raster, hilbert, spiral or cost
+  string pathtracer_stats_path;   // JSON lines progress stats, "-" for stdout
+  string pathtracer_thread_placement; // none, pin or numa
+
+  string pathtracer_hdr_output;   // "", half or float exr next to the png
+
+  string pathtracer_checkpoint_path;      // "" for no checkpoints
+  double pathtracer_checkpoint_interval;  // seconds, 0 checkpoints on cancel only
+  bool pathtracer_resume;         // continue from the checkpoint
+
+  bool pathtracer_high_precision; // also accumulate the radiance in doubles
+  string pathtracer_tonemap;      // linear, reinhard, aces or filmic
+};
+
+} // namespace CGL
+
+#endif // CGL_APP_CONFIG_H
@@ -1,4 +1,5 @@
 #include "application.h"
+#include "command_line.h"
 
 #include "scene/gl_scene/ambient_light.h"
 #include "scene/gl_scene/environment_light.h"
@@ -9,6 +10,8 @@
 #include "scene/gl_scene/sphere.h"
 #include "scene/gl_scene/mesh.h"
 
+#include "util/startup_profiler.h"
+
 using Collada::CameraInfo;
 using Collada::LightInfo;
 using Collada::MaterialInfo;
@@ -20,23 +23,7 @@ namespace CGL {
 
 Application::Application(AppConfig config, bool gl) {
   gl_window = gl;
-  renderer = new RaytracedRenderer (
-    config.pathtracer_ns_aa,
-    config.pathtracer_max_ray_depth,
-    config.pathtracer_accumulate_bounces,
-    config.pathtracer_ns_area_light,
-    config.pathtracer_ns_diff,
-    config.pathtracer_ns_glsy,
-    config.pathtracer_ns_refr,
-    config.pathtracer_num_threads,
-    config.pathtracer_samples_per_patch,
-    config.pathtracer_max_tolerance,
-    config.pathtracer_envmap,
-    config.pathtracer_direct_hemisphere_sample,
-    config.pathtracer_filename,
-    config.pathtracer_lensRadius,
-    config.pathtracer_focalDistance
-  );
+  renderer = create_renderer(config);
   filename = config.pathtracer_filename;
 }
 
@@ -228,6 +215,7 @@ string Application::info() {
 
 void Application::load(SceneInfo* sceneInfo) {
 
+  ProfilePhase phase("GL scene build");
   vector<Collada::Node>& nodes = sceneInfo->nodes;
   vector<GLScene::SceneLight *> lights;
   vector<GLScene::SceneObject *> objects;
@@ -33,6 +33,7 @@
 
 // Shared modules
 #include "pathtracer/camera.h"
+#include "application/app_config.h"
 
 using namespace std;
 
@@ -40,54 +41,6 @@ namespace CGL {
 
   class VisualDebugger;
 
-struct AppConfig {
-
-  AppConfig () {
-
-    pathtracer_ns_aa = 1;
-    pathtracer_max_ray_depth = 1;
-    pathtracer_accumulate_bounces = true;
-    pathtracer_ns_area_light = 1;
-
-    pathtracer_ns_diff = 1;
-    pathtracer_ns_glsy = 1;
-    pathtracer_ns_refr = 1;
-
-    pathtracer_num_threads = 1;
-    pathtracer_envmap = NULL;
-
-    pathtracer_samples_per_patch = 32;
-    pathtracer_max_tolerance = 0.05f;
-    pathtracer_direct_hemisphere_sample = false;
-
-    pathtracer_filename = "";
-    pathtracer_lensRadius = 0.0;
-    pathtracer_focalDistance = 4.7;
-  }
-
-  size_t pathtracer_ns_aa;
-  size_t pathtracer_max_ray_depth;
-  bool pathtracer_accumulate_bounces; // whether we accumulate light bounce or only sample from the last bounce
-  size_t pathtracer_ns_area_light;
-
-  size_t pathtracer_ns_diff;
-  size_t pathtracer_ns_glsy;
-  size_t pathtracer_ns_refr;
-
-  size_t pathtracer_num_threads;
-  HDRImageBuffer* pathtracer_envmap;
-
-  float pathtracer_max_tolerance;
-  size_t pathtracer_samples_per_patch;
-
-  bool pathtracer_direct_hemisphere_sample;
-
-  string pathtracer_filename;
-
-  double pathtracer_lensRadius;
-  double pathtracer_focalDistance;
-};
-
 class Application : public Renderer {
  public:
 
@@ -113,6 +66,16 @@ class Application : public Renderer {
     renderer->render_to_file(filename, x, y, dx, dy); 
   }
 
+  void render_distributed(std::string filename, RenderCoordinator* coordinator) {
+    set_up_pathtracer();
+    renderer->render_distributed(filename, coordinator);
+  }
+
+  void render_worker(std::string address) {
+    set_up_pathtracer();
+    renderer->render_worker(address);
+  }
+
   void load_camera(std::string filename) {
     camera.load_settings(filename);
   }
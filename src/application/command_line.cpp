@@ -0,0 +1,358 @@
+#include "command_line.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+#ifdef _WIN32
+#include "util/win32/getopt.h"
+#else
+#include <getopt.h>
+#endif
+
+#include "scene/scene_cache.h"
+#include "util/exr_io.h"
+#include "util/cpu_topology.h"
+#include "util/startup_profiler.h"
+
+using namespace std;
+
+namespace CGL {
+
+void usage(const char *binaryName) {
+  printf("Usage: %s [options] <scenefile>\n", binaryName);
+  printf("Program Options:\n");
+  printf("  -s  <INT>        Number of camera rays per pixel\n");
+  printf("  -l  <INT>        Number of samples per area light\n");
+  printf("  -L  <INT>        Number of lights picked from the light BVH per "
+         "shading point\n");
+  printf("  -P  <FLOAT>      Render progressively in passes of increasing "
+         "samples, stopping after the given seconds (0 = no time limit)\n");
+  printf("  -J  <FILE>       Append render progress stats as JSON lines "
+         "(- for stdout)\n");
+  printf("  -D               Denoise the rendered image\n");
+  printf("  -A  <LIST>       Comma separated AOVs to save next to the image "
+         "(depth,normal,albedo,primid,direct,indirect,emission or all)\n");
+  printf("  -T               Save a per-pixel render cost heatmap (time, BVH "
+         "visits, bounces)\n");
+  printf("  -t  <INT>        Number of render threads (0 = one per CPU)\n");
+  printf("  -N  <MODE>       Thread placement: none, pin (one core per "
+         "thread) or numa (one NUMA node per thread)\n");
+  printf("  -S  <INT>        Size of the render tiles in pixels\n");
+  printf("  -O  <ORDER>      Tile order: raster, hilbert, spiral or cost "
+         "(pilot pass, splits expensive tiles)\n");
+  printf("  -m  <INT>        Maximum ray depth\n");
+  printf("  -o  <INT>        Accumulate Bounces of Light \n");
+  printf("  -e  <PATH>       Path to environment map\n");
+  printf("  -b  <FLOAT>      The size of the aperture\n");
+  printf("  -d  <FLOAT>      The focal distance\n");
+  printf("  -f  <FILENAME>   Image (.png) file to save output to in windowless "
+         "mode\n");
+  printf("  -E  <TYPE>       Also save the linear radiance, sample counts and "
+         "AOVs to an .exr file of half or float pixels\n");
+  printf("  -k, --checkpoint <FILE>\n"
+         "                   Periodically save the render in progress, to "
+         "continue it with --resume\n");
+  printf("  -I, --checkpoint-interval <FLOAT>\n"
+         "                   Seconds between checkpoints (0 = only when "
+         "canceled, default 60)\n");
+  printf("  -R, --resume     Continue the render saved in the checkpoint "
+         "(default <scene>.checkpoint)\n");
+  printf("      --scene-cache <FILE>\n"
+         "                   Binary scene cache pathtracer_cli loads instead of "
+         "parsing the scene (default in $XDG_CACHE_HOME/pathtracer or "
+         "~/.cache/pathtracer)\n");
+  printf("      --no-scene-cache\n"
+         "                   Always parse the scene file\n");
+  printf("      --startup-profile <FILE>\n"
+         "                   Print the time and memory of each startup phase and "
+         "save them as a Chrome trace\n");
+  printf("      --high-precision\n"
+         "                   Accumulate the radiance in doubles as well, for "
+         "renders of very many passes\n");
+  printf("      --tonemap <OP>\n"
+         "                   Tonemapping of the displayed and saved image: linear "
+         "(default), reinhard, aces or filmic\n");
+  printf("  -C  <INT>        Coordinate a render over worker processes, "
+         "starting the given number locally\n");
+  printf("  -K  <ADDRESS>    Coordinator address: unix:<PATH>, "
+         "[tcp:][HOST:]PORT (default unix socket in /tmp)\n");
+  printf("      --worker-timeout <FLOAT>\n"
+         "                   Seconds a worker may go without progress, and the "
+         "coordinator waits for a worker to connect once spawned workers "
+         "loaded the scene (0 = forever, default 120)\n");
+  printf("  -W  <ADDRESS>    Run as a worker for the coordinator at ADDRESS\n");
+  printf(
+      "  -r  <INT> <INT>  Width and height of output image (if windowless)\n");
+  printf("  -h               Print this help message\n");
+  printf("\n");
+}
+
+// long options without a short form
+enum {
+  OPT_SCENE_CACHE = 256,
+  OPT_NO_SCENE_CACHE,
+  OPT_STARTUP_PROFILE,
+  OPT_HIGH_PRECISION,
+  OPT_TONEMAP,
+  OPT_WORKER_TIMEOUT
+};
+
+bool parse_command_line(int argc, char **argv, CommandLine *cl) {
+  static const struct option long_options[] = {
+    {"checkpoint", required_argument, 0, 'k'},
+    {"checkpoint-interval", required_argument, 0, 'I'},
+    {"resume", no_argument, 0, 'R'},
+    {"scene-cache", required_argument, 0, OPT_SCENE_CACHE},
+    {"no-scene-cache", no_argument, 0, OPT_NO_SCENE_CACHE},
+    {"startup-profile", required_argument, 0, OPT_STARTUP_PROFILE},
+    {"high-precision", no_argument, 0, OPT_HIGH_PRECISION},
+    {"tonemap", required_argument, 0, OPT_TONEMAP},
+    {"worker-timeout", required_argument, 0, OPT_WORKER_TIMEOUT},
+    {0, 0, 0, 0}
+  };
+
+  int opt;
+  cl->args = vector<string>(argv, argv + argc);
+  while ((opt = getopt_long(argc, argv, "s:l:L:t:m:o:e:h:H:f:r:c:b:d:a:p:P:DA:TS:O:J:N:C:K:W:E:k:I:R",
+                            long_options, NULL)) != -1) { // for each option...
+    switch (opt) {
+    case 'f':
+      cl->write_to_file = true;
+      cl->output_file_name = string(optarg);
+      break;
+    case 'r':
+      cl->w = atoi(argv[optind - 1]);
+      cl->h = atoi(argv[optind]);
+      optind++;
+      break;
+    case 'p':
+      cl->x = atoi(argv[optind - 1]);
+      cl->y = atoi(argv[optind - 0]);
+      cl->dx = atoi(argv[optind + 1]);
+      cl->dy = atoi(argv[optind + 2]);
+      optind += 3;
+      break;
+    case 's':
+      cl->config.pathtracer_ns_aa = atoi(optarg);
+      break;
+    case 'l':
+      cl->config.pathtracer_ns_area_light = atoi(optarg);
+      break;
+    case 'L':
+      cl->config.pathtracer_ns_light_bvh = atoi(optarg);
+      break;
+    case 'P':
+      cl->config.pathtracer_progressive = true;
+      cl->config.pathtracer_time_budget = atof(optarg);
+      break;
+    case 'D':
+      cl->config.pathtracer_denoise = true;
+      break;
+    case 'A':
+      cl->config.pathtracer_aovs = optarg;
+      break;
+    case 'T':
+      cl->config.pathtracer_render_cost = true;
+      break;
+    case 'S':
+      cl->config.pathtracer_tile_size = atoi(optarg);
+      break;
+    case 'O':
+      cl->config.pathtracer_tile_order = optarg;
+      break;
+    case 'J':
+      cl->config.pathtracer_stats_path = optarg;
+      break;
+    case 'N':
+      cl->config.pathtracer_thread_placement = optarg;
+      break;
+    case 'E':
+      cl->config.pathtracer_hdr_output = optarg;
+      break;
+    case 'k':
+      cl->config.pathtracer_checkpoint_path = optarg;
+      break;
+    case 'I':
+      cl->config.pathtracer_checkpoint_interval = atof(optarg);
+      break;
+    case 'R':
+      cl->config.pathtracer_resume = true;
+      break;
+    case OPT_SCENE_CACHE:
+      cl->scene_cache = optarg;
+      break;
+    case OPT_NO_SCENE_CACHE:
+      cl->use_scene_cache = false;
+      break;
+    case OPT_STARTUP_PROFILE:
+      cl->startup_profile = optarg;
+      StartupProfiler::instance().set_output(optarg);
+      break;
+    case OPT_HIGH_PRECISION:
+      cl->config.pathtracer_high_precision = true;
+      break;
+    case OPT_TONEMAP:
+      cl->config.pathtracer_tonemap = optarg;
+      break;
+    case 'C':
+      cl->write_to_file = true;
+      cl->coordinate = true;
+      cl->num_workers = atoi(optarg);
+      break;
+    case 'K':
+      cl->coordinator_address = optarg;
+      break;
+    case OPT_WORKER_TIMEOUT:
+      cl->worker_timeout = atof(optarg);
+      break;
+    case 'W':
+      cl->write_to_file = true;
+      cl->worker_address = optarg;
+      break;
+    case 't':
+      cl->config.pathtracer_num_threads = atoi(optarg);
+      break;
+    case 'm':
+      cl->config.pathtracer_max_ray_depth = atoi(optarg);
+      break;
+    case 'o':
+      cl->config.pathtracer_accumulate_bounces = atoi(optarg) > 0;
+      break;
+    case 'e':
+      std::cout << "[PathTracer] Loading environment map " << optarg
+                << std::endl;
+      cl->config.pathtracer_envmap = load_envmap(optarg);
+      cl->config.pathtracer_envmap_path = optarg;
+      break;
+    case 'c':
+      cl->cam_settings = string(optarg);
+      break;
+    case 'b':
+      cl->config.pathtracer_lensRadius = atof(optarg);
+      break;
+    case 'd':
+      cl->config.pathtracer_focalDistance = atof(optarg);
+      break;
+    case 'a':
+      cl->config.pathtracer_samples_per_patch = atoi(argv[optind - 1]);
+      cl->config.pathtracer_max_tolerance = atof(argv[optind]);
+      optind++;
+      break;
+    case 'H':
+      cl->config.pathtracer_direct_hemisphere_sample = true;
+      optind--;
+      break;
+    default:
+      usage(argv[0]);
+      return false;
+    }
+  }
+
+  // print usage if no argument given
+  if (optind >= argc) {
+    usage(argv[0]);
+    return false;
+  }
+
+  cl->scene_file = argv[optind];
+  return true;
+}
+
+void resolve_defaults(CommandLine *cl) {
+  string sceneFile = cl->scene_file.substr(cl->scene_file.find_last_of('/') + 1);
+  sceneFile = sceneFile.substr(0, sceneFile.find(".dae"));
+  cl->config.pathtracer_filename = sceneFile;
+
+  if (cl->use_scene_cache && cl->scene_cache == "") {
+    cl->scene_cache = SceneCache::default_path(cl->scene_file);
+    cl->use_scene_cache = cl->scene_cache != "";
+  }
+
+  if (cl->config.pathtracer_num_threads == 0) {
+    cl->config.pathtracer_num_threads = CPUTopology::detect().num_cpus();
+  }
+}
+
+/**
+ * Arguments for a worker process: the coordinator's own, without the
+ * coordinator options or the startup profile, pointed at address.
+ */
+static vector<string> worker_args(const vector<string>& args, const string& address) {
+  vector<string> out;
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (args[i] == "-C" || args[i] == "-K" || args[i] == "--startup-profile" ||
+        args[i] == "--worker-timeout") {
+      i++;
+      continue;
+    }
+    if (args[i].compare(0, 2, "-C") == 0 || args[i].compare(0, 2, "-K") == 0 ||
+        args[i].compare(0, 18, "--startup-profile=") == 0 ||
+        args[i].compare(0, 17, "--worker-timeout=") == 0) {
+      continue;
+    }
+    out.push_back(args[i]);
+  }
+  out.insert(out.begin() + 1, address);
+  out.insert(out.begin() + 1, "-W");
+  return out;
+}
+
+RenderCoordinator *start_coordinator(const CommandLine &cl) {
+  if (!cl.coordinate) return NULL;
+
+  RenderCoordinator *coordinator = new RenderCoordinator(cl.coordinator_address);
+  coordinator->set_timeout(cl.worker_timeout);
+  if (!coordinator->listen()) exit(EXIT_FAILURE);
+
+  vector<string> wargs = worker_args(cl.args, coordinator->get_address());
+  if (cl.config.pathtracer_num_threads == 0 && cl.num_workers > 0) {
+    // share the CPUs between the local workers
+    size_t cpus = CPUTopology::detect().num_cpus();
+    wargs.insert(wargs.begin() + 1, to_string(max(cpus / cl.num_workers, (size_t) 1)));
+    wargs.insert(wargs.begin() + 1, "-t");
+  }
+  if (cl.num_workers > 0 && !coordinator->spawn_workers(wargs, cl.num_workers)) {
+    delete coordinator;
+    exit(EXIT_FAILURE);
+  }
+  return coordinator;
+}
+
+RaytracedRenderer *create_renderer(const AppConfig &config) {
+  return new RaytracedRenderer (
+    config.pathtracer_ns_aa,
+    config.pathtracer_max_ray_depth,
+    config.pathtracer_accumulate_bounces,
+    config.pathtracer_ns_area_light,
+    config.pathtracer_ns_diff,
+    config.pathtracer_ns_glsy,
+    config.pathtracer_ns_refr,
+    config.pathtracer_num_threads,
+    config.pathtracer_samples_per_patch,
+    config.pathtracer_max_tolerance,
+    config.pathtracer_envmap,
+    config.pathtracer_direct_hemisphere_sample,
+    config.pathtracer_filename,
+    config.pathtracer_lensRadius,
+    config.pathtracer_focalDistance,
+    config.pathtracer_ns_light_bvh,
+    config.pathtracer_envmap_path,
+    config.pathtracer_progressive,
+    config.pathtracer_time_budget,
+    config.pathtracer_denoise,
+    config.pathtracer_aovs,
+    config.pathtracer_render_cost,
+    config.pathtracer_tile_size,
+    config.pathtracer_tile_order,
+    config.pathtracer_stats_path,
+    config.pathtracer_thread_placement,
+    config.pathtracer_hdr_output,
+    config.pathtracer_checkpoint_path,
+    config.pathtracer_checkpoint_interval,
+    config.pathtracer_resume,
+    config.pathtracer_high_precision,
+    config.pathtracer_tonemap
+  );
+}
+
+} // namespace CGL
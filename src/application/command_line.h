@@ -0,0 +1,72 @@
+#ifndef CGL_COMMAND_LINE_H
+#define CGL_COMMAND_LINE_H
+
+#include <string>
+#include <vector>
+
+#include "application/app_config.h"
+#include "pathtracer/raytraced_renderer.h"
+#include "pathtracer/distributed.h"
+
+namespace CGL {
+
+/**
+ * Options shared by the interactive pathtracer and pathtracer_cli.
+ */
+struct CommandLine {
+
+  CommandLine() : write_to_file(false), w(0), h(0), x(-1), y(0), dx(0), dy(0),
+                  coordinate(false), num_workers(0), worker_timeout(120),
+                  use_scene_cache(true) { }
+
+  AppConfig config;
+  std::string scene_file;
+
+  bool write_to_file;             ///< render to output_file_name without a window
+  std::string output_file_name;
+  std::string cam_settings;       ///< camera settings file to load
+  size_t w, h;                    ///< output size, 0 for the default
+  size_t x, y, dx, dy;            ///< cell to render, x = -1 for the whole image
+
+  bool coordinate;                ///< coordinate worker processes
+  size_t num_workers;             ///< local workers to start
+  std::string coordinator_address;
+  double worker_timeout;          ///< seconds to wait on a silent worker
+  std::string worker_address;     ///< run as a worker for this coordinator
+
+  bool use_scene_cache;           ///< load the scene through a binary cache
+  std::string scene_cache;        ///< cache file, in the user's cache directory by default
+
+  std::string startup_profile;    ///< Chrome trace of the startup phases, if set
+
+  std::vector<std::string> args;  ///< arguments as given (getopt may reorder argv)
+};
+
+void usage(const char *binaryName);
+
+/**
+ * Parse the options and scene file. Prints the usage on bad input.
+ */
+bool parse_command_line(int argc, char **argv, CommandLine *cl);
+
+/**
+ * Fill in what follows from the options: the scene name used for output
+ * files, the scene cache file and the thread count when it is left
+ * automatic.
+ */
+void resolve_defaults(CommandLine *cl);
+
+/**
+ * Listen for workers and start the local ones, if coordinating.
+ * \return the coordinator, NULL if not coordinating; exits on failure
+ */
+RenderCoordinator *start_coordinator(const CommandLine &cl);
+
+/**
+ * Create the renderer for the configuration.
+ */
+RaytracedRenderer *create_renderer(const AppConfig &config);
+
+} // namespace CGL
+
+#endif // CGL_COMMAND_LINE_H
@@ -0,0 +1,76 @@
+#include "CGL/CGL.h"
+
+#include "command_line.h"
+#include "scene/scene_loader.h"
+#include "scene/collada/collada.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace CGL;
+
+#define msg(s) cerr << "[PathTracer] " << s << endl;
+
+/**
+ * Renders a scene to file without OpenGL: loads the scene, builds the
+ * raytracing scene and renders it, taking the same options as pathtracer.
+ */
+int main(int argc, char **argv) {
+
+  // get the options
+  CommandLine cl;
+  if (!parse_command_line(argc, argv, &cl)) return 1;
+  msg("Input scene file: " << cl.scene_file);
+
+  // start the workers first, so they load the scene alongside us
+  RenderCoordinator *coordinator = start_coordinator(cl);
+
+  resolve_defaults(&cl);
+  if (cl.output_file_name == "") {
+    cl.output_file_name = cl.config.pathtracer_filename + ".png";
+  }
+  size_t w = cl.w ? cl.w : 800;
+  size_t h = cl.h ? cl.h : 600;
+
+  // the meshes of a cached scene live in the cache's mapping
+  Camera camera;
+  SceneCache cache;
+  SceneObjects::Scene *scene;
+  if (cl.use_scene_cache && cache.load(cl.scene_cache, cl.scene_file)) {
+    msg("Loaded scene cache " << cl.scene_cache);
+    scene = load_static_scene(cache, &camera, w, h);
+  } else {
+    // parse scene
+    Collada::SceneInfo *sceneInfo = new Collada::SceneInfo();
+    if (Collada::ColladaParser::load(cl.scene_file.c_str(), sceneInfo) < 0) {
+      delete sceneInfo;
+      exit(0);
+    }
+    scene = load_static_scene(sceneInfo, &camera, w, h,
+                              cl.use_scene_cache ? &cache : NULL);
+    delete sceneInfo;
+    if (cl.use_scene_cache && !cache.save(cl.scene_cache, cl.scene_file)) {
+      msg("Could not write scene cache " << cl.scene_cache);
+    }
+  }
+
+  if (cl.cam_settings != "")
+    camera.load_settings(cl.cam_settings);
+
+  RaytracedRenderer *renderer = create_renderer(cl.config);
+  msg("Rendering using " << cl.config.pathtracer_num_threads << " threads");
+
+  renderer->set_camera(&camera);
+  renderer->set_scene(scene);
+  renderer->set_frame_size(w, h);
+
+  if (coordinator) {
+    renderer->render_distributed(cl.output_file_name, coordinator);
+    delete coordinator;
+  } else if (cl.worker_address != "") {
+    renderer->render_worker(cl.worker_address);
+  } else {
+    renderer->render_to_file(cl.output_file_name, cl.x, cl.y, cl.dx, cl.dy);
+  }
+  return 0;
+}
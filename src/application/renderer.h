@@ -3,6 +3,7 @@
 #include "pathtracer/camera.h"
 #include "util/image.h"
 #include "util/work_queue.h"
+#include "pathtracer/distributed.h"
 
 #include "application/renderer.h"
 
@@ -79,6 +80,16 @@ public:
 
     virtual void raytrace_cell(ImageBuffer& buffer) = 0;
 
+    /**
+     * Render with worker processes connected to the coordinator.
+     */
+    virtual void render_distributed(std::string filename, RenderCoordinator* coordinator) = 0;
+
+    /**
+     * Render regions for the coordinator at address.
+     */
+    virtual void render_worker(std::string address) = 0;
+
     /**
      * If the pathtracer is in VISUALIZE, handle key presses to traverse the bvh.
      */
@@ -4,7 +4,9 @@
 #include <iostream>
 #include <utility>
 
+#ifndef CGL_HEADLESS
 #include "application/visual_debugger.h"
+#endif
 
 using std::max;
 using std::min;
@@ -28,11 +30,13 @@ Vector3D MirrorBSDF::sample_f(const Vector3D wo, Vector3D* wi, double* pdf) {
 
 void MirrorBSDF::render_debugger_node()
 {
+#ifndef CGL_HEADLESS
   if (ImGui::TreeNode(this, "Mirror BSDF"))
   {
     DragDouble3("Reflectance", &reflectance[0], 0.005);
     ImGui::TreePop();
   }
+#endif
 }
 
 // Microfacet BSDF //
@@ -81,6 +85,7 @@ Vector3D MicrofacetBSDF::sample_f(const Vector3D wo, Vector3D* wi, double* pdf)
 
 void MicrofacetBSDF::render_debugger_node()
 {
+#ifndef CGL_HEADLESS
   if (ImGui::TreeNode(this, "Micofacet BSDF"))
   {
     DragDouble3("eta", &eta[0], 0.005);
@@ -88,6 +93,7 @@ void MicrofacetBSDF::render_debugger_node()
     DragDouble("alpha", &alpha, 0.005);
     ImGui::TreePop();
   }
+#endif
 }
 
 // Refraction BSDF //
@@ -107,12 +113,14 @@ Vector3D RefractionBSDF::sample_f(const Vector3D wo, Vector3D* wi, double* pdf)
 
 void RefractionBSDF::render_debugger_node()
 {
+#ifndef CGL_HEADLESS
   if (ImGui::TreeNode(this, "Refraction BSDF"))
   {
     DragDouble3("Transmittance", &transmittance[0], 0.005);
     DragDouble("ior", &ior, 0.005);
     ImGui::TreePop();
   }
+#endif
 }
 
 // Glass BSDF //
@@ -135,6 +143,7 @@ Vector3D GlassBSDF::sample_f(const Vector3D wo, Vector3D* wi, double* pdf) {
 
 void GlassBSDF::render_debugger_node()
 {
+#ifndef CGL_HEADLESS
   if (ImGui::TreeNode(this, "Refraction BSDF"))
   {
     DragDouble3("Reflectance", &reflectance[0], 0.005);
@@ -142,6 +151,7 @@ void GlassBSDF::render_debugger_node()
     DragDouble("ior", &ior, 0.005);
     ImGui::TreePop();
   }
+#endif
 }
 
 void BSDF::reflect(const Vector3D wo, Vector3D* wi) {
@@ -0,0 +1,97 @@
+#include "aov.h"
+
+#include <sstream>
+#include <algorithm>
+
+namespace CGL {
+
+static const char* aov_names[NUM_AOV_TYPES] = {
+  "depth", "normal", "albedo", "primid", "direct", "indirect", "emission"
+};
+
+AOVBuffers::AOVBuffers() : w(0), h(0), requested(0) { }
+
+const char* AOVBuffers::name(AOVType type) {
+  return aov_names[type];
+}
+
+size_t AOVBuffers::num_channels(AOVType type) {
+  return (type == AOV_DEPTH || type == AOV_PRIMITIVE_ID) ? 1 : 3;
+}
+
+bool AOVBuffers::request(const std::string& names) {
+  std::stringstream ss(names);
+  std::string token;
+  bool ok = true;
+  while (std::getline(ss, token, ',')) {
+    if (token.empty()) continue;
+    if (token == "all") {
+      requested = (1u << NUM_AOV_TYPES) - 1;
+      continue;
+    }
+
+    bool found = false;
+    for (int t = 0; t < NUM_AOV_TYPES; ++t) {
+      if (token == aov_names[t]) {
+        request((AOVType) t);
+        found = true;
+      }
+    }
+    ok = ok && found;
+  }
+  return ok;
+}
+
+void AOVBuffers::resize(size_t w, size_t h) {
+  this->w = w;
+  this->h = h;
+  for (int t = 0; t < NUM_AOV_TYPES; ++t) {
+    if (enabled((AOVType) t)) {
+      sums[t].resize(w, h);
+      counts[t].assign(w * h, 0);
+    } else {
+      sums[t].resize(0, 0);
+      std::vector<int>().swap(counts[t]);
+    }
+  }
+}
+
+void AOVBuffers::clear() {
+  for (int t = 0; t < NUM_AOV_TYPES; ++t) {
+    sums[t].clear();
+    std::fill(counts[t].begin(), counts[t].end(), 0);
+  }
+}
+
+void AOVBuffers::add_sample(size_t x, size_t y, const AOVSample& sample) {
+  size_t i = x + y * w;
+  unsigned mask = sample.written & requested;
+  for (int t = 0; mask; ++t, mask >>= 1) {
+    if (!(mask & 1)) continue;
+    if (t == AOV_PRIMITIVE_ID) {
+      if (counts[t][i] == 0) sums[t].data[i] = sample.value[t];
+      counts[t][i] = 1;
+      continue;
+    }
+    sums[t].data[i] += sample.value[t];
+    counts[t][i]++;
+  }
+}
+
+Vector3D AOVBuffers::get_pixel(AOVType type, size_t x, size_t y) const {
+  size_t i = x + y * w;
+  int n = counts[type][i];
+  return n > 0 ? sums[type].data[i] / n : Vector3D();
+}
+
+void AOVBuffers::resolve(AOVType type, HDRImageBuffer* out) const {
+  out->resize(w, h);
+  if (!enabled(type)) return;
+  for (size_t y = 0; y < h; ++y) {
+    for (size_t x = 0; x < w; ++x) {
+      out->data[x + y * w] = get_pixel(type, x, y);
+    }
+  }
+}
+
+} // namespace CGL
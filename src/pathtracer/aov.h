@@ -0,0 +1,115 @@
+#ifndef CGL_AOV_H
+#define CGL_AOV_H
+
+#include <string>
+#include <vector>
+
+#include "CGL/vector3D.h"
+#include "util/image.h"
+
+namespace CGL {
+
+/**
+ * Arbitrary output variables: per-pixel quantities written next to the
+ * beauty pass so images can be composited without re-rendering.
+ */
+enum AOVType {
+  AOV_DEPTH,         ///< distance to the first hit, INF for misses
+  AOV_NORMAL,        ///< shading normal at the first hit
+  AOV_ALBEDO,        ///< albedo of the first-hit material
+  AOV_PRIMITIVE_ID,  ///< index of the first-hit primitive, -1 for misses
+  AOV_DIRECT,        ///< light reaching the camera after one bounce
+  AOV_INDIRECT,      ///< light reaching the camera after two or more bounces
+  AOV_EMISSION,      ///< light emitted by the first hit (or the environment)
+  NUM_AOV_TYPES
+};
+
+/**
+ * AOV values of a single camera sample. Integrators fill in the AOVs they
+ * know about; AOVs that are not set do not count towards the pixel average.
+ */
+struct AOVSample {
+  AOVSample() : written(0) { }
+
+  void set(AOVType type, const Vector3D& v) {
+    value[type] = v;
+    written |= 1u << type;
+  }
+
+  Vector3D value[NUM_AOV_TYPES];
+  unsigned written;  ///< bit mask of the AOVs set
+};
+
+/**
+ * Registry and storage of the AOVs requested for a render. Only requested
+ * AOVs get buffers. Each pixel accumulates a sum and a sample count per AOV;
+ * the primitive ID keeps the value of the first sample instead since IDs do
+ * not average.
+ *
+ * Pixels are written only by the thread rendering the tile they belong to,
+ * so accumulation needs no locks or atomics.
+ */
+class AOVBuffers {
+ public:
+
+  AOVBuffers();
+
+  /**
+   * Name of an AOV as used on the command line and in output files.
+   */
+  static const char* name(AOVType type);
+
+  /**
+   * Number of meaningful channels of an AOV (1 or 3).
+   */
+  static size_t num_channels(AOVType type);
+
+  /**
+   * Request a comma separated list of AOV names, or "all".
+   * \return false if a name was not recognized
+   */
+  bool request(const std::string& names);
+  void request(AOVType type) { requested |= 1u << type; }
+
+  bool enabled(AOVType type) const { return requested & (1u << type); }
+  bool any() const { return requested != 0; }
+
+  /**
+   * Allocate and clear the buffers of the requested AOVs; all others are
+   * released.
+   */
+  void resize(size_t w, size_t h);
+
+  /**
+   * Reset all accumulated samples.
+   */
+  void clear();
+
+  /**
+   * Accumulate the AOVs written by one camera sample into pixel (x, y).
+   */
+  void add_sample(size_t x, size_t y, const AOVSample& sample);
+
+  /**
+   * Average of the samples of an AOV at pixel (x, y).
+   */
+  Vector3D get_pixel(AOVType type, size_t x, size_t y) const;
+
+  /**
+   * Write the per-pixel averages of an AOV into out.
+   */
+  void resolve(AOVType type, HDRImageBuffer* out) const;
+
+  size_t w, h;
+
+ private:
+
+  unsigned requested;                          ///< bit mask of requested AOVs
+  HDRImageBuffer sums[NUM_AOV_TYPES];          ///< accumulated values
+  std::vector<int> counts[NUM_AOV_TYPES];      ///< accumulated samples
+
+}; // class AOVBuffers
+
+} // namespace CGL
+
+#endif // CGL_AOV_H
@@ -2,7 +2,9 @@
 #include "bsdf.h"
 #include "bsdf.h"
 
+#ifndef CGL_HEADLESS
 #include "application/visual_debugger.h"
+#endif
 
 #include <algorithm>
 #include <iostream>
@@ -77,11 +79,13 @@ Vector3D DiffuseBSDF::sample_f(const Vector3D wo, Vector3D *wi, double *pdf) {
 
 void DiffuseBSDF::render_debugger_node()
 {
+#ifndef CGL_HEADLESS
   if (ImGui::TreeNode(this, "Diffuse BSDF"))
   {
     DragDouble3("Reflectance", &reflectance[0], 0.005);
     ImGui::TreePop();
   }
+#endif
 }
 
 /**
@@ -102,11 +106,13 @@ Vector3D EmissionBSDF::sample_f(const Vector3D wo, Vector3D *wi, double *pdf) {
 
 void EmissionBSDF::render_debugger_node()
 {
+#ifndef CGL_HEADLESS
   if (ImGui::TreeNode(this, "Emission BSDF"))
   {
     DragDouble3("Radiance", &radiance[0], 0.005);
     ImGui::TreePop();
   }
+#endif
 }
 
 } // namespace CGL
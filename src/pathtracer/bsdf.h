@@ -90,6 +90,14 @@ class BSDF {
    */
   virtual Vector3D get_emission () const = 0;
 
+  /**
+   * Get the albedo of the surface material, the fraction of light it
+   * scatters per color channel. Used to guide the denoiser; materials
+   * without a meaningful albedo report white.
+   * \return albedo Vector3D of the surface material
+   */
+  virtual Vector3D get_albedo () const { return Vector3D(1.0); }
+
   /**
    * If the BSDF is a delta distribution. Materials that are perfectly specular,
    * (e.g. water, glass, mirror) only scatter light from a single incident angle
@@ -131,6 +139,7 @@ class DiffuseBSDF : public BSDF {
   Vector3D f(const Vector3D wo, const Vector3D wi);
   Vector3D sample_f(const Vector3D wo, Vector3D* wi, double* pdf);
   Vector3D get_emission() const { return Vector3D(); }
+  Vector3D get_albedo() const { return reflectance; }
   bool is_delta() const { return false; }
 
   void render_debugger_node();
@@ -203,6 +212,7 @@ class MirrorBSDF : public BSDF {
   Vector3D f(const Vector3D wo, const Vector3D wi);
   Vector3D sample_f(const Vector3D wo, Vector3D* wi, double* pdf);
   Vector3D get_emission() const { return Vector3D(); }
+  Vector3D get_albedo() const { return reflectance; }
   bool is_delta() const { return true; }
 
   void render_debugger_node();
@@ -226,6 +236,7 @@ class RefractionBSDF : public BSDF {
   Vector3D f(const Vector3D wo, const Vector3D wi);
   Vector3D sample_f(const Vector3D wo, Vector3D* wi, double* pdf);
   Vector3D get_emission() const { return Vector3D(); }
+  Vector3D get_albedo() const { return transmittance; }
   bool is_delta() const { return true; }
 
   void render_debugger_node();
@@ -252,6 +263,7 @@ class GlassBSDF : public BSDF {
   Vector3D f(const Vector3D wo, const Vector3D wi);
   Vector3D sample_f(const Vector3D wo, Vector3D* wi, double* pdf);
   Vector3D get_emission() const { return Vector3D(); }
+  Vector3D get_albedo() const { return transmittance; }
   bool is_delta() const { return true; }
 
   void render_debugger_node();
@@ -0,0 +1,76 @@
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace CGL {
+
+static const char checkpoint_magic[8] = { 'P', 'T', 'C', 'K', 'P', 'T', 0, 1 };
+
+template <class T>
+static bool write_values(FILE* file, const T* values, size_t count) {
+  return count == 0 || fwrite(values, sizeof(T), count, file) == count;
+}
+
+template <class T>
+static bool read_values(FILE* file, T* values, size_t count) {
+  return count == 0 || fread(values, sizeof(T), count, file) == count;
+}
+
+bool RenderCheckpoint::save(const std::string& path) const {
+  std::string tmp_path = path + ".tmp";
+  FILE* file = fopen(tmp_path.c_str(), "wb");
+  if (!file) return false;
+
+  uint32_t header[9] = { w, h, samples, progressive, interleave, pass_index,
+                         pass_samples, samples_done, (uint32_t) tiles.size() };
+  bool ok = write_values(file, checkpoint_magic, 8) &&
+            write_values(file, header, 9) &&
+            write_values(file, &elapsed, 1) &&
+            write_values(file, tiles.data(), tiles.size()) &&
+            write_values(file, radiance.data(), radiance.size()) &&
+            write_values(file, counts.data(), counts.size());
+  ok = fclose(file) == 0 && ok;
+
+#ifdef _WIN32
+  // rename does not replace existing files here
+  if (ok) remove(path.c_str());
+#endif
+  if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    remove(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool RenderCheckpoint::load(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file) return false;
+
+  char magic[8];
+  uint32_t header[9];
+  bool ok = read_values(file, magic, 8) &&
+            memcmp(magic, checkpoint_magic, 8) == 0 &&
+            read_values(file, header, 9) &&
+            read_values(file, &elapsed, 1);
+  if (ok) {
+    w = header[0];
+    h = header[1];
+    samples = header[2];
+    progressive = header[3] != 0;
+    interleave = header[4] != 0;
+    pass_index = header[5];
+    pass_samples = header[6];
+    samples_done = header[7];
+    tiles.resize(header[8]);
+    radiance.resize((size_t) w * h);
+    counts.resize((size_t) w * h);
+    ok = read_values(file, tiles.data(), tiles.size()) &&
+         read_values(file, radiance.data(), radiance.size()) &&
+         read_values(file, counts.data(), counts.size());
+  }
+  fclose(file);
+  return ok;
+}
+
+} // namespace CGL
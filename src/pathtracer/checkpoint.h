@@ -0,0 +1,59 @@
+#ifndef CGL_CHECKPOINT_H
+#define CGL_CHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "CGL/vector3D.h"
+
+namespace CGL {
+
+/**
+ * Snapshot of a render in progress: the accumulated radiance and sample
+ * counts, the tiles and how many passes of each are done, and where
+ * progressive rendering was. Tiles draw their random numbers from a stream
+ * seeded by tile and pass, so rendering the remaining tiles continues the
+ * render exactly where the snapshot was taken.
+ *
+ * Saved in host byte order, so it is read back on the same kind of machine.
+ */
+struct RenderCheckpoint {
+
+  struct Tile {
+    uint32_t x, y;    ///< top left corner
+    uint32_t w, h;    ///< size
+    uint32_t passes;  ///< passes committed to the buffers
+  };
+
+  RenderCheckpoint() : w(0), h(0), samples(0), progressive(false),
+                       interleave(false), pass_index(0), pass_samples(0),
+                       samples_done(0), elapsed(0) { }
+
+  /**
+   * Write to a temporary file next to path, then move it over path, so a
+   * crash while saving leaves the previous checkpoint intact.
+   */
+  bool save(const std::string& path) const;
+
+  /**
+   * \return false if path cannot be read or is not a checkpoint
+   */
+  bool load(const std::string& path);
+
+  uint32_t w, h;                   ///< frame size
+  uint32_t samples;                ///< samples per pixel requested
+  bool progressive;                ///< rendered in progressive passes
+  bool interleave;                 ///< tiles are dealt out round-robin
+  uint32_t pass_index;             ///< current progressive pass
+  uint32_t pass_samples;           ///< samples per pixel of the current pass
+  uint32_t samples_done;           ///< samples per pixel of completed passes
+  double elapsed;                  ///< seconds rendered so far
+  std::vector<Tile> tiles;         ///< in the order they are handed out
+  std::vector<Vector3D> radiance;  ///< w x h estimate
+  std::vector<int> counts;         ///< w x h sample counts
+};
+
+} // namespace CGL
+
+#endif // CGL_CHECKPOINT_H
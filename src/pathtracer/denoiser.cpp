@@ -0,0 +1,124 @@
+#include "denoiser.h"
+
+#include <cmath>
+#include <thread>
+#include <algorithm>
+
+namespace CGL {
+
+// B3-spline weights of the 5x5 a-trous kernel, applied separably per tap
+static const double kernel[3] = { 3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0 };
+
+// keeps black albedo from blowing up the demodulated radiance
+static const double albedo_eps = 1e-3;
+
+Denoiser::Denoiser() {
+  iterations = 5;
+  sigma_color = 4.0;
+  sigma_normal = 0.1;
+  sigma_depth = 0.05;
+}
+
+void Denoiser::denoise(HDRImageBuffer& image, const Features& features,
+                       size_t num_threads) const {
+  size_t w = image.w;
+  size_t h = image.h;
+  if (w == 0 || h == 0) return;
+  num_threads = std::max(num_threads, (size_t) 1);
+
+  // filter irradiance rather than radiance so texture detail survives
+  HDRImageBuffer src(w, h), dst(w, h);
+  for (size_t i = 0; i < w * h; ++i) {
+    const Vector3D& a = features.albedo->data[i];
+    const Vector3D& c = image.data[i];
+    src.data[i] = Vector3D(c.x / (a.x + albedo_eps),
+                           c.y / (a.y + albedo_eps),
+                           c.z / (a.z + albedo_eps));
+  }
+
+  double sigma_c = sigma_color;
+  for (size_t it = 0; it < iterations; ++it) {
+    int step = 1 << it;
+    size_t rows = (h + num_threads - 1) / num_threads;
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; ++t) {
+      size_t y0 = t * rows;
+      size_t y1 = std::min(h, y0 + rows);
+      if (y0 >= y1) break;
+      threads.push_back(std::thread(&Denoiser::filter_rows, this,
+                                    std::cref(src), std::ref(dst),
+                                    std::cref(features), step, sigma_c,
+                                    y0, y1));
+    }
+    for (size_t t = 0; t < threads.size(); ++t) threads[t].join();
+
+    std::swap(src.data, dst.data);
+    sigma_c *= 0.5;
+  }
+
+  for (size_t i = 0; i < w * h; ++i) {
+    const Vector3D& a = features.albedo->data[i];
+    const Vector3D& c = src.data[i];
+    image.data[i] = Vector3D(c.x * (a.x + albedo_eps),
+                             c.y * (a.y + albedo_eps),
+                             c.z * (a.z + albedo_eps));
+  }
+}
+
+void Denoiser::filter_rows(const HDRImageBuffer& src, HDRImageBuffer& dst,
+                           const Features& features, int step, double sigma_c,
+                           size_t y0, size_t y1) const {
+  int w = src.w;
+  int h = src.h;
+  const std::vector<Vector3D>& normal = features.normal->data;
+  const std::vector<Vector3D>& depth = features.depth->data;
+
+  double inv_c = 1.0 / (sigma_c * sigma_c);
+  double inv_n = 1.0 / (sigma_normal * step * step);
+
+  for (int y = y0; y < (int) y1; ++y) {
+    for (int x = 0; x < w; ++x) {
+      size_t p = x + y * w;
+      const Vector3D& c_p = src.data[p];
+      const Vector3D& n_p = normal[p];
+      double z_p = depth[p].x;
+
+      Vector3D sum;
+      double weight_sum = 0;
+      for (int dy = -2; dy <= 2; ++dy) {
+        int qy = y + dy * step;
+        if (qy < 0 || qy >= h) continue;
+        for (int dx = -2; dx <= 2; ++dx) {
+          int qx = x + dx * step;
+          if (qx < 0 || qx >= w) continue;
+          size_t q = qx + qy * w;
+
+          double weight = kernel[std::abs(dx)] * kernel[std::abs(dy)];
+
+          Vector3D dc = src.data[q] - c_p;
+          weight *= exp(-dot(dc, dc) * inv_c);
+
+          Vector3D dn = normal[q] - n_p;
+          weight *= exp(-dot(dn, dn) * inv_n);
+
+          // background only blends with background
+          double z_q = depth[q].x;
+          if (std::isinf(z_p) || std::isinf(z_q)) {
+            if (std::isinf(z_p) != std::isinf(z_q)) continue;
+          } else {
+            double dz = fabs(z_p - z_q) / (std::max(z_p, 1e-4) * step);
+            weight *= exp(-dz / sigma_depth);
+          }
+
+          sum += weight * src.data[q];
+          weight_sum += weight;
+        }
+      }
+
+      dst.data[p] = weight_sum > 0 ? sum / weight_sum : c_p;
+    }
+  }
+}
+
+} // namespace CGL
@@ -0,0 +1,59 @@
+#ifndef CGL_DENOISER_H
+#define CGL_DENOISER_H
+
+#include <vector>
+
+#include "util/image.h"
+
+namespace CGL {
+
+/**
+ * Edge-avoiding a-trous wavelet denoiser (Dammertz et al. 2010).
+ *
+ * The noisy radiance is divided by the first-hit albedo, smoothed with a
+ * sequence of 5x5 B3-spline filters whose taps are spread 1, 2, 4, ... pixels
+ * apart, and multiplied back by the albedo. Every tap is weighted by how
+ * similar its color, shading normal and depth are to the center pixel, so
+ * the filter blurs noise but stops at geometric and texture edges.
+ */
+class Denoiser {
+ public:
+
+  Denoiser();
+
+  /**
+   * Feature buffers produced alongside the radiance, one entry per pixel.
+   * Pixels whose camera ray missed the scene have infinite depth.
+   */
+  struct Features {
+    const HDRImageBuffer* albedo;  ///< first-hit surface albedo
+    const HDRImageBuffer* normal;  ///< first-hit shading normal
+    const HDRImageBuffer* depth;   ///< first-hit distance along the ray in x
+  };
+
+  /**
+   * Denoise the image in place using num_threads threads.
+   */
+  void denoise(HDRImageBuffer& image, const Features& features,
+               size_t num_threads) const;
+
+  size_t iterations;    ///< number of a-trous passes (filter footprint 2^(i+2)+1)
+  double sigma_color;   ///< color edge-stopping strength, halved every pass
+  double sigma_normal;  ///< normal edge-stopping strength
+  double sigma_depth;   ///< relative depth edge-stopping strength
+
+ private:
+
+  /**
+   * One a-trous pass over rows [y0, y1) of src into dst with the given
+   * tap spacing.
+   */
+  void filter_rows(const HDRImageBuffer& src, HDRImageBuffer& dst,
+                   const Features& features, int step, double sigma_c,
+                   size_t y0, size_t y1) const;
+
+}; // class Denoiser
+
+} // namespace CGL
+
+#endif // CGL_DENOISER_H
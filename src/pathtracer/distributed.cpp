@@ -0,0 +1,588 @@
+#include "distributed.h"
+
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <condition_variable>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+using std::string;
+using std::vector;
+
+namespace CGL {
+
+namespace {
+
+enum MessageType {
+  MSG_HELLO = 1,   ///< worker -> coordinator: frame width and height
+  MSG_REGION,      ///< coordinator -> worker: RenderRegion to render
+  MSG_RESULT,      ///< worker -> coordinator: RenderRegion, RGB floats, counts
+  MSG_FINISHED,    ///< coordinator -> worker: no more regions
+  MSG_PROGRESS     ///< worker -> coordinator: still making progress, no payload
+};
+
+/// seconds between progress reports of a worker
+const double PROGRESS_INTERVAL = 1;
+
+/// seconds spawned workers get to exit after a render before they are killed
+const double EXIT_GRACE = 5;
+
+struct MessageHeader {
+  uint32_t type;
+  uint32_t size;  ///< payload bytes following the header
+};
+
+struct Address {
+  bool is_unix;
+  string path;    ///< Unix socket path
+  string host;
+  string port;
+};
+
+bool parse_address(const string& address, Address* out) {
+  string rest = address;
+  out->is_unix = false;
+  out->host = "127.0.0.1";
+  if (rest.compare(0, 5, "unix:") == 0) {
+    out->is_unix = true;
+    out->path = rest.substr(5);
+    return !out->path.empty();
+  }
+  if (rest.compare(0, 4, "tcp:") == 0) rest = rest.substr(4);
+  size_t colon = rest.rfind(':');
+  if (colon != string::npos) {
+    if (colon > 0) out->host = rest.substr(0, colon);
+    rest = rest.substr(colon + 1);
+  }
+  out->port = rest;
+  return !out->port.empty() &&
+         out->port.find_first_not_of("0123456789") == string::npos;
+}
+
+#ifndef _WIN32
+
+bool write_all(int fd, const void* data, size_t size) {
+  const char* p = (const char*) data;
+  while (size > 0) {
+    ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool read_all(int fd, void* data, size_t size) {
+  char* p = (char*) data;
+  while (size > 0) {
+    ssize_t n = recv(fd, p, size, 0);
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool write_message(int fd, MessageType type, const void* payload, size_t size) {
+  MessageHeader header = { (uint32_t) type, (uint32_t) size };
+  return write_all(fd, &header, sizeof(header)) &&
+         (size == 0 || write_all(fd, payload, size));
+}
+
+/**
+ * Open a socket for address, bound and listening or connected.
+ */
+int open_socket(const Address& address, bool server) {
+  if (address.is_unix) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (address.path.size() >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, address.path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int ret = server
+        ? bind(fd, (sockaddr*) &addr, sizeof(addr)) || ::listen(fd, 64)
+        : ::connect(fd, (sockaddr*) &addr, sizeof(addr));
+    if (ret != 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* results;
+  if (getaddrinfo(address.host.c_str(), address.port.c_str(), &hints, &results) != 0) {
+    return -1;
+  }
+
+  int fd = -1;
+  for (addrinfo* ai = results; ai && fd < 0; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) continue;
+    int one = 1;
+    int ret;
+    if (server) {
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      ret = bind(fd, ai->ai_addr, ai->ai_addrlen) || ::listen(fd, 64);
+    } else {
+      ret = ::connect(fd, ai->ai_addr, ai->ai_addrlen);
+      // region requests are tiny; do not hold them back
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    if (ret != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(results);
+  return fd;
+}
+
+/**
+ * Region bookkeeping shared by the threads serving the workers.
+ */
+struct RegionScheduler {
+  std::mutex lock;
+  std::condition_variable changed;
+  vector<RenderRegion> regions;
+  std::deque<size_t> pending;   ///< regions not handed out (or handed back)
+  size_t merged;
+  size_t workers;               ///< workers currently connected
+  size_t connected;             ///< workers that ever connected
+  bool aborted;                 ///< the render failed; let the workers go
+
+  SampleBuffer* buffer;
+
+  bool finished() const { return merged == regions.size(); }
+};
+
+/**
+ * Make reads and writes on fd fail after seconds without progress.
+ */
+void set_socket_timeout(int fd, double seconds) {
+  timeval tv;
+  tv.tv_sec = (time_t) seconds;
+  tv.tv_usec = (suseconds_t) ((seconds - tv.tv_sec) * 1e6);
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/**
+ * Read the header of the next message from a worker other than a progress
+ * report.
+ */
+bool read_reply(int fd, MessageHeader* header) {
+  while (read_all(fd, header, sizeof(*header))) {
+    if (header->type != MSG_PROGRESS) return true;
+    if (header->size != 0) return false;
+  }
+  return false;
+}
+
+/**
+ * Serve one worker: hand out regions and merge what it returns until all
+ * regions are done or the worker goes away. A worker that reports no
+ * progress for timeout seconds counts as gone.
+ */
+void serve_worker(RegionScheduler* scheduler, int fd, size_t frame_w, size_t frame_h,
+                  double timeout) {
+  if (timeout > 0) set_socket_timeout(fd, timeout);
+
+  MessageHeader header;
+  uint32_t size[2];
+  if (!read_all(fd, &header, sizeof(header)) || header.type != MSG_HELLO ||
+      header.size != sizeof(size) || !read_all(fd, size, sizeof(size))) {
+    close(fd);
+    return;
+  }
+  if (size[0] != frame_w || size[1] != frame_h) {
+    fprintf(stderr, "\n[PathTracer] Rejected worker rendering at %ux%u instead of %zux%zu\n",
+            size[0], size[1], frame_w, frame_h);
+    close(fd);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lk(scheduler->lock);
+    scheduler->workers++;
+    scheduler->connected++;
+  }
+
+  vector<char> payload;
+  bool finished = false;
+  while (true) {
+    size_t index;
+    {
+      // wait for a region, or for the render to be done; regions of
+      // workers that drop out come back to the pending list
+      std::unique_lock<std::mutex> lk(scheduler->lock);
+      scheduler->changed.wait(lk, [scheduler]{
+        return scheduler->finished() || scheduler->aborted ||
+               !scheduler->pending.empty();
+      });
+      finished = scheduler->finished();
+      if (finished || scheduler->aborted) break;
+      index = scheduler->pending.front();
+      scheduler->pending.pop_front();
+    }
+
+    const RenderRegion& region = scheduler->regions[index];
+    size_t pixels = (size_t) region.w * region.h;
+    size_t expected = sizeof(RenderRegion) + pixels * (3 * sizeof(float) + sizeof(int32_t));
+    payload.resize(expected);
+
+    errno = 0;
+    bool ok = write_message(fd, MSG_REGION, &region, sizeof(region)) &&
+              read_reply(fd, &header) &&
+              header.type == MSG_RESULT && header.size == expected &&
+              read_all(fd, &payload[0], expected) &&
+              memcmp(&payload[0], &region, sizeof(region)) == 0;
+
+    std::lock_guard<std::mutex> lk(scheduler->lock);
+    if (!ok) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        fprintf(stderr, "\n[PathTracer] Worker made no progress on region %zu for %.0fs, "
+                "handing it to another worker\n", index, timeout);
+      }
+      scheduler->pending.push_front(index);
+      scheduler->changed.notify_all();
+      break;
+    }
+
+    const float* radiance = (const float*) &payload[sizeof(RenderRegion)];
+    const int32_t* counts = (const int32_t*) (radiance + 3 * pixels);
+    for (size_t y = 0; y < region.h; ++y) {
+      for (size_t x = 0; x < region.w; ++x) {
+        size_t src = x + y * region.w;
+        size_t dst = (region.x + x) + (region.y + y) * frame_w;
+        scheduler->buffer->set(dst, Vector3D(radiance[3 * src],
+                                             radiance[3 * src + 1],
+                                             radiance[3 * src + 2]),
+                               counts[src]);
+      }
+    }
+    scheduler->merged++;
+    if (scheduler->finished()) scheduler->changed.notify_all();
+  }
+
+  if (finished) write_message(fd, MSG_FINISHED, NULL, 0);
+  close(fd);
+
+  std::lock_guard<std::mutex> lk(scheduler->lock);
+  scheduler->workers--;
+}
+
+#endif // _WIN32
+
+} // namespace
+
+#ifndef _WIN32
+
+RenderCoordinator::RenderCoordinator(const string& address)
+    : address(address), listenFd(-1), succeeded(false), timeout(120) {
+  if (this->address.empty()) {
+    char path[64];
+    snprintf(path, sizeof(path), "unix:/tmp/pathtracer-%d.sock", (int) getpid());
+    this->address = path;
+  }
+}
+
+RenderCoordinator::~RenderCoordinator() {
+  if (listenFd >= 0) close(listenFd);
+  if (!unixPath.empty()) unlink(unixPath.c_str());
+  // workers that were told to finish exit on their own; a hung one that was
+  // dropped never would
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < children.size(); ++i) {
+    while (succeeded && waitpid(children[i], NULL, WNOHANG) == 0) {
+      std::chrono::duration<double> waited = std::chrono::steady_clock::now() - start;
+      if (waited.count() > EXIT_GRACE) break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    kill(children[i], SIGTERM);
+    waitpid(children[i], NULL, 0);
+  }
+}
+
+bool RenderCoordinator::listen() {
+  Address parsed;
+  if (!parse_address(address, &parsed)) {
+    fprintf(stderr, "[PathTracer] Invalid coordinator address '%s'\n", address.c_str());
+    return false;
+  }
+  // a stale socket file from an earlier run would make bind fail
+  if (parsed.is_unix) unlink(parsed.path.c_str());
+
+  listenFd = open_socket(parsed, true);
+  if (listenFd < 0) {
+    fprintf(stderr, "[PathTracer] Could not listen on '%s': %s\n",
+            address.c_str(), strerror(errno));
+    return false;
+  }
+  if (parsed.is_unix) unixPath = parsed.path;
+  fcntl(listenFd, F_SETFD, FD_CLOEXEC);
+  fprintf(stdout, "[PathTracer] Coordinator listening on %s\n", address.c_str());
+  return true;
+}
+
+bool RenderCoordinator::spawn_workers(const vector<string>& args, size_t count) {
+  if (args.empty()) return false;
+  vector<char*> argv;
+  for (size_t i = 0; i < args.size(); ++i) argv.push_back((char*) args[i].c_str());
+  argv.push_back(NULL);
+
+  // prefer the running binary itself over a lookup of argv[0] in PATH
+  const char* program = access("/proc/self/exe", X_OK) == 0 ? "/proc/self/exe" : argv[0];
+
+  fflush(stdout);
+  fflush(stderr);
+  for (size_t i = 0; i < count; ++i) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      fprintf(stderr, "[PathTracer] Could not start worker %zu: %s\n", i, strerror(errno));
+      return false;
+    }
+    if (pid == 0) {
+      int devnull = open("/dev/null", O_WRONLY);
+      if (devnull >= 0) dup2(devnull, STDOUT_FILENO);
+      execv(program, &argv[0]);
+      fprintf(stderr, "[PathTracer] Could not run %s: %s\n", program, strerror(errno));
+      _exit(127);
+    }
+    children.push_back(pid);
+  }
+  fprintf(stdout, "[PathTracer] Started %zu worker processes\n", count);
+  return true;
+}
+
+bool RenderCoordinator::render(size_t w, size_t h, size_t region_size,
+                               SampleBuffer* buffer) {
+  if (listenFd < 0) return false;
+  region_size = std::max(region_size, (size_t) 1);
+
+  RegionScheduler scheduler;
+  scheduler.merged = 0;
+  scheduler.workers = 0;
+  scheduler.connected = 0;
+  scheduler.aborted = false;
+  scheduler.buffer = buffer;
+  for (size_t y = 0; y < h; y += region_size) {
+    for (size_t x = 0; x < w; x += region_size) {
+      RenderRegion region = { (uint32_t) x, (uint32_t) y,
+                              (uint32_t) std::min(region_size, w - x),
+                              (uint32_t) std::min(region_size, h - y) };
+      scheduler.pending.push_back(scheduler.regions.size());
+      scheduler.regions.push_back(region);
+    }
+  }
+
+  vector<std::thread> servers;
+  size_t alive = children.size();
+  const char* failure = NULL;
+  std::chrono::steady_clock::time_point last_connected = std::chrono::steady_clock::now();
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lk(scheduler.lock);
+      fprintf(stdout, "\r[PathTracer] Distributed rendering... %d%% (%zu workers)   ",
+              int(100.0 * scheduler.merged / std::max(scheduler.regions.size(), (size_t) 1)),
+              scheduler.workers);
+      fflush(stdout);
+      if (scheduler.finished()) break;
+
+      // with only local workers, give up once they are all gone
+      if (!children.empty() && alive == 0 && scheduler.workers == 0) {
+        failure = "All workers exited before the render was done";
+        scheduler.aborted = true;
+        break;
+      }
+
+      // nor wait forever for workers that never connect; spawned workers
+      // may take long to load the scene, but they all load the same one, so
+      // once one connected the others are not waited for either
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      bool loading = alive > 0 && scheduler.connected == 0;
+      if (scheduler.workers > 0 || loading) {
+        last_connected = now;
+      } else if (timeout > 0 &&
+                 std::chrono::duration<double>(now - last_connected).count() > timeout) {
+        failure = "No worker connected before the timeout";
+        scheduler.aborted = true;
+        break;
+      }
+    }
+
+    pollfd listening = { listenFd, POLLIN, 0 };
+    if (poll(&listening, 1, 500) > 0) {
+      int fd = accept(listenFd, NULL, NULL);
+      if (fd >= 0) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        servers.push_back(std::thread(serve_worker, &scheduler, fd, w, h, timeout));
+      }
+    }
+
+    for (size_t i = 0; i < children.size(); ++i) {
+      if (children[i] > 0 && waitpid(children[i], NULL, WNOHANG) == children[i]) {
+        children[i] = -children[i];  // reaped
+        alive--;
+      }
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lk(scheduler.lock);
+    scheduler.changed.notify_all();
+  }
+  for (size_t i = 0; i < servers.size(); ++i) servers[i].join();
+
+  // forget the reaped workers
+  vector<int> running;
+  for (size_t i = 0; i < children.size(); ++i) {
+    if (children[i] > 0) running.push_back(children[i]);
+  }
+  children.swap(running);
+
+  if (scheduler.aborted) {
+    fprintf(stderr, "\n[PathTracer] %s\n", failure);
+    return false;
+  }
+  fprintf(stdout, "\r[PathTracer] Distributed rendering... 100%%! (%zu regions)\n",
+          scheduler.regions.size());
+  succeeded = true;
+  return true;
+}
+
+RenderWorkerConnection::~RenderWorkerConnection() {
+  {
+    std::lock_guard<std::mutex> lk(reporterLock);
+    stopping = true;
+  }
+  reporterWake.notify_all();
+  if (reporter.joinable()) reporter.join();
+  if (fd >= 0) close(fd);
+}
+
+bool RenderWorkerConnection::connect(const string& address,
+                                     size_t frame_w, size_t frame_h) {
+  Address parsed;
+  if (!parse_address(address, &parsed)) {
+    fprintf(stderr, "[PathTracer] Invalid coordinator address '%s'\n", address.c_str());
+    return false;
+  }
+  fd = open_socket(parsed, false);
+  if (fd < 0) {
+    fprintf(stderr, "[PathTracer] Could not connect to coordinator at '%s': %s\n",
+            address.c_str(), strerror(errno));
+    return false;
+  }
+  uint32_t size[2] = { (uint32_t) frame_w, (uint32_t) frame_h };
+  return write_message(fd, MSG_HELLO, size, sizeof(size));
+}
+
+void RenderWorkerConnection::report_progress(std::function<size_t()> progress) {
+  if (fd < 0 || reporter.joinable()) return;
+  reporter = std::thread([this, progress]{
+    size_t last = progress();
+    std::unique_lock<std::mutex> lk(reporterLock);
+    while (!reporterWake.wait_for(lk, std::chrono::duration<double>(PROGRESS_INTERVAL),
+                                  [this]{ return stopping; })) {
+      size_t now = progress();
+      if (now == last) continue;
+      last = now;
+      std::lock_guard<std::mutex> send(sending);
+      if (!write_message(fd, MSG_PROGRESS, NULL, 0)) break;
+    }
+  });
+}
+
+bool RenderWorkerConnection::next_region(RenderRegion* region) {
+  MessageHeader header;
+  if (fd < 0 || !read_all(fd, &header, sizeof(header))) return false;
+  if (header.type != MSG_REGION || header.size != sizeof(RenderRegion)) return false;
+  return read_all(fd, region, sizeof(RenderRegion));
+}
+
+bool RenderWorkerConnection::send_result(const RenderRegion& region,
+                                         const vector<float>& radiance,
+                                         const vector<int32_t>& counts) {
+  size_t pixels = (size_t) region.w * region.h;
+  if (radiance.size() != 3 * pixels || counts.size() != pixels) return false;
+  MessageHeader header = { (uint32_t) MSG_RESULT,
+      (uint32_t) (sizeof(region) + pixels * (3 * sizeof(float) + sizeof(int32_t))) };
+  std::lock_guard<std::mutex> lk(sending);
+  return write_all(fd, &header, sizeof(header)) &&
+         write_all(fd, &region, sizeof(region)) &&
+         write_all(fd, &radiance[0], radiance.size() * sizeof(float)) &&
+         write_all(fd, &counts[0], counts.size() * sizeof(int32_t));
+}
+
+#else // _WIN32
+
+RenderCoordinator::RenderCoordinator(const string& address)
+    : address(address), listenFd(-1), succeeded(false), timeout(120) { }
+
+RenderCoordinator::~RenderCoordinator() { }
+
+bool RenderCoordinator::listen() {
+  fprintf(stderr, "[PathTracer] Distributed rendering is not supported on Windows\n");
+  return false;
+}
+
+bool RenderCoordinator::spawn_workers(const vector<string>& args, size_t count) {
+  return false;
+}
+
+bool RenderCoordinator::render(size_t w, size_t h, size_t region_size,
+                               SampleBuffer* buffer) {
+  return false;
+}
+
+RenderWorkerConnection::~RenderWorkerConnection() { }
+
+void RenderWorkerConnection::report_progress(std::function<size_t()> progress) { }
+
+bool RenderWorkerConnection::connect(const string& address,
+                                     size_t frame_w, size_t frame_h) {
+  fprintf(stderr, "[PathTracer] Distributed rendering is not supported on Windows\n");
+  return false;
+}
+
+bool RenderWorkerConnection::next_region(RenderRegion* region) {
+  return false;
+}
+
+bool RenderWorkerConnection::send_result(const RenderRegion& region,
+                                         const vector<float>& radiance,
+                                         const vector<int32_t>& counts) {
+  return false;
+}
+
+#endif // _WIN32
+
+} // namespace CGL
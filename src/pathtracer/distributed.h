@@ -0,0 +1,147 @@
+#ifndef CGL_DISTRIBUTED_H
+#define CGL_DISTRIBUTED_H
+
+#include <string>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+
+#include "util/sample_buffer.h"
+
+namespace CGL {
+
+/**
+ * Rectangle of the image handed to a worker process.
+ */
+struct RenderRegion {
+  uint32_t x, y;  ///< top left corner
+  uint32_t w, h;  ///< size
+};
+
+/**
+ * Coordinator of a render spread over worker processes.
+ *
+ * Workers connect over a Unix or TCP socket (see parse_address) and are
+ * handed regions of the image one at a time, so fast workers take more of
+ * them. Each returns the HDR radiance and sample counts of its region,
+ * which are merged into one buffer. While rendering, workers report each
+ * bit of progress, so a slow region is told apart from a hung worker: a
+ * region whose worker disconnects, or reports no progress for longer than
+ * the timeout, is handed to the next worker that asks.
+ *
+ * Messages are sent in host byte order, so all processes must run on
+ * machines of the same endianness (normally the same binary on one box).
+ */
+class RenderCoordinator {
+ public:
+
+  /**
+   * \param address "unix:<path>", "tcp:<host>:<port>", "<host>:<port>" or
+   *                "<port>" (on 127.0.0.1); empty for a Unix socket in /tmp
+   */
+  RenderCoordinator(const std::string& address);
+
+  /**
+   * Closes the socket and waits for (or, if the render failed, kills) the
+   * spawned workers.
+   */
+  ~RenderCoordinator();
+
+  const std::string& get_address() const { return address; }
+
+  /**
+   * Seconds a worker may go without reporting progress before it is dropped
+   * and its region handed to another. Also how long a render waits with no
+   * worker connected before it fails; while spawned workers are still
+   * loading the scene (none has connected yet) it waits for them instead.
+   * 0 waits forever.
+   */
+  void set_timeout(double seconds) { timeout = seconds; }
+
+  /**
+   * Start accepting workers.
+   * \return false if the address is invalid or in use
+   */
+  bool listen();
+
+  /**
+   * Start count local worker processes running the program with args
+   * (args[0] being the program). Their standard output is discarded.
+   */
+  bool spawn_workers(const std::vector<std::string>& args, size_t count);
+
+  /**
+   * Render a w x h image in regions of at most region_size pixels square,
+   * merging the results into buffer (already of size w x h).
+   * Returns once every region is merged.
+   * \return false if all spawned workers died, or no worker was connected
+   *         for the timeout (see set_timeout), before the image was done
+   */
+  bool render(size_t w, size_t h, size_t region_size,
+              SampleBuffer* buffer);
+
+ private:
+
+  std::string address;
+  std::string unixPath;        ///< socket file to remove, if any
+  int listenFd;
+  std::vector<int> children;   ///< pids of the spawned workers
+  double timeout;              ///< seconds, 0 for none
+  bool succeeded;
+
+}; // class RenderCoordinator
+
+/**
+ * Connection of a worker process to the coordinator.
+ */
+class RenderWorkerConnection {
+ public:
+
+  RenderWorkerConnection() : fd(-1), stopping(false) { }
+  ~RenderWorkerConnection();
+
+  /**
+   * Connect to the coordinator and announce the frame size this worker
+   * renders at, which must match the coordinator's.
+   */
+  bool connect(const std::string& address, size_t frame_w, size_t frame_h);
+
+  /**
+   * Tell the coordinator, about once a second, whenever progress (any
+   * count that grows while a region renders, e.g. tiles done) has changed,
+   * until the connection is closed. A worker that stops making progress
+   * goes silent and is dropped after the coordinator's timeout.
+   */
+  void report_progress(std::function<size_t()> progress);
+
+  /**
+   * Wait for the next region to render.
+   * \return false once the coordinator has no more work or went away
+   */
+  bool next_region(RenderRegion* region);
+
+  /**
+   * Return the radiance (RGB per pixel, row by row) and sample counts of a
+   * region.
+   */
+  bool send_result(const RenderRegion& region,
+                   const std::vector<float>& radiance,
+                   const std::vector<int32_t>& counts);
+
+ private:
+  int fd;
+
+  std::thread reporter;
+  std::mutex sending;          ///< progress and results share the socket
+  std::mutex reporterLock;
+  std::condition_variable reporterWake;
+  bool stopping;
+
+}; // class RenderWorkerConnection
+
+} // namespace CGL
+
+#endif // CGL_DISTRIBUTED_H
@@ -3,20 +3,37 @@
 #include "scene/light.h"
 #include "scene/sphere.h"
 #include "scene/triangle.h"
+#include "pathtracer/render_cost.h"
 
 
 using namespace CGL::SceneObjects;
 
 namespace CGL {
 
+// tile block the calling render thread is accumulating into, if any
+static thread_local TileBlock* tile_block = NULL;
+
+/**
+ * AOVs of the camera sample a render thread is tracing, and the pixel they
+ * accumulate into.
+ */
+struct AOVRecord {
+  size_t x, y;
+  bool tracing;     ///< a camera sample is being traced
+  bool hit;         ///< its camera ray hit the scene
+  size_t depth;     ///< depth of its camera ray
+  AOVSample sample;
+};
+
+// AOV record of the calling render thread, if AOVs are requested
+static thread_local AOVRecord* aov_record = NULL;
+
 PathTracer::PathTracer() {
+  lightBVH = NULL;
+  ns_light_bvh = 0;
+
   gridSampler = new UniformGridSampler2D();
   hemisphereSampler = new UniformHemisphereSampler3D();
-
-  tm_gamma = 2.2f;
-  tm_level = 1.0f;
-  tm_key = 0.18;
-  tm_wht = 5.0f;
 }
 
 PathTracer::~PathTracer() {
@@ -26,22 +43,102 @@ PathTracer::~PathTracer() {
 
 void PathTracer::set_frame_size(size_t width, size_t height) {
   sampleBuffer.resize(width, height);
-  sampleCountBuffer.resize(width * height);
+  aovs.resize(width, height);
 }
 
 void PathTracer::clear() {
   bvh = NULL;
+  lightBVH = NULL;
   scene = NULL;
   camera = NULL;
-  sampleBuffer.clear();
-  sampleCountBuffer.clear();
   sampleBuffer.resize(0, 0);
-  sampleCountBuffer.resize(0, 0);
+  aovs.resize(0, 0);
 }
 
 void PathTracer::write_to_framebuffer(ImageBuffer &framebuffer, size_t x0,
                                       size_t y0, size_t x1, size_t y1) {
-  sampleBuffer.toColor(framebuffer, x0, y0, x1, y1);
+  tonemapper.apply(sampleBuffer, framebuffer, x0, y0, x1, y1);
+}
+
+void PathTracer::refresh_framebuffer(ImageBuffer &framebuffer, size_t num_threads,
+                                     float tolerance) {
+  bool moved = tonemapper.update(sampleBuffer, num_threads, tolerance);
+  if (tolerance > 0 && tonemapper.is_global() && !moved) return;
+  tonemapper.apply(sampleBuffer, framebuffer, num_threads);
+}
+
+void PathTracer::bind_tile_block(TileBlock* block) {
+  tile_block = block;
+}
+
+void PathTracer::bind_aov_pixel(size_t x, size_t y) {
+  static thread_local AOVRecord record;
+  record.x = x;
+  record.y = y;
+  record.tracing = false;
+  aov_record = &record;
+}
+
+void PathTracer::unbind_aov_pixel() {
+  aov_record = NULL;
+}
+
+void PathTracer::begin_aov_sample(const Ray& r, const Intersection* isect) {
+  if (!aov_record) return;
+  AOVRecord& rec = *aov_record;
+  rec.tracing = true;
+  rec.hit = isect != NULL;
+  rec.depth = r.depth;
+  rec.sample = AOVSample();
+
+  AOVSample& aov = rec.sample;
+  if (!isect) {
+    // misses keep a white albedo so the background is not demodulated
+    aov.set(AOV_DEPTH, Vector3D(INF_D));
+    aov.set(AOV_NORMAL, Vector3D());
+    aov.set(AOV_ALBEDO, Vector3D(1.0));
+    aov.set(AOV_PRIMITIVE_ID, Vector3D(-1));
+    return;
+  }
+  aov.set(AOV_DEPTH, Vector3D(isect->t));
+  aov.set(AOV_NORMAL, isect->n);
+  aov.set(AOV_ALBEDO, isect->bsdf ? isect->bsdf->get_albedo() : Vector3D(1.0));
+  if (aovs.enabled(AOV_PRIMITIVE_ID)) {
+    auto id = primitiveIds.find(isect->primitive);
+    aov.set(AOV_PRIMITIVE_ID,
+            Vector3D(id != primitiveIds.end() ? id->second : -1));
+  }
+}
+
+void PathTracer::record_aov(const Ray& r, AOVType type, const Vector3D& L) {
+  if (!aov_record || !aov_record->tracing || r.depth != aov_record->depth)
+    return;
+  AOVSample& aov = aov_record->sample;
+  if (!(aov.written & (1u << type))) aov.set(type, L);
+}
+
+Vector3D PathTracer::end_aov_sample(const Vector3D& L) {
+  if (!aov_record || !aov_record->tracing) return L;
+  AOVRecord& rec = *aov_record;
+  AOVSample& aov = rec.sample;
+  rec.tracing = false;
+
+  // all light of a miss comes from the environment
+  if (!rec.hit) aov.set(AOV_EMISSION, L);
+  if (!(aov.written & (1u << AOV_EMISSION))) aov.set(AOV_EMISSION, Vector3D());
+  if (!(aov.written & (1u << AOV_DIRECT))) aov.set(AOV_DIRECT, Vector3D());
+  aov.set(AOV_INDIRECT, L - aov.value[AOV_EMISSION] - aov.value[AOV_DIRECT]);
+  aovs.add_sample(rec.x, rec.y, aov);
+  return L;
+}
+
+void PathTracer::store_pixel(size_t x, size_t y, const Vector3D& radiance,
+                             int num_samples) {
+  if (tile_block && tile_block->contains(x, y)) {
+    tile_block->set(x, y, radiance, num_samples);
+    return;
+  }
+  sampleBuffer.update_pixel(radiance, num_samples, x, y);
 }
 
 Vector3D
@@ -97,20 +194,64 @@ PathTracer::estimate_direct_lighting_importance(const Ray &r,
   const Vector3D w_out = w2o * (-r.d);
   Vector3D L_out;
 
+  // With many lights, pick a few from the light BVH instead of looping
+  // over all of them.
+  if (lightBVH && ns_light_bvh > 0)
+    return estimate_direct_lighting_light_bvh(r, isect);
+
 
   return Vector3D(1.0);
 
 }
 
+Vector3D
+PathTracer::estimate_direct_lighting_light_bvh(const Ray &r,
+                                               const Intersection &isect) {
+  Matrix3x3 o2w;
+  make_coord_space(o2w, isect.n);
+  Matrix3x3 w2o = o2w.T();
+
+  const Vector3D hit_p = r.o + r.d * isect.t;
+  const Vector3D w_out = w2o * (-r.d);
+  Vector3D L_out;
+
+  // Each sample picks one light with probability pmf, roughly proportional
+  // to its contribution at hit_p, and takes one sample of it.
+  for (size_t i = 0; i < ns_light_bvh; i++) {
+    double pmf;
+    const SceneLight *light =
+        lightBVH->sample(hit_p, isect.n, random_uniform(), &pmf);
+    if (!light || pmf <= 0)
+      continue;
+
+    Vector3D wi;
+    double distToLight, pdf;
+    Vector3D L = light->sample_L(hit_p, &wi, &distToLight, &pdf);
+    Vector3D w_in = w2o * wi;
+    if (w_in.z <= 0 || pdf <= 0)
+      continue;
+
+    Ray shadow(hit_p, wi);
+    shadow.min_t = EPS_F;
+    shadow.max_t = distToLight - EPS_F;
+    if (bvh->has_intersection(shadow))
+      continue;
+
+    L_out += isect.bsdf->f(w_out, w_in) * L * w_in.z / (pdf * pmf);
+  }
+
+  return L_out / ns_light_bvh;
+}
+
 Vector3D PathTracer::zero_bounce_radiance(const Ray &r,
                                           const Intersection &isect) {
   // TODO: Part 3, Task 2
   // Returns the light that results from no bounces of light
+  Vector3D L_out(1.0);
 
 
-  return Vector3D(1.0);
-
-
+  record_aov(r, AOV_EMISSION, L_out);
+  return L_out;
 }
 
 Vector3D PathTracer::one_bounce_radiance(const Ray &r,
@@ -118,11 +259,11 @@ Vector3D PathTracer::one_bounce_radiance(const Ray &r,
   // TODO: Part 3, Task 3
   // Returns either the direct illumination by hemisphere or importance sampling
   // depending on `direct_hemisphere_sample`
+  Vector3D L_out(1.0);
 
 
-  return Vector3D(1.0);
-
-
+  record_aov(r, AOV_DIRECT, L_out);
+  return L_out;
 }
 
 Vector3D PathTracer::at_least_one_bounce_radiance(const Ray &r,
@@ -135,6 +276,7 @@ Vector3D PathTracer::at_least_one_bounce_radiance(const Ray &r,
   Vector3D w_out = w2o * (-r.d);
 
   Vector3D L_out(0, 0, 0);
+  COUNT_RAY_EVENT(bounces);
 
   // TODO: Part 4, Task 2
   // Returns the one bounce radiance + radiance from extra bounces at this point.
@@ -158,9 +300,11 @@ Vector3D PathTracer::est_radiance_global_illumination(const Ray &r) {
   //
   // REMOVE THIS LINE when you are ready to begin Part 3.
   
-  if (!bvh->intersect(r, &isect))
-    return envLight ? envLight->sample_dir(r) : L_out;
-
+  if (!bvh->intersect(r, &isect)) {
+    begin_aov_sample(r, NULL);
+    return end_aov_sample(envLight ? envLight->sample_dir(r) : L_out);
+  }
+  begin_aov_sample(r, &isect);
 
   L_out = (isect.t == INF_D) ? debug_shading(r.d) : normal_shading(isect.n);
 
@@ -169,7 +313,7 @@ Vector3D PathTracer::est_radiance_global_illumination(const Ray &r) {
   // TODO (Part 4): Accumulate the "direct" and "indirect"
   // parts of global illumination into L_out rather than just direct
 
-  return L_out;
+  return end_aov_sample(L_out);
 }
 
 void PathTracer::raytrace_pixel(size_t x, size_t y) {
@@ -185,8 +329,7 @@ void PathTracer::raytrace_pixel(size_t x, size_t y) {
   Vector2D origin = Vector2D(x, y); // bottom left corner of the pixel
 
 
-  sampleBuffer.update_pixel(Vector3D(0.2, 1.0, 0.8), x, y);
-  sampleCountBuffer[x + y * sampleBuffer.w] = num_samples;
+  store_pixel(x, y, Vector3D(0.2, 1.0, 0.8), num_samples);
 
 
 }
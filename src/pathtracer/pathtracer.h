@@ -6,6 +6,12 @@
 #include "scene/bvh.h"
 #include "pathtracer/sampler.h"
 #include "pathtracer/intersection.h"
+#include "pathtracer/aov.h"
+#include "pathtracer/tile_block.h"
+#include "util/sample_buffer.h"
+#include "util/tonemap.h"
+
+#include <unordered_map>
 
 #include "application/renderer.h"
 
@@ -15,6 +21,9 @@ using CGL::SceneObjects::Scene;
 #include "scene/environment_light.h"
 using CGL::SceneObjects::EnvironmentLight;
 
+#include "scene/light_bvh.h"
+using CGL::SceneObjects::LightBVH;
+
 using CGL::SceneObjects::BVHNode;
 using CGL::SceneObjects::BVHAccel;
 
@@ -37,6 +46,27 @@ namespace CGL {
 
         void write_to_framebuffer(ImageBuffer& framebuffer, size_t x0, size_t y0, size_t x1, size_t y1);
 
+        /**
+         * Tonemap the whole sample buffer into framebuffer on num_threads
+         * threads, updating the log average of a global operator first.
+         * With a tolerance, a global operator leaves framebuffer as it is
+         * if its average moved by no more than that fraction.
+         */
+        void refresh_framebuffer(ImageBuffer& framebuffer, size_t num_threads,
+                                 float tolerance = 0);
+
+        /**
+         * Send the calling thread's pixel estimates to block until it is
+         * unbound with NULL. Pixels outside the block, or any pixel while no
+         * block is bound, go straight to the sample buffers.
+         */
+        static void bind_tile_block(TileBlock* block);
+
+        /**
+         * Store the radiance estimate of pixel (x, y) from num_samples samples.
+         */
+        void store_pixel(size_t x, size_t y, const Vector3D& radiance, int num_samples);
+
         /**
          * If the pathtracer is in READY, delete all internal data, transition to INIT.
          */
@@ -50,6 +80,12 @@ namespace CGL {
         Vector3D estimate_direct_lighting_hemisphere(const Ray& r, const SceneObjects::Intersection& isect);
         Vector3D estimate_direct_lighting_importance(const Ray& r, const SceneObjects::Intersection& isect);
 
+        /**
+         * Estimate direct lighting by picking ns_light_bvh lights from the
+         * light BVH instead of sampling every light in the scene.
+         */
+        Vector3D estimate_direct_lighting_light_bvh(const Ray& r, const SceneObjects::Intersection& isect);
+
         Vector3D est_radiance_global_illumination(const Ray& r);
         Vector3D zero_bounce_radiance(const Ray& r, const SceneObjects::Intersection& isect);
         Vector3D one_bounce_radiance(const Ray& r, const SceneObjects::Intersection& isect);
@@ -68,6 +104,34 @@ namespace CGL {
          */
         void raytrace_pixel(size_t x, size_t y);
 
+        /**
+         * Accumulate the requested AOVs of the camera samples the calling
+         * thread traces into pixel (x, y) of aovs, until unbind_aov_pixel.
+         */
+        static void bind_aov_pixel(size_t x, size_t y);
+        static void unbind_aov_pixel();
+
+        /**
+         * Start the AOVs of a camera sample at its first hit, isect, or at
+         * a miss if isect is NULL. Called when the camera ray r enters
+         * est_radiance_global_illumination.
+         */
+        void begin_aov_sample(const Ray& r, const SceneObjects::Intersection* isect);
+
+        /**
+         * Record the light L of an AOV (AOV_EMISSION or AOV_DIRECT) if r is
+         * the camera ray of the sample being traced, so only the first hit
+         * contributes.
+         */
+        void record_aov(const Ray& r, AOVType type, const Vector3D& L);
+
+        /**
+         * Finish the sample with its radiance L, taking as indirect light
+         * what emission and direct light do not account for, so the
+         * lighting AOVs add up to the beauty pass. Returns L.
+         */
+        Vector3D end_aov_sample(const Vector3D& L);
+
         // Integrator sampling settings //
 
         size_t max_ray_depth; ///< maximum allowed ray depth (applies to all rays)
@@ -77,6 +141,7 @@ namespace CGL {
         size_t ns_diff;       ///< number of samples - diffuse surfaces
         size_t ns_glsy;       ///< number of samples - glossy surfaces
         size_t ns_refr;       ///< number of samples - refractive surfaces
+        size_t ns_light_bvh;  ///< number of lights picked from the light BVH per shading point (0 = all lights)
 
         size_t samplesPerBatch;
         double maxTolerance;
@@ -86,22 +151,23 @@ namespace CGL {
 
         BVHAccel* bvh;                 ///< BVH accelerator aggregate
         EnvironmentLight* envLight;    ///< environment map
+        LightBVH* lightBVH;            ///< light BVH for many-light sampling
         Sampler2D* gridSampler;        ///< samples unit grid
         Sampler3D* hemisphereSampler;  ///< samples unit hemisphere
-        HDRImageBuffer sampleBuffer;   ///< sample buffer
+        SampleBuffer sampleBuffer;     ///< radiance and sample count per pixel
         Timer timer;                   ///< performance test timer
 
-        std::vector<int> sampleCountBuffer;   ///< sample count buffer
+        // Arbitrary Output Variables //
+
+        AOVBuffers aovs;               ///< requested AOVs, allocated with the frame
+        std::unordered_map<const SceneObjects::Primitive*, int> primitiveIds; ///< ids for AOV_PRIMITIVE_ID
 
         Scene* scene;         ///< current scene
         Camera* camera;       ///< current camera
 
         // Tonemapping Controls //
 
-        double tm_gamma;                           ///< gamma
-        double tm_level;                           ///< exposure level
-        double tm_key;                             ///< key value
-        double tm_wht;                             ///< white point
+        ToneMapper tonemapper;         ///< operator, gamma, exposure, key and white point
     };
 
 }  // namespace CGL
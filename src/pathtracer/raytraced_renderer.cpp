@@ -12,11 +12,15 @@
 #include "CGL/matrix3x3.h"
 #include "CGL/lodepng.h"
 
+#ifndef CGL_HEADLESS
 #include "GL/glew.h"
+#endif
 
 #include "scene/sphere.h"
 #include "scene/triangle.h"
 #include "scene/light.h"
+#include "scene/primitive_arena.h"
+#include "util/startup_profiler.h"
 
 using namespace CGL::SceneObjects;
 
@@ -43,11 +47,28 @@ RaytracedRenderer::RaytracedRenderer(size_t ns_aa,
                        size_t num_threads,
                        size_t samples_per_batch,
                        float max_tolerance,
-                       HDRImageBuffer* envmap,
+                       EnvironmentMap* envmap,
                        bool direct_hemisphere_sample,
                        string filename,
                        double lensRadius,
-                       double focalDistance) {
+                       double focalDistance,
+                       size_t ns_light_bvh,
+                       string envmap_path,
+                       bool progressive,
+                       double time_budget,
+                       bool denoise,
+                       string aovs,
+                       bool render_cost,
+                       size_t tile_size,
+                       string tile_order,
+                       string stats_path,
+                       string thread_placement,
+                       string hdr_output,
+                       string checkpoint_path,
+                       double checkpoint_interval,
+                       bool resume,
+                       bool high_precision,
+                       string tonemap) {
   state = INIT;
 
   pt = new PathTracer();
@@ -62,6 +83,8 @@ RaytracedRenderer::RaytracedRenderer(size_t ns_aa,
   pt->samplesPerBatch = samples_per_batch;                  // Number of samples per batch
   pt->maxTolerance = max_tolerance;                         // Maximum tolerance for early termination
   pt->direct_hemisphere_sample = direct_hemisphere_sample;  // Whether to use direct hemisphere sampling vs. Importance Sampling
+  pt->ns_light_bvh = ns_light_bvh;                          // Number of lights picked from the light BVH per shading point
+  pt->sampleBuffer.set_high_precision(high_precision);      // Accumulate radiance in doubles too
 
   this->lensRadius = lensRadius;
   this->focalDistance = focalDistance;
@@ -69,20 +92,110 @@ RaytracedRenderer::RaytracedRenderer(size_t ns_aa,
   this->filename = filename;
 
   if (envmap) {
-    pt->envLight = new EnvironmentLight(envmap);
+    pt->envLight = new EnvironmentLight(envmap, envmap_path);
   } else {
     pt->envLight = NULL;
   }
 
   bvh = NULL;
+  lightBVH = NULL;
   scene = NULL;
   camera = NULL;
 
   show_rays = true;
 
-  imageTileSize = 32;                     // Size of the rendering tile.
-  numWorkerThreads = num_threads;         // Number of threads
-  workerThreads.resize(numWorkerThreads);
+  imageTileSize = max(tile_size, (size_t) 4); // Size of the rendering tile.
+  if (!parse_tile_order(tile_order, &tileOrder)) {
+    fprintf(stderr, "[PathTracer] Unknown tile order '%s', using raster\n", tile_order.c_str());
+    tileOrder = TILE_ORDER_RASTER;
+  }
+  CPUTopology topology = CPUTopology::detect();
+  numWorkerThreads = num_threads ? num_threads : topology.num_cpus(); // Number of threads, 0 = one per CPU
+  pool = new ThreadPool(numWorkerThreads); // Workers stay parked between renders
+  workerStats = new WorkerStats[numWorkerThreads];
+  place_workers(topology, thread_placement);
+
+  reporterThread = NULL;
+  statsPath = stats_path;                 // JSON lines render stats, "-" for stdout
+  statsFile = NULL;
+
+  if (hdr_output != "" && hdr_output != "half" && hdr_output != "float") {
+    fprintf(stderr, "[PathTracer] Unknown HDR output type '%s', using float\n", hdr_output.c_str());
+    hdr_output = "float";
+  }
+  hdrOutput = hdr_output;                 // Save an exr of the linear radiance
+
+  ToneMapper::Operator tone_operator;
+  if (!ToneMapper::parse_operator(tonemap, &tone_operator)) {
+    fprintf(stderr, "[PathTracer] Unknown tonemapping operator '%s', using linear\n", tonemap.c_str());
+    tone_operator = ToneMapper::LINEAR;
+  }
+  pt->tonemapper.set_operator(tone_operator); // Display curve of the frame buffer
+
+  if (resume && checkpoint_path.empty()) {
+    checkpoint_path = filename + ".checkpoint";
+  }
+  checkpointPath = checkpoint_path;       // Periodically snapshot full-frame renders
+  checkpointInterval = checkpoint_interval;
+  this->resume = resume;                  // Continue the first render from the snapshot
+
+  this->progressive = progressive;        // Render in passes of increasing spp
+  this->timeBudget = time_budget;         // Stop progressive rendering after this many seconds
+
+  this->denoise = denoise;                // Denoise the finished image
+
+  // Arbitrary output variables, plus the guides the denoiser needs
+  if (!pt->aovs.request(aovs)) {
+    fprintf(stderr, "[PathTracer] Unknown AOV in '%s', skipping it\n", aovs.c_str());
+  }
+  this->renderCost = render_cost;         // Record per-pixel render cost
+
+  if (denoise) {
+    pt->aovs.request(AOV_ALBEDO);
+    pt->aovs.request(AOV_NORMAL);
+    pt->aovs.request(AOV_DEPTH);
+  }
+}
+
+void RaytracedRenderer::place_workers(const CPUTopology& topology,
+                                      const string& placement) {
+  if (placement == "none") return;
+  bool numa = placement == "numa";
+  if (!numa && placement != "pin") {
+    fprintf(stderr, "[PathTracer] Unknown thread placement '%s', not pinning\n",
+            placement.c_str());
+    return;
+  }
+
+  // spread the workers evenly over the CPUs listed node by node, so each
+  // node's workers are consecutive and their chunks of tiles form a band
+  vector<int> cpus;
+  vector<size_t> cpu_nodes;
+  for (size_t n = 0; n < topology.nodes.size(); ++n) {
+    for (size_t i = 0; i < topology.nodes[n].size(); ++i) {
+      cpus.push_back(topology.nodes[n][i]);
+      cpu_nodes.push_back(n);
+    }
+  }
+
+  vector<vector<int> > affinity(numWorkerThreads);
+  vector<size_t> groups(numWorkerThreads);
+  for (size_t i = 0; i < numWorkerThreads; ++i) {
+    size_t c = i * cpus.size() / numWorkerThreads;
+    groups[i] = cpu_nodes[c];
+    // in NUMA mode the scheduler may still move a worker within its node
+    affinity[i] = numa ? topology.nodes[groups[i]] : vector<int>(1, cpus[c]);
+  }
+
+  std::atomic<size_t> pinned(0);
+  pool->run([&](size_t worker_id) {
+    if (pin_current_thread(affinity[worker_id])) pinned++;
+  }).wait();
+
+  if (numa) workQueue.set_groups(groups);
+  fprintf(stdout, "[PathTracer] Pinned %zu of %zu workers to %s across %zu NUMA node(s)\n",
+          pinned.load(), numWorkerThreads, numa ? "their node" : "a core",
+          topology.nodes.size());
 }
 
 /**
@@ -91,7 +204,22 @@ RaytracedRenderer::RaytracedRenderer(size_t ns_aa,
  */
 RaytracedRenderer::~RaytracedRenderer() {
 
+  // let a running render wind down before the pool joins its workers
+  {
+    lock_guard<std::mutex> lk(m_done);
+    continueRaytracing = false;
+    workQueue.cancel();
+  }
+  cv_pass.notify_all();
+  delete pool;
+  stop_reporter();
+  delete[] workerStats;
+  if (statsFile && statsFile != stdout) fclose(statsFile);
+
   delete bvh;
+  delete lightBVH;
+  release_scene();
+  delete pt->envLight;
   delete pt;
 
 }
@@ -110,12 +238,16 @@ void RaytracedRenderer::set_scene(Scene *scene) {
   }
 
   if (this->scene != nullptr) {
-    delete scene;
+    if (this->scene != scene) release_scene();
     delete bvh;
+    delete lightBVH;
     selectionHistory.pop();
   }
 
-  if (pt->envLight != nullptr) {
+  // a scene passed in again already has the environment light
+  if (pt->envLight != nullptr &&
+      std::find(scene->lights.begin(), scene->lights.end(), pt->envLight) ==
+      scene->lights.end()) {
     scene->lights.push_back(pt->envLight);
   }
 
@@ -187,6 +319,7 @@ bool RaytracedRenderer::has_valid_configuration() {
  * the BVH visualization with OpenGL.
  */
 void RaytracedRenderer::update_screen() {
+#ifndef CGL_HEADLESS
   switch (state) {
     case INIT:
     case READY:
@@ -207,6 +340,7 @@ void RaytracedRenderer::update_screen() {
         visualize_cell();
       break;
   }
+#endif
 }
 
 /**
@@ -224,12 +358,14 @@ void RaytracedRenderer::stop() {
       state = READY;
       break;
     case RENDERING:
-      continueRaytracing = false;
+      {
+        lock_guard<std::mutex> lk(m_done);
+        continueRaytracing = false;
+        workQueue.cancel();
+      }
+      cv_pass.notify_all();
     case DONE:
-      for (int i=0; i<numWorkerThreads; i++) {
-            workerThreads[i]->join();
-            delete workerThreads[i];
-        }
+      renderDone.wait();
       state = READY;
       break;
   }
@@ -242,7 +378,9 @@ void RaytracedRenderer::clear() {
   if (state != READY) return;
   delete bvh;
   bvh = NULL;
-  scene = NULL;
+  delete lightBVH;
+  lightBVH = NULL;
+  release_scene();
   camera = NULL;
   selectionHistory.pop();
   frameBuffer.resize(0, 0);
@@ -273,7 +411,6 @@ void RaytracedRenderer::start_raytracing() {
 
   state = RENDERING;
   continueRaytracing = true;
-  workerDoneCount = 0;
 
   size_t width = frameBuffer.w;
   size_t height = frameBuffer.h;
@@ -282,58 +419,245 @@ void RaytracedRenderer::start_raytracing() {
   pt->set_frame_size(width, height);
 
   pt->bvh = bvh;
+  pt->lightBVH = lightBVH;
   pt->camera = camera;
   pt->scene = scene;
 
+  pt->primitiveIds.clear();
+  if (pt->aovs.enabled(AOV_PRIMITIVE_ID)) {
+    // number primitives in the order build_accel collects them
+    const vector<Primitive *> &primitives = scene->get_primitives();
+    for (size_t i = 0; i < primitives.size(); ++i) {
+      pt->primitiveIds[primitives[i]] = i;
+    }
+  }
+
   if (!render_cell) {
     frameBuffer.clear();
-    num_tiles_w = width / imageTileSize + 1;
-    num_tiles_h = height / imageTileSize + 1;
-    tilesTotal = num_tiles_w * num_tiles_h;
-    tilesDone = 0;
-    tile_samples.resize(num_tiles_w * num_tiles_h);
-    memset(&tile_samples[0], 0, num_tiles_w * num_tiles_h * sizeof(int));
-
-    // populate the tile work queue
+  }
+  tilesDone = 0;
+  passIndex = 0;
+
+  // progressive rendering starts with a 1 spp pass and works its way up
+  // to the requested samples per pixel
+  if (progressive) {
+    targetSamples = pt->ns_aa;
+    samplesDone = 0;
+    passSamples = 1;
+    progressiveDone = false;
+    passCut = false;
+    pt->ns_aa = passSamples;
+  }
+
+  if (renderCost) {
+    costMap.resize(width, height);
+    costMap.start_clock();
+#ifndef CGL_RAY_COUNTERS
+    fprintf(stdout, "[PathTracer] Built without BUILD_RAY_COUNTERS, the render cost map has times only\n");
+#endif
+  }
+
+  renderStart = std::chrono::steady_clock::now();
+  bool resumed = resume && !render_cell && resume_from_checkpoint();
+  resume = false;
+  if (!resumed) populate_work_queue();
+  lastCheckpoint = elapsed_time();
+
+  bvh->total_isects = 0; bvh->total_rays = 0;
+  StartupProfiler::instance().finish();
+  // wake up the workers
+  fprintf(stdout, "[PathTracer] Rendering... "); fflush(stdout);
+  start_reporter();
+  renderDone = pool->run(
+      std::bind(&RaytracedRenderer::worker_thread, this, std::placeholders::_1),
+      std::bind(&RaytracedRenderer::finish_raytracing, this));
+}
+
+void RaytracedRenderer::populate_work_queue() {
+  size_t width = frameBuffer.w;
+  size_t height = frameBuffer.h;
+
+  vector<WorkItem> tiles;
+  int tile_size;
+  if (!render_cell) {
+    tile_size = imageTileSize;
     for (size_t y = 0; y < height; y += imageTileSize) {
         for (size_t x = 0; x < width; x += imageTileSize) {
-            workQueue.put_work(WorkItem(x, y, imageTileSize, imageTileSize));
+            tiles.push_back(WorkItem(x, y, imageTileSize, imageTileSize));
         }
     }
   } else {
-    int w = (cell_br-cell_tl).x;
-    int h = (cell_br-cell_tl).y;
     int imTS = imageTileSize / 4;
-    num_tiles_w = w / imTS + 1;
-    num_tiles_h = h / imTS + 1;
-    tilesTotal = num_tiles_w * num_tiles_h;
-    tilesDone = 0;
-    tile_samples.resize(num_tiles_w * num_tiles_h);
-    memset(&tile_samples[0], 0, num_tiles_w * num_tiles_h * sizeof(int));
-
-    // populate the tile work queue
+    tile_size = imTS;
     for (size_t y = cell_tl.y; y < cell_br.y; y += imTS) {
       for (size_t x = cell_tl.x; x < cell_br.x; x += imTS) {
-        workQueue.put_work(WorkItem(x, y, 
+        tiles.push_back(WorkItem(x, y, 
           min(imTS, (int)(cell_br.x-x)), min(imTS, (int)(cell_br.y-y)) ));
       }
     }
   }
 
-  bvh->total_isects = 0; bvh->total_rays = 0;
-  // launch threads
-  fprintf(stdout, "[PathTracer] Rendering... "); fflush(stdout);
-  for (int i=0; i<numWorkerThreads; i++) {
-      workerThreads[i] = new std::thread(&RaytracedRenderer::worker_thread, this);
+  // raster, hilbert and spiral orders give each worker a contiguous run of
+  // tiles; cost order deals the most expensive tiles out first to everyone
+  bool interleave = false;
+  if (tileOrder == TILE_ORDER_COST) {
+    vector<double> costs = estimate_tile_costs(tiles);
+    split_costly_tiles(tiles, costs);
+    sort_tiles(tiles, costs, true);
+    interleave = true;
+  } else if (tileOrder != TILE_ORDER_RASTER) {
+    int x0 = render_cell ? cell_tl.x : 0;
+    int y0 = render_cell ? cell_tl.y : 0;
+    int nx = 1, ny = 1;
+    for (size_t i = 0; i < tiles.size(); ++i) {
+      nx = max(nx, (tiles[i].tile_x - x0) / tile_size + 1);
+      ny = max(ny, (tiles[i].tile_y - y0) / tile_size + 1);
+    }
+    uint32_t n = 1;
+    while (n < (uint32_t) max(nx, ny)) n <<= 1;
+
+    vector<double> keys(tiles.size());
+    for (size_t i = 0; i < tiles.size(); ++i) {
+      int tx = (tiles[i].tile_x - x0) / tile_size;
+      int ty = (tiles[i].tile_y - y0) / tile_size;
+      keys[i] = tileOrder == TILE_ORDER_HILBERT
+          ? (double) hilbert_index(n, tx, ty)
+          : spiral_key(tx + 0.5, ty + 0.5, nx * 0.5, ny * 0.5);
+    }
+    sort_tiles(tiles, keys, false);
+  }
+
+  set_tiles(tiles, interleave);
+}
+
+void RaytracedRenderer::set_tiles(vector<WorkItem>& tiles, bool interleave) {
+  for (size_t i = 0; i < tiles.size(); ++i) tiles[i].index = i;
+  renderTiles = tiles;
+  tilesInterleaved = interleave;
+  tilePasses.assign(tiles.size(), 0);
+
+  tilesTotal = tiles.size();
+  workQueue.reset(tiles, numWorkerThreads, interleave);
+}
+
+vector<double> RaytracedRenderer::estimate_tile_costs(const vector<WorkItem>& tiles) {
+  fprintf(stdout, "[PathTracer] Pilot pass over %zu tiles... ", tiles.size());
+  fflush(stdout);
+  Timer pilot_timer;
+  pilot_timer.start();
+
+  // trace one camera ray through a sparse grid of pixels in every tile and
+  // time it; the workers take tiles off a shared counter
+  const int grid = 4;
+  vector<double> costs(tiles.size());
+  std::atomic<size_t> next(0);
+  std::function<void(size_t)> pilot = [&](size_t worker_id) {
+    for (size_t i = next++; i < tiles.size(); i = next++) {
+      const WorkItem& t = tiles[i];
+      uint64_t start = read_cycle_counter();
+      for (int j = 0; j < grid; ++j) {
+        for (int k = 0; k < grid; ++k) {
+          double x = t.tile_x + (k + 0.5) * t.tile_w / grid;
+          double y = t.tile_y + (j + 0.5) * t.tile_h / grid;
+          if (x >= frame_w || y >= frame_h) continue;
+          Ray r = camera->generate_ray(x / frame_w, y / frame_h);
+          r.depth = pt->max_ray_depth;
+          pt->est_radiance_global_illumination(r);
+        }
+      }
+      costs[i] = (double) (read_cycle_counter() - start);
+    }
+  };
+  pool->run(pilot).wait();
+
+  pilot_timer.stop();
+  fprintf(stdout, "Done! (%.4f sec)\n", pilot_timer.duration());
+  return costs;
+}
+
+void RaytracedRenderer::split_costly_tiles(vector<WorkItem>& tiles,
+                                           vector<double>& costs) {
+  // aim for at least 8 tiles' worth of work per worker, and split any tile
+  // that alone costs more than that into quadrants
+  const int min_tile_size = 8;
+  double total = 0;
+  for (size_t i = 0; i < costs.size(); ++i) total += costs[i];
+  double target = total / (numWorkerThreads * 8);
+  if (target <= 0) return;
+
+  size_t split = 0;
+  for (size_t i = 0; i < tiles.size(); ++i) {
+    WorkItem t = tiles[i];
+    if (costs[i] <= target || t.tile_w < 2 * min_tile_size ||
+        t.tile_h < 2 * min_tile_size) continue;
+
+    // replace the tile by its top-left quadrant and append the others;
+    // appended quadrants are revisited and split further if need be
+    int hw = t.tile_w / 2, hh = t.tile_h / 2;
+    double cost = costs[i] / 4;
+    tiles[i] = WorkItem(t.tile_x, t.tile_y, hw, hh);
+    costs[i] = cost;
+    tiles.push_back(WorkItem(t.tile_x + hw, t.tile_y, t.tile_w - hw, hh));
+    tiles.push_back(WorkItem(t.tile_x, t.tile_y + hh, hw, t.tile_h - hh));
+    tiles.push_back(WorkItem(t.tile_x + hw, t.tile_y + hh, t.tile_w - hw, t.tile_h - hh));
+    costs.insert(costs.end(), 3, cost);
+    --i;
+    split++;
+  }
+
+  if (split > 0) {
+    fprintf(stdout, "[PathTracer] Split %zu expensive tiles, %zu tiles in total.\n",
+            split, tiles.size());
   }
 }
 
+void RaytracedRenderer::sort_tiles(vector<WorkItem>& tiles,
+                                   vector<double>& keys, bool descending) {
+  vector<size_t> order(tiles.size());
+  for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return descending ? keys[a] > keys[b] : keys[a] < keys[b];
+  });
+
+  vector<WorkItem> sorted_tiles(tiles.size());
+  vector<double> sorted_keys(keys.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    sorted_tiles[i] = tiles[order[i]];
+    sorted_keys[i] = keys[order[i]];
+  }
+  tiles.swap(sorted_tiles);
+  keys.swap(sorted_keys);
+}
+
+bool RaytracedRenderer::start_next_pass() {
+  samplesDone += passSamples;
+  fprintf(stdout, "\r[PathTracer] Pass %zu done, %zu spp (%.4fs)\n",
+          passIndex.load(), samplesDone, elapsed_time());
+  fflush(stdout);
+
+  if (samplesDone >= targetSamples) return false;
+  if (timeBudget > 0 && elapsed_time() >= timeBudget) return false;
+
+  // double the accumulated samples with every pass, but keep passes short
+  // enough that the preview and the time budget stay responsive
+  const size_t max_pass_samples = 64;
+  passSamples = std::min(std::max(samplesDone, (size_t) 1),
+                         std::min(targetSamples - samplesDone, max_pass_samples));
+  pt->ns_aa = passSamples;
+  passIndex++;
+  tilesDone = 0;
+  return true;
+}
+
+double RaytracedRenderer::elapsed_time() const {
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - renderStart).count();
+}
+
 void RaytracedRenderer::render_to_file(string filename, size_t x, size_t y, size_t dx, size_t dy) {
   if (x == -1) {
-    unique_lock<std::mutex> lk(m_done);
     start_raytracing();
-    cv_done.wait(lk, [this]{ return state == DONE; });
-    lk.unlock();
+    renderDone.wait();
     save_image(filename);
     fprintf(stdout, "[PathTracer] Job completed.\n");
   } else {
@@ -347,34 +671,135 @@ void RaytracedRenderer::render_to_file(string filename, size_t x, size_t y, size
   }
 }
 
+void RaytracedRenderer::render_distributed(string filename, RenderCoordinator* coordinator) {
+  if (state != READY) return;
+
+  // the workers only send back radiance and sample counts
+  if (pt->aovs.any() || renderCost || denoise) {
+    fprintf(stderr, "[PathTracer] AOVs, render cost and denoising are not "
+                    "supported in distributed mode, skipping them\n");
+    pt->aovs = AOVBuffers();
+    renderCost = false;
+  }
+  if (!checkpointPath.empty()) {
+    fprintf(stderr, "[PathTracer] Checkpoints are not supported in distributed "
+                    "mode, skipping them\n");
+  }
+
+  if (filename == "") filename = this->filename + ".png";
+
+  pt->clear();
+  pt->set_frame_size(frame_w, frame_h);
+  StartupProfiler::instance().finish();
+  renderStart = std::chrono::steady_clock::now();
+  if (!coordinator->render(frame_w, frame_h, 4 * imageTileSize, &pt->sampleBuffer)) {
+    fprintf(stderr, "[PathTracer] Distributed render failed.\n");
+    return;
+  }
+  fprintf(stdout, "[PathTracer] Rendered in %.4fs\n", elapsed_time());
+
+  pt->refresh_framebuffer(frameBuffer, numWorkerThreads);
+  state = DONE;
+  if (hdrOutput == "") hdrOutput = "float";  // the merged radiance is the point
+  save_image(filename);
+  fprintf(stdout, "[PathTracer] Job completed.\n");
+}
+
+void RaytracedRenderer::render_worker(string address) {
+  // tiles of the regions before the current one, which restarts tilesDone;
+  // declared first, as the connection reports it until destroyed
+  std::atomic<size_t> tiles(0);
+  RenderWorkerConnection connection;
+  if (!connection.connect(address, frame_w, frame_h)) return;
+  connection.report_progress([this, &tiles]{ return tiles + tilesDone; });
+
+  size_t rendered = 0;
+  RenderRegion region;
+  vector<float> radiance;
+  vector<int32_t> counts;
+  while (connection.next_region(&region)) {
+    stop();
+    render_cell = true;
+    cell_tl = Vector2D(region.x, region.y);
+    cell_br = Vector2D(region.x + region.w, region.y + region.h);
+    start_raytracing();
+    renderDone.wait();
+    if (state != DONE) break;
+    tiles += tilesDone;
+
+    radiance.resize(3 * region.w * region.h);
+    counts.resize(region.w * region.h);
+    for (size_t y = 0; y < region.h; ++y) {
+      for (size_t x = 0; x < region.w; ++x) {
+        size_t src = (region.x + x) + (region.y + y) * frame_w;
+        size_t dst = x + y * region.w;
+        Vector3D s = pt->sampleBuffer.radiance(src);
+        radiance[3 * dst] = s.x;
+        radiance[3 * dst + 1] = s.y;
+        radiance[3 * dst + 2] = s.z;
+        counts[dst] = pt->sampleBuffer.count(src);
+      }
+    }
+    if (!connection.send_result(region, radiance, counts)) break;
+    rendered++;
+  }
+  fprintf(stdout, "[PathTracer] Worker rendered %zu regions.\n", rendered);
+}
 
 void RaytracedRenderer::build_accel() {
 
   // collect primitives //
   fprintf(stdout, "[PathTracer] Collecting primitives... "); fflush(stdout);
   timer.start();
-  vector<Primitive *> primitives;
-  for (SceneObject *obj : scene->objects) {
-    const vector<Primitive *> &obj_prims = obj->get_primitives();
-    primitives.reserve(primitives.size() + obj_prims.size());
-    primitives.insert(primitives.end(), obj_prims.begin(), obj_prims.end());
+  const vector<Primitive *> *primitives;
+  {
+    ProfilePhase phase("get_primitives");
+    primitives = &scene->get_primitives();
   }
   timer.stop();
   fprintf(stdout, "Done! (%.4f sec)\n", timer.duration());
+  scene->get_arena()->print_report();
 
   // build BVH //
-  fprintf(stdout, "[PathTracer] Building BVH from %lu primitives... ", primitives.size()); 
+  fprintf(stdout, "[PathTracer] Building BVH from %lu primitives... ", primitives->size()); 
   fflush(stdout);
   timer.start();
-  bvh = new BVHAccel(primitives);
+  {
+    ProfilePhase phase("BVH build");
+    bvh = new BVHAccel(*primitives);
+  }
   timer.stop();
   fprintf(stdout, "Done! (%.4f sec)\n", timer.duration());
 
+  // build light BVH //
+  if (pt->ns_light_bvh > 0) {
+    ProfilePhase phase("Light BVH build");
+    fprintf(stdout, "[PathTracer] Building light BVH from %lu lights... ",
+            scene->lights.size());
+    fflush(stdout);
+    timer.start();
+    lightBVH = new LightBVH(scene->lights);
+    timer.stop();
+    fprintf(stdout, "Done! (%.4f sec, %lu nodes)\n", timer.duration(),
+            lightBVH->num_nodes());
+  }
+
   // initial visualization //
   selectionHistory.push(bvh->get_root());
 }
 
+void RaytracedRenderer::release_scene() {
+  if (!scene) return;
+  vector<SceneLight *> &lights = scene->lights;
+  lights.erase(std::remove(lights.begin(), lights.end(), pt->envLight),
+               lights.end());
+  delete scene;
+  scene = NULL;
+  pt->scene = NULL;
+}
+
 void RaytracedRenderer::visualize_accel() const {
+#ifndef CGL_HEADLESS
 
   glPushAttrib(GL_ENABLE_BIT);
   glDisable(GL_LIGHTING);
@@ -465,9 +890,11 @@ void RaytracedRenderer::visualize_accel() const {
 
   glDepthMask(GL_TRUE);
   glPopAttrib();
+#endif
 }
 
 void RaytracedRenderer::visualize_cell() const {
+#ifndef CGL_HEADLESS
   glPushAttrib(GL_VIEWPORT_BIT);
   glViewport(0, 0, frameBuffer.w, frameBuffer.h);
 
@@ -503,6 +930,7 @@ void RaytracedRenderer::visualize_cell() const {
 
   glEnable(GL_LIGHTING);
   glEnable(GL_DEPTH_TEST);
+#endif
 }
 
 /**
@@ -593,29 +1021,70 @@ void RaytracedRenderer::key_press(int key) {
  * Raytrace a tile of the scene and update the frame buffer. Is run
  * in a worker thread.
  */
-void RaytracedRenderer::raytrace_tile(int tile_x, int tile_y,
-                               int tile_w, int tile_h) {
+/**
+ * Seed for the random numbers of a tile in a pass (a splitmix64 hash), so a
+ * tile draws the same samples whichever worker renders it and whenever.
+ */
+static uint32_t tile_seed(size_t tile_x, size_t tile_y, size_t pass) {
+  uint64_t z = ((uint64_t) tile_x << 40) ^ ((uint64_t) tile_y << 20) ^ pass;
+  z += 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return (uint32_t) (z ^ (z >> 31));
+}
+
+void RaytracedRenderer::raytrace_tile(const WorkItem& work) {
   size_t w = frame_w;
   size_t h = frame_h;
 
-  size_t tile_start_x = tile_x;
-  size_t tile_start_y = tile_y;
+  size_t tile_start_x = work.tile_x;
+  size_t tile_start_y = work.tile_y;
 
-  size_t tile_end_x = std::min(tile_start_x + tile_w, w);
-  size_t tile_end_y = std::min(tile_start_y + tile_h, h);
+  size_t tile_end_x = std::min(tile_start_x + work.tile_w, w);
+  size_t tile_end_y = std::min(tile_start_y + work.tile_h, h);
 
-  size_t tile_idx_x = tile_x / imageTileSize;
-  size_t tile_idx_y = tile_y / imageTileSize;
-  size_t num_samples_tile = tile_samples[tile_idx_x + tile_idx_y * num_tiles_w];
+  // accumulate into a block private to this worker, so workers on
+  // neighbouring tiles never write to the same cache lines
+  static thread_local TileBlock block;
+  block.bind(tile_start_x, tile_start_y,
+             tile_end_x - tile_start_x, tile_end_y - tile_start_y);
+  PathTracer::bind_tile_block(&block);
+  seed_random(tile_seed(tile_start_x, tile_start_y, passIndex));
 
   for (size_t y = tile_start_y; y < tile_end_y; y++) {
-    if (!continueRaytracing) return;
+    if (!continueRaytracing) {
+      PathTracer::bind_tile_block(NULL);
+      PathTracer::unbind_aov_pixel();
+      return;
+    }
     for (size_t x = tile_start_x; x < tile_end_x; x++) {
+      if (pt->aovs.any()) {
+        PathTracer::bind_aov_pixel(x, y);
+      }
+
+      if (!renderCost) {
+        pt->raytrace_pixel(x, y);
+        continue;
+      }
+
+      RayCounters before = ray_counters;
+      uint64_t start = read_cycle_counter();
       pt->raytrace_pixel(x, y);
+      costMap.record(x, y, read_cycle_counter() - start, before, ray_counters);
     }
   }
 
-  tile_samples[tile_idx_x + tile_idx_y * num_tiles_w] += 1;
+  // progressive passes are blended into the previous passes by sample count
+  PathTracer::bind_tile_block(NULL);
+  PathTracer::unbind_aov_pixel();
+  if (checkpointPath.empty() || render_cell) {
+    block.commit(pt->sampleBuffer, progressive);
+  } else {
+    // a checkpoint holds either all or none of the tile's samples
+    lock_guard<std::mutex> lk(m_checkpoint);
+    block.commit(pt->sampleBuffer, progressive);
+    tilePasses[work.index]++;
+  }
 
   pt->write_to_framebuffer(frameBuffer, tile_start_x, tile_start_y, tile_end_x, tile_end_y);
 }
@@ -634,12 +1103,8 @@ void RaytracedRenderer::raytrace_cell(ImageBuffer& buffer) {
 
   stop();
   render_cell = true;
-  {
-    unique_lock<std::mutex> lk(m_done);
-    start_raytracing();
-    cv_done.wait(lk, [this]{ return state == DONE; });
-    lk.unlock();
-  }
+  start_raytracing();
+  renderDone.wait();
 
   for (size_t y = tile_start_y; y < tile_end_y; y++) {
     for (size_t x = tile_start_x; x < tile_end_x; x++) {
@@ -652,42 +1117,358 @@ void RaytracedRenderer::autofocus(Vector2D loc) {
   pt->autofocus(loc);
 }
 
-void RaytracedRenderer::worker_thread() {
-
-  Timer timer;
-  timer.start();
+void RaytracedRenderer::worker_thread(size_t worker_id) {
 
   WorkItem work;
-  while (continueRaytracing && workQueue.try_get_work(&work)) {
-    raytrace_tile(work.tile_x, work.tile_y, work.tile_w, work.tile_h);
-    { 
-      lock_guard<std::mutex> lk(m_done);
-      ++tilesDone;
-      cout << "\r[PathTracer] Rendering... " << int((double)tilesDone/tilesTotal * 100) << '%';
-      cout.flush();
+  while (continueRaytracing) {
+    if (!workQueue.try_get_work(worker_id, &work)) {
+      if (!progressive) break;
+
+      // wait for the next pass to be scheduled or for rendering to end
+      unique_lock<std::mutex> lk(m_done);
+      cv_pass.wait(lk, [this]{
+        return progressiveDone || !continueRaytracing || !workQueue.is_empty();
+      });
+      if (progressiveDone) break;
+      continue;
+    }
+
+    std::chrono::steady_clock::time_point tile_start = std::chrono::steady_clock::now();
+    uint64_t rays = ray_counters.rays;
+    // tiles a resumed render restored from the checkpoint are already done
+    if (tilePasses[work.index] <= passIndex) {
+      raytrace_tile(work);
+    }
+
+    // the reporter thread reads these; each worker owns its own cache line
+    WorkerStats& stats = workerStats[worker_id];
+    stats.busy_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - tile_start).count(), std::memory_order_relaxed);
+    stats.rays.fetch_add(ray_counters.rays - rays, std::memory_order_relaxed);
+    size_t done = ++tilesDone;
+
+    if (!progressive) continue;
+
+    // the first pass always completes so every pixel has an estimate;
+    // after that the time budget may cut a pass short
+    bool over_budget = passIndex > 0 && timeBudget > 0 &&
+                       elapsed_time() >= timeBudget;
+    if (over_budget || done == tilesTotal) {
+      {
+        lock_guard<std::mutex> lk(m_done);
+        if (progressiveDone) continue;
+        if (over_budget && done < tilesTotal) {
+          // the pass's samples only reached some of the tiles; they count
+          // if the tiles still being rendered turn out to be the last ones
+          passCut = true;
+          workQueue.cancel();
+          progressiveDone = true;
+          cv_pass.notify_all();
+          continue;
+        }
+        if (!start_next_pass()) {
+          progressiveDone = true;
+          cv_pass.notify_all();
+          continue;
+        }
+      }
+
+      // every tile is committed and the next pass is not queued yet, so no
+      // tile is written while a global operator's moved log average is
+      // applied; m_done is not held, the reporter keeps reporting. A move
+      // of 0.1% changes a display value by at most 255 * 0.001 / gamma.
+      if (pt->tonemapper.is_global()) {
+        pt->refresh_framebuffer(frameBuffer, numWorkerThreads, 0.001f);
+      }
+      {
+        lock_guard<std::mutex> lk(m_done);
+        if (continueRaytracing) workQueue.restart();
+      }
+      cv_pass.notify_all();
     }
   }
+}
 
-  workerDoneCount++;
-  if (!continueRaytracing && workerDoneCount == numWorkerThreads) {
-    timer.stop();
-    fprintf(stdout, "\n[PathTracer] Rendering canceled!\n");
-    state = READY;
+void RaytracedRenderer::finish_raytracing() {
+  double duration = elapsed_time();
+  stop_reporter();
+
+  if (progressive) {
+    pt->ns_aa = targetSamples;
   }
 
-  if (continueRaytracing && workerDoneCount == numWorkerThreads) {
-    timer.stop();
-    fprintf(stdout, "\r[PathTracer] Rendering... 100%%! (%.4fs)\n", timer.duration());
+  if (!continueRaytracing) {
+    fprintf(stdout, "\n[PathTracer] Rendering canceled!\n");
+    if (!checkpointPath.empty() && !render_cell) save_checkpoint();
+    state = READY;
+  } else {
+    if (!checkpointPath.empty() && !render_cell) remove(checkpointPath.c_str());
+    if (renderCost) costMap.stop_clock();
+    if (pt->tonemapper.is_global()) {
+      pt->refresh_framebuffer(frameBuffer, numWorkerThreads);
+    }
+    fprintf(stdout, "\r[PathTracer] Rendering... 100%%! (%.4fs)\n", duration);
+    if (progressive) {
+      if (passCut && tilesDone == tilesTotal) {
+        samplesDone += passSamples;
+        passCut = false;
+      }
+      size_t passes = passIndex + (passCut ? 0 : 1);
+      fprintf(stdout, "[PathTracer] Progressive rendering reached %zu spp in %zu complete passes",
+              samplesDone, passes);
+      if (passCut) {
+        fprintf(stdout, ", plus %zu spp over %zu of %zu tiles", passSamples,
+                tilesDone.load(), tilesTotal);
+      }
+      fprintf(stdout, ".\n");
+    }
     fprintf(stdout, "[PathTracer] BVH traced %llu rays.\n", bvh->total_rays);
-    fprintf(stdout, "[PathTracer] Average speed %.4f million rays per second.\n", (double)bvh->total_rays / timer.duration() * 1e-6);
+    fprintf(stdout, "[PathTracer] Average speed %.4f million rays per second.\n", (double)bvh->total_rays / duration * 1e-6);
     fprintf(stdout, "[PathTracer] Averaged %f intersection tests per ray.\n", (((double)bvh->total_isects)/bvh->total_rays));
 
+    // time the workers spent on tiles against a perfectly parallel render
+    double busy = 0;
+    for (size_t i = 0; i < numWorkerThreads; ++i) {
+      busy += workerStats[i].busy_ns.load() * 1e-9;
+    }
+    double speedup = duration > 0 ? busy / duration : 0;
+    fprintf(stdout, "[PathTracer] Scaling efficiency %.1f%% (%.2fx on %zu threads).\n",
+            speedup / numWorkerThreads * 100, speedup, numWorkerThreads);
+
+    if (denoise && !render_cell) {
+      denoise_image();
+    }
+
     lock_guard<std::mutex> lk(m_done);
     state = DONE;
-    cv_done.notify_one();
   }
 }
 
+void RaytracedRenderer::start_reporter() {
+  for (size_t i = 0; i < numWorkerThreads; ++i) {
+    workerStats[i].busy_ns = 0;
+    workerStats[i].rays = 0;
+  }
+
+  if (!statsPath.empty() && !statsFile) {
+    statsFile = statsPath == "-" ? stdout : fopen(statsPath.c_str(), "a");
+    if (!statsFile) {
+      fprintf(stderr, "[PathTracer] Could not open %s for render stats\n", statsPath.c_str());
+      statsPath.clear();
+    }
+  }
+
+  reporterRunning = true;
+  reporterThread = new std::thread(&RaytracedRenderer::reporter_thread, this);
+}
+
+void RaytracedRenderer::stop_reporter() {
+  if (!reporterThread) return;
+  {
+    lock_guard<std::mutex> lk(m_report);
+    reporterRunning = false;
+  }
+  cv_report.notify_one();
+  reporterThread->join();
+  delete reporterThread;
+  reporterThread = NULL;
+}
+
+void RaytracedRenderer::reporter_thread() {
+  // print once per interval from the counters the workers bump; the workers
+  // themselves never wait on console output
+  const std::chrono::milliseconds interval(1000);
+  vector<uint64_t> last_busy(numWorkerThreads, 0);
+  uint64_t last_rays = 0;
+  double last_time = 0;
+
+  unique_lock<std::mutex> lk(m_report);
+  while (!cv_report.wait_for(lk, interval, [this]{ return !reporterRunning; })) {
+    double now = elapsed_time();
+    double dt = max(now - last_time, 1e-9);
+    last_time = now;
+
+    uint64_t rays = 0;
+    double util_sum = 0, util_min = 1;
+    vector<double> util(numWorkerThreads);
+    for (size_t i = 0; i < numWorkerThreads; ++i) {
+      uint64_t busy = workerStats[i].busy_ns.load(std::memory_order_relaxed);
+      util[i] = min(1.0, (busy - last_busy[i]) * 1e-9 / dt);
+      last_busy[i] = busy;
+      util_sum += util[i];
+      util_min = min(util_min, util[i]);
+      rays += workerStats[i].rays.load(std::memory_order_relaxed);
+    }
+    double mrays = (rays - last_rays) / dt * 1e-6;
+    last_rays = rays;
+
+    // progressive state only changes between passes, under m_done
+    double progress = (double) tilesDone / max(tilesTotal, (size_t) 1);
+    size_t pass = 0, spp = 0;
+    if (progressive) {
+      lock_guard<std::mutex> plk(m_done);
+      pass = passIndex;
+      spp = samplesDone;
+      double samples = (samplesDone + passSamples * progress) / max(targetSamples, (size_t) 1);
+      progress = timeBudget > 0 ? max(samples, now / timeBudget) : samples;
+    }
+    progress = min(progress, 1.0);
+    double eta = progress > 0 ? now / progress - now : 0;
+
+    if (progressive) {
+      fprintf(stdout, "\r[PathTracer] Rendering... pass %zu (%zu spp) ", pass, spp);
+    } else {
+      fprintf(stdout, "\r[PathTracer] Rendering... ");
+    }
+    fprintf(stdout, "%d%%, ETA %.1fs, %.2f Mrays/s, utilization %.0f%% (min %.0f%%)   ",
+            int(progress * 100), eta, mrays,
+            util_sum / numWorkerThreads * 100, util_min * 100);
+    fflush(stdout);
+
+    if (statsFile) {
+      fprintf(statsFile, "{\"time\": %.3f, \"progress\": %.4f, \"eta\": %.3f, "
+              "\"mrays_per_sec\": %.4f, \"pass\": %zu, \"spp\": %zu, \"utilization\": [",
+              now, progress, eta, mrays, pass, spp);
+      for (size_t i = 0; i < numWorkerThreads; ++i) {
+        fprintf(statsFile, i ? ", %.3f" : "%.3f", util[i]);
+      }
+      fprintf(statsFile, "]}\n");
+      fflush(statsFile);
+    }
+
+    // written from here so the workers never wait on the disk
+    if (!checkpointPath.empty() && !render_cell && checkpointInterval > 0 &&
+        now - lastCheckpoint >= checkpointInterval) {
+      lk.unlock();
+      save_checkpoint();
+      lastCheckpoint = now;
+      lk.lock();
+    }
+  }
+}
+
+void RaytracedRenderer::save_checkpoint() {
+  RenderCheckpoint ckpt;
+  ckpt.w = frame_w;
+  ckpt.h = frame_h;
+  ckpt.interleave = tilesInterleaved;
+  ckpt.tiles.resize(renderTiles.size());
+  {
+    // with both locks held no tile is committed and no pass starts
+    lock_guard<std::mutex> lk(m_checkpoint);
+    lock_guard<std::mutex> plk(m_done);
+    ckpt.progressive = progressive;
+    ckpt.samples = progressive ? targetSamples : pt->ns_aa;
+    if (progressive) {
+      ckpt.pass_index = passIndex;
+      ckpt.pass_samples = passSamples;
+      ckpt.samples_done = samplesDone;
+    }
+    ckpt.elapsed = elapsed_time();
+    for (size_t i = 0; i < renderTiles.size(); ++i) {
+      const WorkItem& t = renderTiles[i];
+      RenderCheckpoint::Tile tile = { (uint32_t) t.tile_x, (uint32_t) t.tile_y,
+                                      (uint32_t) t.tile_w, (uint32_t) t.tile_h,
+                                      tilePasses[i] };
+      ckpt.tiles[i] = tile;
+    }
+    ckpt.radiance.resize(frame_w * frame_h);
+    ckpt.counts.resize(frame_w * frame_h);
+    for (size_t i = 0; i < ckpt.radiance.size(); ++i) {
+      ckpt.radiance[i] = pt->sampleBuffer.radiance(i);
+      ckpt.counts[i] = pt->sampleBuffer.count(i);
+    }
+  }
+
+  if (!ckpt.save(checkpointPath)) {
+    fprintf(stderr, "\n[PathTracer] Could not write checkpoint %s\n",
+            checkpointPath.c_str());
+  }
+}
+
+bool RaytracedRenderer::resume_from_checkpoint() {
+  RenderCheckpoint ckpt;
+  if (!ckpt.load(checkpointPath)) {
+    fprintf(stderr, "[PathTracer] No checkpoint to resume from in %s, "
+                    "starting over\n", checkpointPath.c_str());
+    return false;
+  }
+  size_t samples = progressive ? targetSamples : pt->ns_aa;
+  if (ckpt.w != frame_w || ckpt.h != frame_h || ckpt.samples != samples ||
+      ckpt.progressive != progressive) {
+    fprintf(stderr, "[PathTracer] Checkpoint %s is of a %ux%u render at %u spp%s, "
+                    "starting over\n", checkpointPath.c_str(), ckpt.w, ckpt.h,
+            ckpt.samples, ckpt.progressive ? " (progressive)" : "");
+    return false;
+  }
+
+  for (size_t i = 0; i < ckpt.radiance.size(); ++i) {
+    pt->sampleBuffer.set(i, ckpt.radiance[i], ckpt.counts[i]);
+  }
+  pt->refresh_framebuffer(frameBuffer, numWorkerThreads);
+
+  vector<WorkItem> tiles(ckpt.tiles.size());
+  size_t done = 0;
+  for (size_t i = 0; i < tiles.size(); ++i) {
+    const RenderCheckpoint::Tile& t = ckpt.tiles[i];
+    tiles[i] = WorkItem(t.x, t.y, t.w, t.h);
+  }
+  set_tiles(tiles, ckpt.interleave);
+  for (size_t i = 0; i < tiles.size(); ++i) {
+    tilePasses[i] = ckpt.tiles[i].passes;
+    if (tilePasses[i] > ckpt.pass_index) done++;
+  }
+
+  if (progressive) {
+    passIndex = ckpt.pass_index;
+    passSamples = ckpt.pass_samples;
+    samplesDone = ckpt.samples_done;
+    pt->ns_aa = passSamples;
+  }
+  renderStart -= std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(ckpt.elapsed));
+
+  fprintf(stdout, "[PathTracer] Resuming from %s: %zu of %zu tiles done",
+          checkpointPath.c_str(), done, tiles.size());
+  if (progressive) {
+    fprintf(stdout, " in pass %u (%u spp)", ckpt.pass_index, ckpt.samples_done);
+  }
+  fprintf(stdout, ", %.1fs rendered\n", ckpt.elapsed);
+  return true;
+}
+
+void RaytracedRenderer::denoise_image() {
+  fprintf(stdout, "[PathTracer] Denoising %zux%zu image (%zu iterations)... ",
+          frame_w, frame_h, denoiser.iterations);
+  fflush(stdout);
+
+  Timer denoise_timer;
+  denoise_timer.start();
+
+  HDRImageBuffer albedo, normal, depth;
+  pt->aovs.resolve(AOV_ALBEDO, &albedo);
+  pt->aovs.resolve(AOV_NORMAL, &normal);
+  pt->aovs.resolve(AOV_DEPTH, &depth);
+
+  Denoiser::Features features;
+  features.albedo = &albedo;
+  features.normal = &normal;
+  features.depth = &depth;
+  // the denoiser filters doubles; the sample counts stay as they are
+  HDRImageBuffer image(frame_w, frame_h);
+  for (size_t i = 0; i < image.data.size(); ++i) {
+    image.data[i] = pt->sampleBuffer.radiance(i);
+  }
+  denoiser.denoise(image, features, numWorkerThreads);
+  for (size_t i = 0; i < image.data.size(); ++i) {
+    pt->sampleBuffer.set(i, image.data[i], pt->sampleBuffer.count(i));
+  }
+  pt->refresh_framebuffer(frameBuffer, numWorkerThreads);
+
+  denoise_timer.stop();
+  fprintf(stdout, "Done! (%.4fs)\n", denoise_timer.duration());
+}
+
 void RaytracedRenderer::save_image(string filename, ImageBuffer* buffer) {
 
   if (state != DONE) return;
@@ -726,6 +1507,43 @@ void RaytracedRenderer::save_image(string filename, ImageBuffer* buffer) {
   delete[] frame_out;
 
   save_sampling_rate_image(filename);
+  if (hdrOutput != "") save_hdr_image(filename);
+  else if (pt->aovs.any()) save_aov_image(filename);
+  if (renderCost && !render_cell) save_cost_image(filename);
+}
+
+void RaytracedRenderer::save_hdr_image(string filename) {
+  size_t w = frame_w;
+  size_t h = frame_h;
+  bool half = hdrOutput == "half";
+
+  // sample counts stay float, half is only exact up to 2048
+  std::vector<EXRChannel> channels;
+  const char* rgb[3] = { "R", "G", "B" };
+  for (int c = 0; c < 3; ++c) {
+    channels.push_back(EXRChannel(rgb[c], w * h, half));
+  }
+  channels.push_back(EXRChannel("samples", w * h));
+  for (size_t y = 0; y < h; ++y) {
+    for (size_t x = 0; x < w; ++x) {
+      size_t i = x + y * w;
+      size_t o = x + (h - 1 - y) * w;  // exr scanlines run top to bottom
+      Vector3D s = pt->sampleBuffer.radiance(i);
+      for (int c = 0; c < 3; ++c) {
+        channels[c].data[o] = s[c];
+      }
+      channels[3].data[o] = pt->sampleBuffer.count(i);
+    }
+  }
+  if (pt->aovs.any()) append_aov_channels(channels, half);
+
+  EXRWriteOptions options;
+  options.num_threads = numWorkerThreads;
+
+  std::string hdr_filename = filename.substr(0, filename.size() - 4) + ".exr";
+  fprintf(stderr, "[PathTracer] Saving HDR image to file %s... ", hdr_filename.c_str());
+  if (save_exr(hdr_filename, channels, w, h, options))
+    fprintf(stderr, "Done!\n");
 }
 
 void RaytracedRenderer::save_sampling_rate_image(string filename) {
@@ -735,7 +1553,7 @@ void RaytracedRenderer::save_sampling_rate_image(string filename) {
 
   for (int x = 0; x < w; x++) {
       for (int y = 0; y < h; y++) {
-          float samplingRate = pt->sampleCountBuffer[y * w + x] * 1.0f / pt->ns_aa;
+          float samplingRate = pt->sampleBuffer.count(y * w + x) * 1.0f / pt->ns_aa;
 
           Color c;
           if (samplingRate <= 0.5) {
@@ -761,4 +1579,107 @@ void RaytracedRenderer::save_sampling_rate_image(string filename) {
   delete[] frame_out;
 }
 
+void RaytracedRenderer::save_aov_image(string filename) {
+  std::vector<EXRChannel> channels;
+  append_aov_channels(channels, false);
+
+  EXRWriteOptions options;
+  options.num_threads = numWorkerThreads;
+
+  std::string aov_filename = filename.substr(0, filename.size() - 4) + "_aov.exr";
+  fprintf(stderr, "[PathTracer] Saving AOVs to file %s... ", aov_filename.c_str());
+  if (save_exr(aov_filename, channels, pt->aovs.w, pt->aovs.h, options))
+    fprintf(stderr, "Done!\n");
+}
+
+void RaytracedRenderer::append_aov_channels(std::vector<EXRChannel>& channels,
+                                            bool half) const {
+  const AOVBuffers& aovs = pt->aovs;
+  size_t w = aovs.w;
+  size_t h = aovs.h;
+
+  const char* rgb[3] = { "R", "G", "B" };
+  HDRImageBuffer resolved;
+  for (int t = 0; t < NUM_AOV_TYPES; ++t) {
+    AOVType type = (AOVType) t;
+    if (!aovs.enabled(type)) continue;
+    aovs.resolve(type, &resolved);
+
+    size_t nc = AOVBuffers::num_channels(type);
+    for (size_t c = 0; c < nc; ++c) {
+      std::string name = AOVBuffers::name(type);
+      name += nc == 1 ? ".Z" : std::string(".") + rgb[c];
+      // primitive ids are not exact in half
+      channels.push_back(EXRChannel(name, w * h, half && type != AOV_PRIMITIVE_ID));
+      std::vector<float>& values = channels.back().data;
+      for (size_t y = 0; y < h; ++y) {
+        for (size_t x = 0; x < w; ++x) {
+          // exr scanlines run top to bottom
+          values[x + (h - 1 - y) * w] = resolved.data[x + y * w][c];
+        }
+      }
+    }
+  }
+}
+
+void RaytracedRenderer::save_cost_image(string filename) {
+  size_t w = costMap.w;
+  size_t h = costMap.h;
+
+  // exr keeps the raw numbers, flipped since exr scanlines run top to bottom
+  // the counts are all zero in builds without the ray counters
+  std::vector<EXRChannel> channels;
+  channels.push_back(EXRChannel("time_us", w * h));
+#ifdef CGL_RAY_COUNTERS
+  channels.push_back(EXRChannel("bounces", w * h));
+  channels.push_back(EXRChannel("bvh_visits", w * h));
+#endif
+  float max_time = 0;
+  for (size_t y = 0; y < h; ++y) {
+    for (size_t x = 0; x < w; ++x) {
+      size_t i = x + y * w;
+      size_t o = x + (h - 1 - y) * w;
+      channels[0].data[o] = costMap.time_us(i);
+#ifdef CGL_RAY_COUNTERS
+      channels[1].data[o] = costMap.bounces[i];
+      channels[2].data[o] = costMap.visits[i];
+#endif
+      max_time = max(max_time, channels[0].data[o]);
+    }
+  }
+
+  string base = filename.substr(0, filename.size() - 4);
+  fprintf(stderr, "[PathTracer] Saving render cost to file %s_cost.exr... ", base.c_str());
+  EXRWriteOptions options;
+  options.num_threads = numWorkerThreads;
+  if (save_exr(base + "_cost.exr", channels, w, h, options))
+    fprintf(stderr, "Done!\n");
+
+  // png maps time on a log scale from blue (cheap) over green to red
+  const std::vector<float>& time_us = channels[0].data;
+  ImageBuffer outputBuffer(w, h);
+  double log_max = log(1.0 + max_time);
+  for (size_t i = 0; i < w * h; ++i) {
+    float t = log_max > 0 ? log(1.0 + time_us[i]) / log_max : 0;
+    Color c;
+    if (t <= 0.5) {
+      float r = t / 0.5;
+      c = Color(0.0f, 0.0f, 1.0f) * (1.0 - r) + Color(0.0f, 1.0f, 0.0f) * r;
+    } else {
+      float r = (t - 0.5) / 0.5;
+      c = Color(0.0f, 1.0f, 0.0f) * (1.0 - r) + Color(1.0f, 0.0f, 0.0f) * r;
+    }
+    outputBuffer.update_pixel(c, i % w, i / w);
+  }
+
+  uint32_t* frame_out = new uint32_t[w * h];
+  for (size_t i = 0; i < w * h; ++i) {
+    frame_out[i] = outputBuffer.data[i] | 0xFF000000;
+  }
+
+  lodepng::encode(base + "_cost.png", (unsigned char*) frame_out, w, h);
+
+  delete[] frame_out;
+}
+
 }  // namespace CGL
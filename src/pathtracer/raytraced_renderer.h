@@ -8,14 +8,24 @@
 #include <condition_variable>
 #include <vector>
 #include <algorithm>
+#include <chrono>
 
 #include "CGL/timer.h"
 
 #include "scene/bvh.h"
 #include "pathtracer/camera.h"
 #include "pathtracer/sampler.h"
+#include "pathtracer/denoiser.h"
+#include "pathtracer/distributed.h"
+#include "pathtracer/render_cost.h"
+#include "pathtracer/tile_order.h"
+#include "pathtracer/checkpoint.h"
 #include "util/image.h"
 #include "util/work_queue.h"
+#include "util/work_stealing_queue.h"
+#include "util/thread_pool.h"
+#include "util/cpu_topology.h"
+#include "util/exr_io.h"
 #include "pathtracer/intersection.h"
 
 #include "application/renderer.h"
@@ -39,12 +49,14 @@ struct WorkItem {
   WorkItem() : WorkItem(0, 0, 0, 0) { }
 
   WorkItem(int x, int y, int w, int h)
-      : tile_x(x), tile_y(y), tile_w(w), tile_h(h) {}
+      : tile_x(x), tile_y(y), tile_w(w), tile_h(h), index(0) {}
 
   int tile_x;
   int tile_y;
   int tile_w;
   int tile_h;
+  size_t index;  ///< position in the render's tile list
+
 
 };
 
@@ -70,11 +82,28 @@ public:
              size_t num_threads = 1,
              size_t samples_per_batch = 32,
              float max_tolerance = 0.05f,
-             HDRImageBuffer* envmap = NULL,
+             EnvironmentMap* envmap = NULL,
              bool direct_hemisphere_sample = false,
              string filename = "",
              double lensRadius = 0.25,
-             double focalDistance = 4.7);
+             double focalDistance = 4.7,
+             size_t ns_light_bvh = 0,
+             string envmap_path = "",
+             bool progressive = false,
+             double time_budget = 0,
+             bool denoise = false,
+             string aovs = "",
+             bool render_cost = false,
+             size_t tile_size = 32,
+             string tile_order = "raster",
+             string stats_path = "",
+             string thread_placement = "none",
+             string hdr_output = "",
+             string checkpoint_path = "",
+             double checkpoint_interval = 60,
+             bool resume = false,
+             bool high_precision = false,
+             string tonemap = "linear");
 
   /**
    * Destructor.
@@ -146,6 +175,18 @@ public:
 
   void raytrace_cell(ImageBuffer& buffer);
 
+  /**
+   * Render the image with worker processes connected to coordinator and
+   * save the merged result like render_to_file, plus the HDR image.
+   */
+  void render_distributed(std::string filename, RenderCoordinator* coordinator);
+
+  /**
+   * Render regions handed out by the coordinator at address until it has
+   * no more.
+   */
+  void render_worker(std::string address);
+
   /**
    * If the pathtracer is in VISUALIZE, handle key presses to traverse the bvh.
    */
@@ -156,11 +197,32 @@ public:
    */
   void save_image(std::string filename="", ImageBuffer* buffer=NULL);
 
+  /**
+   * Save the linear radiance, sample counts and AOVs to an exr file, in
+   * half or float as requested by hdrOutput.
+   */
+  void save_hdr_image(std::string filename);
+
   /**
    * Save sampling rates to png file.
    */
   void save_sampling_rate_image(std::string filename);
 
+  /**
+   * Save the requested AOVs to a multi-channel float exr file.
+   */
+  void save_aov_image(std::string filename);
+
+  /**
+   * Add the requested AOVs to channels, named <aov>.<component>.
+   */
+  void append_aov_channels(std::vector<EXRChannel>& channels, bool half) const;
+
+  /**
+   * Save the per-pixel render cost to an exr file and a false-color png.
+   */
+  void save_cost_image(std::string filename);
+
  private:
 
   /**
@@ -173,6 +235,12 @@ public:
    */
   void build_accel();
 
+  /**
+   * Delete the scene along with its primitives. The environment light is
+   * the path tracer's and is kept.
+   */
+  void release_scene();
+
   /**
    * Visualize acceleration structures.
    */
@@ -184,12 +252,98 @@ public:
    * Raytrace a tile of the scene and update the frame buffer. Is run
    * in a worker thread.
    */
-  void raytrace_tile(int tile_x, int tile_y, int tile_w, int tile_h);
+  void raytrace_tile(const WorkItem& work);
 
   /**
    * Implementation of a ray tracer worker thread
+   * \param worker_id index of the worker's deque in workQueue
+   */
+  void worker_thread(size_t worker_id);
+
+  /**
+   * Run by the last worker to finish a render: restore settings, print
+   * statistics, denoise, and transition to DONE (or READY if canceled).
+   */
+  void finish_raytracing();
+
+  /**
+   * Pin the workers to CPUs: "pin" pins each to a core, "numa" to a NUMA
+   * node and makes them steal tiles within their node first.
+   */
+  void place_workers(const CPUTopology& topology, const string& placement);
+
+  /**
+   * Start and stop the thread that periodically reports render progress.
+   */
+  void start_reporter();
+  void stop_reporter();
+
+  /**
+   * Print progress, ETA, ray throughput and worker utilization once a
+   * second, and append them to statsFile as JSON lines.
+   */
+  void reporter_thread();
+
+  /**
+   * Put the tiles of the frame (or of the selected cell) on the work queue,
+   * in the order given by tileOrder.
+   */
+  void populate_work_queue();
+
+  /**
+   * Number the tiles, reset their pass counts and hand them to the work
+   * queue.
    */
-  void worker_thread();
+  void set_tiles(std::vector<WorkItem>& tiles, bool interleave);
+
+  /**
+   * Snapshot the render into checkpointPath. Safe to call while the
+   * workers are rendering; they only wait for the buffers to be copied.
+   */
+  void save_checkpoint();
+
+  /**
+   * Restore the buffers, tiles and progressive state of checkpointPath.
+   * \return false if there is no usable checkpoint for this render
+   */
+  bool resume_from_checkpoint();
+
+  /**
+   * Quick pilot pass: time a few camera rays per tile as an estimate of the
+   * relative cost of rendering it.
+   */
+  std::vector<double> estimate_tile_costs(const std::vector<WorkItem>& tiles);
+
+  /**
+   * Split tiles whose estimated cost is a large share of the frame into
+   * quadrants, so no single tile holds up the end of the render.
+   */
+  void split_costly_tiles(std::vector<WorkItem>& tiles, std::vector<double>& costs);
+
+  /**
+   * Sort tiles (and their keys) by key.
+   */
+  void sort_tiles(std::vector<WorkItem>& tiles, std::vector<double>& keys,
+                  bool descending);
+
+  /**
+   * In progressive mode, called with m_done held when all tiles of a pass
+   * are done. Sets up the next pass at a higher sample count and returns
+   * true, or returns false once the sample target or time budget is reached.
+   * The caller queues the pass's tiles with workQueue.restart().
+   */
+  bool start_next_pass();
+
+  /**
+   * Seconds since start_raytracing.
+   */
+  double elapsed_time() const;
+
+  /**
+   * Run the denoiser over the finished sample buffer and refresh the frame
+   * buffer from it.
+   */
+  void denoise_image();
 
   enum State {
     INIT,               ///< to be initialized
@@ -209,10 +363,6 @@ public:
 
   // Integration state //
 
-  vector<int> tile_samples; ///< current sample rate for tile
-  size_t num_tiles_w;       ///< number of tiles along width of the image
-  size_t num_tiles_h;       ///< number of tiles along height of the image
-
   size_t frame_w, frame_h;
 
   double lensRadius;
@@ -221,6 +371,7 @@ public:
   // Components //
 
   BVHAccel* bvh;                 ///< BVH accelerator aggregate
+  LightBVH* lightBVH;            ///< light BVH for many-light sampling
   ImageBuffer frameBuffer;       ///< frame buffer
   Timer timer;                   ///< performance test timer
 
@@ -230,15 +381,71 @@ public:
 
   size_t numWorkerThreads;
   size_t imageTileSize;
+  TileOrder tileOrder;
 
   bool continueRaytracing;                  ///< rendering should continue
-  std::vector<std::thread*> workerThreads;  ///< pool of worker threads
-  std::atomic<int> workerDoneCount;         ///< worker threads management
-  WorkQueue<WorkItem> workQueue;            ///< queue of work for the workers
-  std::condition_variable cv_done;
+  ThreadPool* pool;                         ///< persistent pool of worker threads
+  std::future<void> renderDone;             ///< ready once the render finished
+  WorkStealingQueue<WorkItem> workQueue;    ///< per-worker tile deques
   std::mutex m_done;
-  size_t tilesDone;
+  std::atomic<size_t> tilesDone;
   size_t tilesTotal;
+  std::chrono::steady_clock::time_point renderStart;
+
+  // Progressive rendering //
+
+  bool progressive;           ///< sweep all tiles repeatedly at increasing spp
+  double timeBudget;          ///< wall-clock budget in seconds (0 = none)
+  size_t targetSamples;       ///< samples per pixel to reach
+  size_t passSamples;         ///< samples per pixel taken by the current pass
+  size_t samplesDone;         ///< samples per pixel of the completed passes
+  std::atomic<size_t> passIndex; ///< index of the current pass
+  bool progressiveDone;       ///< no further passes will be scheduled
+  bool passCut;               ///< the time budget ended the last pass early
+  std::condition_variable cv_pass;
+
+  // Progress reporting //
+
+  /**
+   * Counters a worker bumps once per tile, padded to a cache line each.
+   */
+  struct WorkerStats {
+    WorkerStats() : busy_ns(0), rays(0) { }
+    std::atomic<uint64_t> busy_ns;  ///< time spent rendering tiles
+    std::atomic<uint64_t> rays;     ///< rays traced
+    char pad[48];
+  };
+
+  WorkerStats* workerStats;         ///< one per worker
+  std::thread* reporterThread;      ///< prints progress while rendering
+  bool reporterRunning;
+  std::mutex m_report;
+  std::condition_variable cv_report;
+  std::string statsPath;            ///< where to write JSON lines stats
+  FILE* statsFile;
+
+  std::string hdrOutput;            ///< "half" or "float" to save an exr too
+
+  // Checkpointing //
+
+  std::string checkpointPath;       ///< where to checkpoint, empty for never
+  double checkpointInterval;        ///< seconds between checkpoints (0 = on cancel only)
+  double lastCheckpoint;            ///< elapsed time of the last checkpoint
+  bool resume;                      ///< resume the next render from checkpointPath
+  std::vector<WorkItem> renderTiles;  ///< tiles of the current render
+  bool tilesInterleaved;            ///< renderTiles are dealt out round-robin
+  std::vector<uint32_t> tilePasses; ///< passes committed, per tile
+  std::mutex m_checkpoint;          ///< held while committing or snapshotting
+
+  // Denoising //
+
+  bool denoise;               ///< denoise the image once rendering completes
+  Denoiser denoiser;          ///< a-trous filter guided by pt's AOVs
+
+  // Render cost instrumentation //
+
+  bool renderCost;            ///< record time, BVH visits and bounces per pixel
+  RenderCostMap costMap;      ///< per-pixel cost of the current render
 
   // Visualizer Controls //
 
@@ -0,0 +1,28 @@
+#include "render_cost.h"
+
+namespace CGL {
+
+thread_local RayCounters ray_counters;
+
+void RenderCostMap::resize(size_t w, size_t h) {
+  this->w = w;
+  this->h = h;
+  cycles_buffer.assign(w * h, 0);
+  visits.assign(w * h, 0);
+  bounces.assign(w * h, 0);
+  cycles_per_second = 1e9;
+}
+
+void RenderCostMap::start_clock() {
+  start_time = std::chrono::steady_clock::now();
+  start_cycles = read_cycle_counter();
+}
+
+void RenderCostMap::stop_clock() {
+  uint64_t cycles = read_cycle_counter() - start_cycles;
+  double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start_time).count();
+  if (seconds > 0 && cycles > 0) cycles_per_second = cycles / seconds;
+}
+
+} // namespace CGL
@@ -0,0 +1,110 @@
+#ifndef CGL_RENDER_COST_H
+#define CGL_RENDER_COST_H
+
+#include <vector>
+#include <cstdint>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CGL_HAS_RDTSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+namespace CGL {
+
+/**
+ * Per-thread counters of the work done while tracing rays. They are plain
+ * thread-local integers, so bumping them never touches memory shared with
+ * other render threads. rays is always counted, once per BVH query, for
+ * the progress report's Mrays/s; the others only in builds that define
+ * CGL_RAY_COUNTERS, see COUNT_RAY_EVENT.
+ */
+struct RayCounters {
+  RayCounters() : rays(0), bvh_visits(0), bounces(0) { }
+
+  uint64_t rays;        ///< rays traced through the BVH
+  uint64_t bvh_visits;  ///< BVH nodes visited by intersection queries
+  uint64_t bounces;     ///< path vertices past the first hit
+};
+
+extern thread_local RayCounters ray_counters;
+
+/**
+ * Bump a per-node or per-bounce field of the calling thread's
+ * ray_counters. Without CGL_RAY_COUNTERS (the BUILD_RAY_COUNTERS option)
+ * this compiles to nothing, and those counters stay zero.
+ */
+#ifdef CGL_RAY_COUNTERS
+#define COUNT_RAY_EVENT(counter) (++CGL::ray_counters.counter)
+#else
+#define COUNT_RAY_EVENT(counter) ((void) 0)
+#endif
+
+/**
+ * Read the CPU timestamp counter, or a nanosecond clock where there is none.
+ */
+inline uint64_t read_cycle_counter() {
+#ifdef CGL_HAS_RDTSC
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**
+ * Per-pixel render cost: time spent in raytrace_pixel, BVH nodes visited
+ * and bounces traced. Like the sample buffer, each pixel is only written by
+ * the thread rendering its tile.
+ */
+class RenderCostMap {
+ public:
+
+  RenderCostMap() : w(0), h(0) { }
+
+  void resize(size_t w, size_t h);
+
+  /**
+   * Add the cost of one raytrace_pixel call to pixel (x, y).
+   */
+  void record(size_t x, size_t y, uint64_t cycles,
+              const RayCounters& before, const RayCounters& after) {
+    size_t i = x + y * w;
+    cycles_buffer[i] += cycles;
+    visits[i] += after.bvh_visits - before.bvh_visits;
+    bounces[i] += after.bounces - before.bounces;
+  }
+
+  /**
+   * Start and stop timing the render, used to turn cycles into seconds.
+   */
+  void start_clock();
+  void stop_clock();
+
+  /**
+   * Time spent on pixel i in microseconds.
+   */
+  float time_us(size_t i) const {
+    return (float) (cycles_buffer[i] * 1e6 / cycles_per_second);
+  }
+
+  size_t w, h;
+  std::vector<uint64_t> cycles_buffer;  ///< timestamp counter ticks
+  std::vector<float> visits;            ///< BVH node visits
+  std::vector<float> bounces;           ///< bounces traced
+
+ private:
+
+  double cycles_per_second;
+  uint64_t start_cycles;
+  std::chrono::steady_clock::time_point start_time;
+
+}; // class RenderCostMap
+
+} // namespace CGL
+
+#endif // CGL_RENDER_COST_H
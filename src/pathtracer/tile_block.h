@@ -0,0 +1,80 @@
+#ifndef CGL_TILE_BLOCK_H
+#define CGL_TILE_BLOCK_H
+
+#include <vector>
+#include <algorithm>
+
+#include "CGL/vector3D.h"
+#include "util/sample_buffer.h"
+
+namespace CGL {
+
+/**
+ * Private accumulation block for the tile a worker is rendering. Samples go
+ * here instead of straight into the shared sample buffers, whose rows are
+ * shared with the neighbouring tiles (and their cache lines with the
+ * neighbouring workers). The block is committed to the shared buffers once
+ * the tile is done, a row at a time.
+ */
+struct TileBlock {
+  TileBlock() : x0(0), y0(0), w(0), h(0) { }
+
+  /**
+   * Start accumulating the tile [x0, x0 + w) x [y0, y0 + h).
+   */
+  void bind(size_t x0, size_t y0, size_t w, size_t h) {
+    this->x0 = x0;
+    this->y0 = y0;
+    this->w = w;
+    this->h = h;
+    // keep the allocation between tiles; only grow it
+    if (radiance.size() < w * h) {
+      radiance.resize(w * h);
+      counts.resize(w * h);
+    }
+    std::fill(radiance.begin(), radiance.begin() + w * h, Vector3D());
+    std::fill(counts.begin(), counts.begin() + w * h, 0);
+  }
+
+  bool contains(size_t x, size_t y) const {
+    return x >= x0 && x < x0 + w && y >= y0 && y < y0 + h;
+  }
+
+  /**
+   * Store the estimate of pixel (x, y), in image coordinates.
+   */
+  void set(size_t x, size_t y, const Vector3D& s, int num_samples) {
+    size_t i = (x - x0) + (y - y0) * w;
+    radiance[i] = s;
+    counts[i] = num_samples;
+  }
+
+  /**
+   * Write the block into the shared buffer. With blend, the block holds one
+   * more pass of samples, which are averaged into what the buffer already
+   * holds weighted by sample counts.
+   */
+  void commit(SampleBuffer& buffer, bool blend) const {
+    for (size_t y = 0; y < h; ++y) {
+      const Vector3D* src = &radiance[y * w];
+      const int* src_counts = &counts[y * w];
+      size_t row = x0 + (y0 + y) * buffer.w;
+
+      if (!blend) {
+        for (size_t x = 0; x < w; ++x) buffer.set(row + x, src[x], src_counts[x]);
+        continue;
+      }
+      for (size_t x = 0; x < w; ++x) buffer.blend(row + x, src[x], src_counts[x]);
+    }
+  }
+
+  size_t x0, y0;                  ///< tile origin in the image
+  size_t w, h;                    ///< tile size
+  std::vector<Vector3D> radiance; ///< per-pixel estimate, row-major
+  std::vector<int> counts;        ///< per-pixel sample count
+
+}; // struct TileBlock
+
+} // namespace CGL
+
+#endif // CGL_TILE_BLOCK_H
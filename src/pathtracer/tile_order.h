@@ -0,0 +1,70 @@
+#ifndef CGL_TILE_ORDER_H
+#define CGL_TILE_ORDER_H
+
+#include <string>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+namespace CGL {
+
+/**
+ * Order in which the renderer hands out tiles.
+ */
+enum TileOrder {
+  TILE_ORDER_RASTER,   ///< row by row
+  TILE_ORDER_HILBERT,  ///< along a Hilbert curve, keeping each worker's tiles compact
+  TILE_ORDER_SPIRAL,   ///< center out, so the interesting part shows up first
+  TILE_ORDER_COST      ///< most expensive first, estimated by a pilot pass
+};
+
+/**
+ * Parse "raster", "hilbert", "spiral" or "cost".
+ * \return false if the name is not recognized
+ */
+inline bool parse_tile_order(const std::string& name, TileOrder* order) {
+  if (name == "raster") *order = TILE_ORDER_RASTER;
+  else if (name == "hilbert") *order = TILE_ORDER_HILBERT;
+  else if (name == "spiral") *order = TILE_ORDER_SPIRAL;
+  else if (name == "cost") *order = TILE_ORDER_COST;
+  else return false;
+  return true;
+}
+
+/**
+ * Distance of cell (x, y) along the Hilbert curve filling an n x n grid,
+ * n a power of two.
+ */
+inline uint64_t hilbert_index(uint32_t n, uint32_t x, uint32_t y) {
+  uint64_t d = 0;
+  for (uint32_t s = n / 2; s > 0; s /= 2) {
+    uint32_t rx = (x & s) > 0;
+    uint32_t ry = (y & s) > 0;
+    d += (uint64_t) s * s * ((3 * rx) ^ ry);
+    // rotate the quadrant so the curve stays continuous
+    if (ry == 0) {
+      if (rx == 1) {
+        x = n - 1 - x;
+        y = n - 1 - y;
+      }
+      uint32_t t = x; x = y; y = t;
+    }
+  }
+  return d;
+}
+
+/**
+ * Sort key walking outwards from (cx, cy) in square rings, each ring
+ * clockwise by angle.
+ */
+inline double spiral_key(double x, double y, double cx, double cy) {
+  double dx = x - cx;
+  double dy = y - cy;
+  double ring = std::floor(std::max(std::fabs(dx), std::fabs(dy)));
+  double angle = std::atan2(dy, dx) + M_PI;  // [0, 2pi]
+  return ring * 8 + angle;
+}
+
+} // namespace CGL
+
+#endif // CGL_TILE_ORDER_H
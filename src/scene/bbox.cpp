@@ -1,6 +1,8 @@
 #include "bbox.h"
 
+#ifndef CGL_HEADLESS
 #include "GL/glew.h"
+#endif
 
 #include <algorithm>
 #include <iostream>
@@ -20,6 +22,7 @@ bool BBox::intersect(const Ray& r, double& t0, double& t1) const {
 }
 
 void BBox::draw(Color c, float alpha) const {
+#ifndef CGL_HEADLESS
 
   glColor4f(c.r, c.g, c.b, alpha);
 
@@ -53,6 +56,7 @@ void BBox::draw(Color c, float alpha) const {
   glVertex3d(min.x, min.y, max.z);
   glEnd();
 
+#endif
 }
 
 std::ostream& operator<<(std::ostream& os, const BBox& b) {
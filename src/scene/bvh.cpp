@@ -2,6 +2,7 @@
 
 #include "CGL/CGL.h"
 #include "triangle.h"
+#include "pathtracer/render_cost.h"
 
 #include <iostream>
 #include <stack>
@@ -81,8 +82,11 @@ bool BVHAccel::has_intersection(const Ray &ray, BVHNode *node) const {
   // Take note that this function has a short-circuit that the
   // Intersection version cannot, since it returns as soon as it finds
   // a hit, it doesn't actually have to find the closest hit.
+  // Test each node you visit with visit(), which counts it.
 
-
+  double t0 = ray.min_t, t1 = ray.max_t;
+  if (!visit(ray, node, t0, t1))
+    return false;
 
   for (auto p : primitives) {
     total_isects++;
@@ -97,8 +101,11 @@ bool BVHAccel::has_intersection(const Ray &ray, BVHNode *node) const {
 bool BVHAccel::intersect(const Ray &ray, Intersection *i, BVHNode *node) const {
   // TODO (Part 2.3):
   // Fill in the intersect function.
+  // Test each node you visit with visit(), which counts it.
 
-
+  double t0 = ray.min_t, t1 = ray.max_t;
+  if (!visit(ray, node, t0, t1))
+    return false;
 
   bool hit = false;
   for (auto p : primitives) {
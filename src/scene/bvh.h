@@ -3,6 +3,7 @@
 
 #include "scene.h"
 #include "aggregate.h"
+#include "pathtracer/render_cost.h"
 
 #include <vector>
 
@@ -63,7 +64,8 @@ class BVHAccel : public Aggregate {
   /**
    * Destructor.
    * The destructor only destroys the Aggregate itself, the primitives that
-   * it contains are left untouched.
+   * it contains are left untouched; they belong to the scene's
+   * PrimitiveArena and are freed with the scene.
    */
   ~BVHAccel();
 
@@ -83,6 +85,7 @@ class BVHAccel : public Aggregate {
    */
   bool has_intersection(const Ray& r) const {
     ++total_rays;
+    ++ray_counters.rays;
     return has_intersection(r, root);
   }
 
@@ -103,11 +106,27 @@ class BVHAccel : public Aggregate {
    */
   bool intersect(const Ray& r, Intersection* i) const {
     ++total_rays;
+    ++ray_counters.rays;
     return intersect(r, i, root);
   }
 
   bool intersect(const Ray& r, Intersection* i, BVHNode *node) const;
 
+  /**
+   * Ray - node bounding box test, counting the node as visited. Traversals
+   * test every node they visit with it, so the BVH visits of the render
+   * cost map are the nodes actually visited.
+   * \param r ray to test
+   * \param node node whose box is tested
+   * \param t0 lower end of the ray's interval, raised to the box entry
+   * \param t1 upper end of the ray's interval, lowered to the box exit
+   * \return true if the ray hits the box within [t0, t1]
+   */
+  bool visit(const Ray& r, const BVHNode* node, double& t0, double& t1) const {
+    COUNT_RAY_EVENT(bvh_visits);
+    return node->bb.intersect(r, t0, t1);
+  }
+
   /**
    * Get BSDF of the surface material
    * Note that this does not make sense for the BVHAccel aggregate
@@ -9,8 +9,13 @@
 #include <sstream>
 #include <iostream>
 #include <algorithm>
+#include <thread>
 
+#include "collada_stream.h"
 #include "pathtracer/bsdf.h"
+#include "util/mapped_file.h"
+#include "util/parallel_for.h"
+#include "util/startup_profiler.h"
 
 #define stat(s) cerr << "[COLLADA Parser] " << s << endl;
 
@@ -24,6 +29,9 @@ SceneInfo* ColladaParser::scene; // pointer to output scene description
 Vector3D ColladaParser::up; // scene up direction
 Matrix4x4 ColladaParser::transform; // current transformation
 map<string, XMLElement*> ColladaParser::sources; // URI lookup table
+const char* ColladaParser::array_data; // mapped number array text
+size_t ColladaParser::array_size;
+vector<pair<XMLElement*, PolymeshInfo*> > ColladaParser::geometries;
 
 // Parser Helpers //
 
@@ -155,13 +163,27 @@ XMLElement* ColladaParser::get_technique_blender( XMLElement* xml ) {
 
 int ColladaParser::load( const char* filename, SceneInfo* sceneInfo ) {
 
+  ProfilePhase phase("Collada parse");
   ifstream in (filename);
   if (!in.is_open()) {
     return -1;
   } in.close();
 
+  // Map the file and hand tinyxml2 only its structure; the number arrays
+  // that make up most of a large file are parsed from the mapping
+  MappedFile file;
   XMLDocument doc;
-  doc.LoadFile(filename);
+  if (file.open(filename)) {
+    file.advise_sequential();
+    string skeleton = strip_array_text(file.data(), file.size());
+    doc.Parse(skeleton.c_str(), skeleton.size());
+    array_data = file.data();
+    array_size = file.size();
+  } else {
+    doc.LoadFile(filename);
+    array_data = NULL;
+    array_size = 0;
+  }
   if (doc.Error()) {
     stat("XML error: ");
     doc.PrintError();
@@ -234,11 +256,13 @@ int ColladaParser::load( const char* filename, SceneInfo* sceneInfo ) {
     stat("Loading scene...");
 
     // parse all nodes in scene
+    geometries.clear();
     XMLElement* e_node = get_element(e_scene, "node");
     while (e_node) {
       parse_node(e_node);
       e_node = e_node->NextSiblingElement("node");
     }
+    parse_geometries();
 
   } else {
     stat("Error: No scene description found in file:" << filename);
@@ -389,9 +413,9 @@ void ColladaParser::parse_node( XMLElement* xml ) {
   } else if (e_geometry) {
     if (get_element(e_geometry, "mesh")) {
 
-      // mesh geometry
+      // mesh geometry - parsed with the rest once the scene is walked
       PolymeshInfo* polymesh = new PolymeshInfo();
-      parse_polymesh(e_geometry, *polymesh);
+      geometries.push_back(make_pair(e_geometry, polymesh));
 
       // mesh material
       XMLElement* e_instance_material = get_element(xml,
@@ -656,20 +680,15 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
     XMLElement* e_float_array = e_source->FirstChildElement("float_array");
     if (e_float_array) {
 
-      float f; vector<float> floats;
-
-      // load float array string
-      string s = e_float_array->GetText();
-      stringstream ss (s);
-
-      // load float array
+      // load float array straight into the sources table
+      vector<float>& floats = arr_sources[source_id];
       size_t num_floats = e_float_array->IntAttribute("count");
-      for (size_t i = 0; i < num_floats; ++i) {
-        ss >> f; floats.push_back(f);
-      }
+      floats.resize(num_floats);
 
-      // add to array sources
-      arr_sources[source_id] = floats;
+      const char *begin, *end;
+      if (array_text(e_float_array, array_data, array_size, &begin, &end)) {
+        parse_floats(begin, end, floats.data(), num_floats);
+      }
     }
 
     // parse next source
@@ -698,6 +717,7 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
       if (arr_sources.find(source) != arr_sources.end()) {
         vector<float>& floats = arr_sources[source];
         size_t num_floats = floats.size();
+        vertices.reserve(num_floats / 3);
         for (size_t i = 0; i < num_floats; i += 3) {
           Vector3D v = Vector3D(floats[i], floats[i+1], floats[i+2]);
           vertices.push_back(v);
@@ -754,6 +774,7 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
         if (arr_sources.find(source) != arr_sources.end()) {
           vector<float>& floats = arr_sources[source];
           size_t num_floats = floats.size();
+          polymesh.normals.reserve(num_floats / 3);
           for (size_t i = 0; i < num_floats; i += 3) {
             Vector3D n = Vector3D(floats[i], floats[i+1], floats[i+2]);
             polymesh.normals.push_back(n);
@@ -773,6 +794,7 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
         if (arr_sources.find(source) != arr_sources.end()) {
           vector<float>& floats = arr_sources[source];
           size_t num_floats = floats.size();
+          polymesh.texcoords.reserve(num_floats / 2);
           for (size_t i = 0; i < num_floats; i += 2) {
             Vector2D n = Vector2D(floats[i], floats[i+1]);
             polymesh.texcoords.push_back(n);
@@ -797,14 +819,13 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
     XMLElement* e_vcount = e_polylist->FirstChildElement("vcount");
     if (e_vcount) {
 
-      size_t size;
-      string s = e_vcount->GetText();
-      stringstream ss (s);
-
+      sizes.resize(num_polygons);
+      const char *begin, *end;
+      if (array_text(e_vcount, array_data, array_size, &begin, &end)) {
+        parse_indices(begin, end, sizes.data(), num_polygons);
+      }
       for (size_t i = 0; i < num_polygons; ++i) {
-        ss >> size;
-        sizes.push_back(size);
-        num_indices += size * stride;
+        num_indices += sizes[i] * stride;
       }
 
     } else {
@@ -817,13 +838,10 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
     XMLElement* e_p = e_polylist->FirstChildElement("p");
     if (e_p) {
 
-      size_t index;
-      string s = e_p->GetText();
-      stringstream ss (s);
-
-      for (size_t i = 0; i < num_indices; ++i) {
-        ss >> index;
-        indices.push_back(index);
+      indices.resize(num_indices);
+      const char *begin, *end;
+      if (array_text(e_p, array_data, array_size, &begin, &end)) {
+        parse_indices(begin, end, indices.data(), num_indices);
       }
 
     } else {
@@ -838,6 +856,7 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
     if (has_vertex_array) {
       size_t k = 0;
       for (size_t i = 0; i < num_polygons; ++i) {
+        polymesh.polygons[i].vertex_indices.reserve(sizes[i]);
         for (size_t j = 0; j < sizes[i]; ++j) {
           polymesh.polygons[i].vertex_indices.push_back(
             indices[k * stride + vertex_offset]
@@ -851,6 +870,7 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
     if (has_normal_array) {
       size_t k = 0;
       for (size_t i = 0; i < num_polygons; ++i) {
+        polymesh.polygons[i].normal_indices.reserve(sizes[i]);
         for (size_t j = 0; j < sizes[i]; ++j) {
           polymesh.polygons[i].normal_indices.push_back(
             indices[k * stride + normal_offset]
@@ -864,6 +884,7 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
     if (has_normal_array) {
       size_t k = 0;
       for (size_t i = 0; i < num_polygons; ++i) {
+        polymesh.polygons[i].texcoord_indices.reserve(sizes[i]);
         for (size_t j = 0; j < sizes[i]; ++j) {
           polymesh.polygons[i].texcoord_indices.push_back(
             indices[k * stride + texcoord_offset]
@@ -914,6 +935,7 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
           if (arr_sources.find(source) != arr_sources.end()) {
             vector<float>& floats = arr_sources[source];
             size_t num_floats = floats.size();
+            polymesh.normals.reserve(num_floats / 3);
             for (size_t i = 0; i < num_floats; i += 3) {
               Vector3D n = Vector3D(floats[i], floats[i+1], floats[i+2]);
               polymesh.normals.push_back(n);
@@ -933,6 +955,7 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
           if (arr_sources.find(source) != arr_sources.end()) {
             vector<float>& floats = arr_sources[source];
             size_t num_floats = floats.size();
+            polymesh.texcoords.reserve(num_floats / 2);
             for (size_t i = 0; i < num_floats; i += 2) {
               Vector2D n = Vector2D(floats[i], floats[i+1]);
               polymesh.texcoords.push_back(n);
@@ -957,14 +980,13 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
       XMLElement* e_vcount = e_polylist->FirstChildElement("vcount");
       if (e_vcount) {
 
-        size_t size;
-        string s = e_vcount->GetText();
-        stringstream ss (s);
-
+        sizes.resize(num_polygons);
+        const char *begin, *end;
+        if (array_text(e_vcount, array_data, array_size, &begin, &end)) {
+          parse_indices(begin, end, sizes.data(), num_polygons);
+        }
         for (size_t i = 0; i < num_polygons; ++i) {
-          ss >> size;
-          sizes.push_back(size);
-          num_indices += size * stride;
+          num_indices += sizes[i] * stride;
         }
 
       } else {
@@ -980,13 +1002,10 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
       XMLElement* e_p = e_polylist->FirstChildElement("p");
       if (e_p) {
 
-        size_t index;
-        string s = e_p->GetText();
-        stringstream ss (s);
-
-        for (size_t i = 0; i < num_indices; ++i) {
-          ss >> index;
-          indices.push_back(index);
+        indices.resize(num_indices);
+        const char *begin, *end;
+        if (array_text(e_p, array_data, array_size, &begin, &end)) {
+          parse_indices(begin, end, indices.data(), num_indices);
         }
 
       } else {
@@ -1001,6 +1020,7 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
       if (has_vertex_array) {
         size_t k = 0;
         for (size_t i = 0; i < num_polygons; ++i) {
+          polymesh.polygons[i].vertex_indices.reserve(sizes[i]);
           for (size_t j = 0; j < sizes[i]; ++j) {
             polymesh.polygons[i].vertex_indices.push_back(
               indices[k * stride + vertex_offset]
@@ -1014,6 +1034,7 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
       if (has_normal_array) {
         size_t k = 0;
         for (size_t i = 0; i < num_polygons; ++i) {
+          polymesh.polygons[i].normal_indices.reserve(sizes[i]);
           for (size_t j = 0; j < sizes[i]; ++j) {
             polymesh.polygons[i].normal_indices.push_back(
               indices[k * stride + normal_offset]
@@ -1027,6 +1048,7 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
       if (has_normal_array) {
         size_t k = 0;
         for (size_t i = 0; i < num_polygons; ++i) {
+          polymesh.polygons[i].texcoord_indices.reserve(sizes[i]);
           for (size_t j = 0; j < sizes[i]; ++j) {
             polymesh.polygons[i].texcoord_indices.push_back(
               indices[k * stride + texcoord_offset]
@@ -1038,12 +1060,48 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
     }
   }
 
+}
+
+void ColladaParser::parse_geometries() {
+
+  ProfilePhase phase("Collada geometry");
+  // geometry instanced by several nodes is parsed once
+  vector<XMLElement*> elements;
+  vector< vector<PolymeshInfo*> > targets;
+  map<XMLElement*, size_t> element_index;
+  for (size_t i = 0; i < geometries.size(); ++i) {
+    XMLElement* e_geometry = geometries[i].first;
+    if (element_index.find(e_geometry) == element_index.end()) {
+      element_index[e_geometry] = elements.size();
+      elements.push_back(e_geometry);
+      targets.push_back(vector<PolymeshInfo*>());
+    }
+    targets[element_index[e_geometry]].push_back(geometries[i].second);
+  }
+
+  // each mesh only touches its own part of the document
+  parallel_for(elements.size(), std::thread::hardware_concurrency(), [&](size_t i) {
+    parse_polymesh(elements[i], *targets[i][0]);
+  });
+
+  for (size_t i = 0; i < targets.size(); ++i) {
+    for (size_t j = 1; j < targets[i].size(); ++j) {
+      MaterialInfo* material = targets[i][j]->material;
+      *targets[i][j] = *targets[i][0];
+      targets[i][j]->material = material;
+    }
+  }
+
   // print summary
-  stat("  |- " << polymesh);
+  for (size_t i = 0; i < geometries.size(); ++i) {
+    stat("  |- " << *geometries[i].second);
+  }
+  geometries.clear();
 }
 
 void ColladaParser::parse_material ( XMLElement* xml, MaterialInfo& material ) {
 
+  ProfilePhase phase("Material/BSDF creation");
   // name & id
   material.id   = xml->Attribute( "id" );
   material.name = xml->Attribute("name");
@@ -1060,51 +1118,45 @@ void ColladaParser::parse_material ( XMLElement* xml, MaterialInfo& material ) {
     XMLElement* tech_common = get_technique_common(e_effect); // common profile
     XMLElement* tech_CGL = get_technique_CGL(e_effect); // CGL profile
 
+    MaterialParams& params = material.params;
     if (tech_CGL) {
       XMLElement *e_bsdf = tech_CGL->FirstChildElement();
       while (e_bsdf) {
         string type = e_bsdf->Name();
         if (type == "emission") {
           XMLElement *e_radiance  = get_element(e_bsdf, "radiance");
-          Vector3D radiance = spectrum_from_string(string(e_radiance->GetText()));
-          // FIXME: staff sol uses new EmissionBSDF(radiance, Vector3D(0));, whereas student code omits Vector3D(0)
-          BSDF* bsdf = new EmissionBSDF(radiance); // FIXME: Should not add emissive materials. Use light sources directly.
-          material.bsdf = bsdf;
+          params.type = MaterialParams::EMISSION; // FIXME: Should not add emissive materials. Use light sources directly.
+          params.spectrum = spectrum_from_string(string(e_radiance->GetText()));
         } else if (type == "mirror") {
           XMLElement *e_reflectance  = get_element(e_bsdf, "reflectance");
-          Vector3D reflectance = spectrum_from_string(string(e_reflectance->GetText()));
-          BSDF* bsdf = new MirrorBSDF(reflectance);
-          material.bsdf = bsdf;
+          params.type = MaterialParams::MIRROR;
+          params.spectrum = spectrum_from_string(string(e_reflectance->GetText()));
         } else if (type == "microfacet") {
-          XMLElement* e_reflectance = get_element(e_bsdf, "reflectance");
           XMLElement* e_alpha = get_element(e_bsdf, "alpha");
           XMLElement* e_eta = get_element(e_bsdf, "eta");
           XMLElement* e_k = get_element(e_bsdf, "k");
-          float alpha = atof(e_alpha->GetText());
-          Vector3D eta = spectrum_from_string(string(e_eta->GetText()));
-          Vector3D k = spectrum_from_string(string(e_k->GetText()));
-          BSDF* bsdf = new MicrofacetBSDF(eta, k, alpha);
-          material.bsdf = bsdf;
+          params.type = MaterialParams::MICROFACET;
+          params.roughness = (float) atof(e_alpha->GetText());
+          params.spectrum = spectrum_from_string(string(e_eta->GetText()));
+          params.spectrum2 = spectrum_from_string(string(e_k->GetText()));
         } else if (type == "refraction") {
           XMLElement *e_transmittance  = get_element(e_bsdf, "transmittance");
           XMLElement *e_roughness = get_element(e_bsdf, "roughness");
           XMLElement *e_ior = get_element(e_bsdf, "ior");
-          Vector3D transmittance = spectrum_from_string(string(e_transmittance->GetText()));
-          float roughness = atof(e_roughness->GetText());
-          float ior = atof(e_ior->GetText());
-          BSDF* bsdf = new RefractionBSDF(transmittance, roughness, ior);
-          material.bsdf = bsdf;
+          params.type = MaterialParams::REFRACTION;
+          params.spectrum = spectrum_from_string(string(e_transmittance->GetText()));
+          params.roughness = (float) atof(e_roughness->GetText());
+          params.ior = (float) atof(e_ior->GetText());
         } else if (type == "glass") {
           XMLElement *e_transmittance  = get_element(e_bsdf, "transmittance");
           XMLElement *e_reflectance  = get_element(e_bsdf, "reflectance");
           XMLElement *e_roughness = get_element(e_bsdf, "roughness");
           XMLElement *e_ior = get_element(e_bsdf, "ior");
-          Vector3D transmittance = spectrum_from_string(string(e_transmittance->GetText()));
-          Vector3D reflectance = spectrum_from_string(string(e_reflectance->GetText()));
-          float roughness = atof(e_roughness->GetText());
-          float ior = atof(e_ior->GetText());
-          BSDF* bsdf = new GlassBSDF(transmittance, reflectance, roughness, ior);
-          material.bsdf = bsdf;
+          params.type = MaterialParams::GLASS;
+          params.spectrum = spectrum_from_string(string(e_transmittance->GetText()));
+          params.spectrum2 = spectrum_from_string(string(e_reflectance->GetText()));
+          params.roughness = (float) atof(e_roughness->GetText());
+          params.ior = (float) atof(e_ior->GetText());
         }
         e_bsdf = e_bsdf->NextSiblingElement();
       }
@@ -1112,19 +1164,12 @@ void ColladaParser::parse_material ( XMLElement* xml, MaterialInfo& material ) {
       XMLElement* e_diffuse = get_element(tech_common, "phong/diffuse/color");
       XMLElement* e_lambert_diffuse = get_element(tech_common, "lambert/diffuse/color");
       if (e_diffuse) {
-        Vector3D reflectance = spectrum_from_string(string(e_diffuse->GetText()));
-        material.bsdf = new DiffuseBSDF(reflectance);
+        params.spectrum = spectrum_from_string(string(e_diffuse->GetText()));
       } else if (e_lambert_diffuse) {
-        Vector3D reflectance = spectrum_from_string(string(e_lambert_diffuse->GetText()));
-        material.bsdf = new DiffuseBSDF(reflectance);
-      }
-      else {
-        material.bsdf = new DiffuseBSDF(Vector3D(.5f,.5f,.5f));
+        params.spectrum = spectrum_from_string(string(e_lambert_diffuse->GetText()));
       }
-    } else {
-      BSDF* bsdf = new DiffuseBSDF(Vector3D(.5f,.5f,.5f));
-      material.bsdf = bsdf;
     }
+    material.bsdf = create_bsdf(params);
   } else {
     stat("Error: no target effects found for material: " << material.id);
     exit(EXIT_FAILURE);
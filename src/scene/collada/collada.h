@@ -3,6 +3,8 @@
 
 #include <map>
 #include <string>
+#include <vector>
+#include <utility>
 
 #include "CGL/CGL.h"
 #include "CGL/tinyexr.h"
@@ -45,6 +47,14 @@ class ColladaParser {
 	// The lookup table is constructed when the file is loaded
 	static std::map<std::string, XMLElement*> sources;
 
+	// Text of the number arrays, which load leaves out of the document and
+	// reads from the mapped file instead (NULL if it is in the document)
+	static const char* array_data;
+	static size_t array_size;
+
+	// Mesh geometry found while walking the scene, parsed afterwards
+	static std::vector<std::pair<XMLElement*, PolymeshInfo*> > geometries;
+
  	// Load Collada elements with UUID into lookup table
  	static void uri_load( XMLElement* xml );
 
@@ -72,6 +82,7 @@ class ColladaParser {
   static void parse_light		 ( XMLElement* xml, LightInfo& 		light		 );
 	static void parse_sphere	 ( XMLElement* xml, SphereInfo& 	sphere	 );
   static void parse_polymesh ( XMLElement* xml, PolymeshInfo& polymesh );
+  static void parse_geometries();
 	static void parse_material ( XMLElement* xml, MaterialInfo&	material );
 
 }; // class ColladaParser
@@ -0,0 +1,225 @@
+#include "collada_stream.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+using namespace std;
+using namespace tinyxml2;
+
+namespace CGL { namespace Collada {
+
+// Streaming Helpers //
+
+static const char* find(const char* p, const char* end, const char* s) {
+  size_t n = strlen(s);
+  while (p + n <= end) {
+    p = (const char*) memchr(p, s[0], end - p);
+    if (!p || p + n > end) return NULL;
+    if (memcmp(p, s, n) == 0) return p;
+    ++p;
+  }
+  return NULL;
+}
+
+static bool is_name_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.' || c == ':';
+}
+
+static bool is_array_element(const char* name, size_t length) {
+  return (length == 11 && memcmp(name, "float_array", 11) == 0) ||
+         (length == 1 && name[0] == 'p') ||
+         (length == 6 && memcmp(name, "vcount", 6) == 0);
+}
+
+string strip_array_text(const char* data, size_t size) {
+  string out;
+  const char* end = data + size;
+  const char* copied = data;  // everything before this is in out
+  const char* p = data;
+
+  while ((p = (const char*) memchr(p, '<', end - p))) {
+
+    // skip end tags, comments, CDATA, declarations and instructions
+    if (end - p < 2) break;
+    if (p[1] == '/' || p[1] == '!' || p[1] == '?') {
+      const char* skip_to;
+      if (end - p >= 4 && memcmp(p, "<!--", 4) == 0) {
+        skip_to = find(p + 4, end, "-->");
+      } else if (end - p >= 9 && memcmp(p, "<![CDATA[", 9) == 0) {
+        skip_to = find(p + 9, end, "]]>");
+      } else {
+        skip_to = (const char*) memchr(p, '>', end - p);
+      }
+      if (!skip_to) break;
+      p = skip_to + 1;
+      continue;
+    }
+
+    // start tag: name, then attributes up to the closing '>'
+    const char* name = p + 1;
+    const char* q = name;
+    while (q < end && is_name_char(*q)) ++q;
+    size_t name_length = q - name;
+    char quote = 0;
+    while (q < end && (quote || *q != '>')) {
+      if (quote) {
+        if (*q == quote) quote = 0;
+      } else if (*q == '"' || *q == '\'') {
+        quote = *q;
+      }
+      ++q;
+    }
+    if (q == end) break;
+    const char* tag_end = q;
+    p = tag_end + 1;
+    if (tag_end[-1] == '/' || !is_array_element(name, name_length)) continue;
+
+    // the text runs up to the end tag; number arrays hold no markup
+    const char* text_end = find(p, end, "</");
+    if (!text_end) break;
+
+    char range[64];
+    snprintf(range, sizeof(range), " cgl_text=\"%llu %llu\"",
+             (unsigned long long) (p - data), (unsigned long long) (text_end - p));
+    out.append(copied, tag_end);
+    out.append(range);
+    out.append(">");
+    copied = text_end;
+    p = text_end;
+  }
+
+  out.append(copied, end);
+  return out;
+}
+
+bool array_text(const XMLElement* xml, const char* data, size_t size,
+                const char** begin, const char** end) {
+  const char* range = xml->Attribute("cgl_text");
+  if (range && data) {
+    char* rest;
+    unsigned long long offset = strtoull(range, &rest, 10);
+    unsigned long long length = strtoull(rest, NULL, 10);
+    if (offset > size || length > size - offset) return false;
+    *begin = data + offset;
+    *end = *begin + length;
+    return true;
+  }
+
+  const char* text = xml->GetText();
+  if (!text) return false;
+  *begin = text;
+  *end = text + strlen(text);
+  return true;
+}
+
+// Number Parsing //
+
+static inline bool is_space(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static inline bool is_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+/*
+  Parse the number at p. Numbers of up to 7 significant digits and with
+  decimal exponents of up to 10 convert exactly: the digits and the power
+  of ten are exact floats, so one correctly rounded multiply or divide
+  gives the same float strtof would. Everything else goes to strtof.
+*/
+static float parse_float(const char* p, const char* end, const char** next) {
+  static const float powers[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+                                  1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+  const char* start = p;
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+  uint32_t mantissa = 0;
+  int significant = 0, exponent = 0;
+  bool has_digits = false;
+  for (; p < end && is_digit(*p); ++p) {
+    has_digits = true;
+    if (mantissa || *p != '0') significant++;
+    if (significant <= 7) mantissa = mantissa * 10 + (*p - '0');
+    else exponent++;
+  }
+  if (p < end && *p == '.') {
+    for (++p; p < end && is_digit(*p); ++p) {
+      has_digits = true;
+      if (mantissa || *p != '0') significant++;
+      if (significant <= 7) {
+        mantissa = mantissa * 10 + (*p - '0');
+        exponent--;
+      }
+    }
+  }
+  if (has_digits && p < end && (*p == 'e' || *p == 'E')) {
+    const char* q = p + 1;
+    bool exp_negative = false;
+    if (q < end && (*q == '-' || *q == '+')) exp_negative = *q++ == '-';
+    if (q < end && is_digit(*q)) {
+      int e = 0;
+      for (; q < end && is_digit(*q); ++q) {
+        if (e < 10000) e = e * 10 + (*q - '0');
+      }
+      exponent += exp_negative ? -e : e;
+      p = q;
+    }
+  }
+
+  bool fast = has_digits && significant <= 7 && exponent >= -10 && exponent <= 10 &&
+              (p == end || is_space(*p) || *p == '<');
+  if (fast) {
+    *next = p;
+    float f = (float) mantissa;
+    f = exponent < 0 ? f / powers[-exponent] : f * powers[exponent];
+    return negative ? -f : f;
+  }
+
+  // strtof needs the token terminated
+  char token[64];
+  size_t length = 0;
+  for (p = start; p < end && !is_space(*p) && *p != '<' && length < sizeof(token) - 1; ++p) {
+    token[length++] = *p;
+  }
+  token[length] = 0;
+  char* token_end;
+  float f = strtof(token, &token_end);
+  *next = start + (token_end - token);
+  return f;
+}
+
+size_t parse_floats(const char* begin, const char* end, float* out, size_t count) {
+  const char* p = begin;
+  size_t n = 0;
+  while (n < count) {
+    while (p < end && is_space(*p)) ++p;
+    if (p == end) break;
+    const char* next;
+    float f = parse_float(p, end, &next);
+    if (next == p) break;
+    out[n++] = f;
+    p = next;
+  }
+  return n;
+}
+
+size_t parse_indices(const char* begin, const char* end, size_t* out, size_t count) {
+  const char* p = begin;
+  size_t n = 0;
+  while (n < count) {
+    while (p < end && is_space(*p)) ++p;
+    if (p == end || !is_digit(*p)) break;
+    size_t index = 0;
+    for (; p < end && is_digit(*p); ++p) index = index * 10 + (*p - '0');
+    out[n++] = index;
+  }
+  return n;
+}
+
+} // namespace Collada
+} // namespace CGL
@@ -0,0 +1,43 @@
+#ifndef CGL_COLLADA_COLLADASTREAM_H
+#define CGL_COLLADA_COLLADASTREAM_H
+
+#include <string>
+
+#include "CGL/tinyxml2.h"
+
+namespace CGL { namespace Collada {
+
+/*
+  Large Collada files are nearly all number arrays: the text of
+  <float_array>, <p> and <vcount> elements. Rather than having tinyxml2
+  copy that text into its DOM, a streaming pass over the mapped file
+  copies the rest of the document and leaves these elements empty, with
+  a cgl_text="<offset> <length>" attribute pointing at their text in the
+  file. The arrays are then parsed straight from the file.
+*/
+
+/*
+  Copy of the document without the text of its number arrays.
+*/
+std::string strip_array_text(const char* data, size_t size);
+
+/*
+  The text of a number array element: its range in the file (data, size)
+  if strip_array_text elided it, else its own text. Returns false if it
+  has none.
+*/
+bool array_text(const tinyxml2::XMLElement* xml, const char* data, size_t size,
+                const char** begin, const char** end);
+
+/*
+  Parse up to count whitespace separated numbers from [begin, end) into
+  out, stopping at anything that is not a number. Floats are rounded as
+  strtof rounds them. Returns the number parsed.
+*/
+size_t parse_floats(const char* begin, const char* end, float* out, size_t count);
+size_t parse_indices(const char* begin, const char* end, size_t* out, size_t count);
+
+} // namespace Collada
+} // namespace CGL
+
+#endif // CGL_COLLADA_COLLADASTREAM_H
@@ -1,9 +1,30 @@
 #include "material_info.h"
 
+#include "pathtracer/bsdf.h"
+
 using namespace std;
 
 namespace CGL { namespace Collada {
 
+BSDF* create_bsdf(const MaterialParams& params) {
+  switch (params.type) {
+    case MaterialParams::EMISSION:
+      // FIXME: staff sol uses new EmissionBSDF(radiance, Vector3D(0));, whereas student code omits Vector3D(0)
+      return new EmissionBSDF(params.spectrum);
+    case MaterialParams::MIRROR:
+      return new MirrorBSDF(params.spectrum);
+    case MaterialParams::MICROFACET:
+      return new MicrofacetBSDF(params.spectrum, params.spectrum2, params.roughness);
+    case MaterialParams::REFRACTION:
+      return new RefractionBSDF(params.spectrum, params.roughness, params.ior);
+    case MaterialParams::GLASS:
+      return new GlassBSDF(params.spectrum, params.spectrum2, params.roughness, params.ior);
+    case MaterialParams::DIFFUSE:
+    default:
+      return new DiffuseBSDF(params.spectrum);
+  }
+}
+
 std::ostream& operator<<(std::ostream& os, const MaterialInfo& material) {
 
   os << "MaterialInfo: " << material.name << " (id:" << material.id << ")";
@@ -2,6 +2,7 @@
 #define CGL_COLLADA_MATERIALINFO_H
 
 #include "CGL/color.h"
+#include "CGL/vector3D.h"
 #include "collada_info.h"
 
 namespace CGL {
@@ -10,8 +11,39 @@ class BSDF;
 
 namespace Collada {
 
+/**
+ * The BSDF of a material as given in the scene file, enough to create it
+ * again (see create_bsdf). Plain data, so it can be cached.
+ */
+struct MaterialParams {
+
+  enum Type {
+    DIFFUSE,     ///< spectrum = reflectance
+    EMISSION,    ///< spectrum = radiance
+    MIRROR,      ///< spectrum = reflectance
+    MICROFACET,  ///< spectrum = eta, spectrum2 = k, roughness = alpha
+    REFRACTION,  ///< spectrum = transmittance, roughness, ior
+    GLASS        ///< spectrum = transmittance, spectrum2 = reflectance, roughness, ior
+  };
+
+  MaterialParams() : type(DIFFUSE), spectrum(.5f, .5f, .5f), roughness(0), ior(1) { }
+
+  Type type;
+  Vector3D spectrum;
+  Vector3D spectrum2;
+  double roughness;
+  double ior;
+
+}; // struct MaterialParams
+
+/**
+ * Create the BSDF described by params.
+ */
+BSDF* create_bsdf(const MaterialParams& params);
+
 struct MaterialInfo : public Instance {
 
+  MaterialParams params;  ///< what bsdf was created from
   BSDF* bsdf;
   
   // Texture* tex; ///< texture
@@ -1,10 +1,81 @@
 #include "environment_light.h"
 #include "util/lodepng.h"
+#include "util/parallel_for.h"
+#include "util/startup_profiler.h"
+
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
 
 namespace CGL { namespace SceneObjects {
 
-  EnvironmentLight::EnvironmentLight(const HDRImageBuffer* envMap)
-    : envMap(envMap) {
+  static const char ALIAS_CACHE_MAGIC[8] = { 'C', 'G', 'L', 'E', 'N', 'V', 'A', 'T' };
+  static const uint32_t ALIAS_CACHE_VERSION = 2;
+
+  static void fnv1a(const void* data, size_t n, uint64_t* hv) {
+    const unsigned char* bytes = (const unsigned char*) data;
+    for (size_t i = 0; i < n; ++i) {
+      *hv ^= bytes[i];
+      *hv *= 1099511628211ULL;
+    }
+  }
+
+  // Key of the alias cache: the file's size and modification time, and a
+  // 64-bit FNV-1a hash of its first and last 64 KB (the header and offset
+  // table, the end of the pixels) and of 4 KB at 16 points in between.
+  // Hashing all of an 8K float map took about as long as building the
+  // tables; this reads the same few hundred KB for any size.
+  static bool fingerprint_file(const std::string& path, uint64_t* hash) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return false;
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+
+    uint64_t size = (uint64_t) st.st_size;
+    int64_t mtime = (int64_t) st.st_mtime;
+    uint64_t hv = 14695981039346656037ULL;
+    fnv1a(&size, sizeof(size), &hv);
+    fnv1a(&mtime, sizeof(mtime), &hv);
+
+    const uint64_t end_bytes = 1 << 16, sample_bytes = 1 << 12;
+    const int num_samples = 16;
+    std::vector<unsigned char> buf(end_bytes);
+    bool ok = true;
+    for (int i = 0; ok && i < num_samples + 2; ++i) {
+      uint64_t offset, n;
+      if (i == 0) {
+        offset = 0;
+        n = end_bytes;
+      } else if (i == num_samples + 1) {
+        offset = size > end_bytes ? size - end_bytes : 0;
+        n = end_bytes;
+      } else {
+        offset = size / (num_samples + 1) * i;
+        n = sample_bytes;
+      }
+      n = std::min(n, size - std::min(offset, size));
+      ok = fseek(file, (long) offset, SEEK_SET) == 0 &&
+           fread(&buf[0], 1, n, file) == n;
+      fnv1a(&buf[0], n, &hv);
+    }
+    fclose(file);
+
+    *hash = hv;
+    return ok;
+  }
+
+  EnvironmentLight::EnvironmentLight(const EnvironmentMap* envMap,
+                                     const std::string& envmap_path)
+    : envMap(envMap), envmap_path(envmap_path), alias_total(0) {
     init();
   }
 
@@ -16,6 +87,7 @@ namespace CGL { namespace SceneObjects {
 
 
   void EnvironmentLight::init() {
+    ProfilePhase phase("Environment light init");
     uint32_t w = envMap->w, h = envMap->h;
     pdf_envmap = new double[w * h];
     conds_y = new double[w * h];
@@ -31,7 +103,7 @@ namespace CGL { namespace SceneObjects {
     double sum = 0;
     for (int j = 0; j < h; ++j) {
       for (int i = 0; i < w; ++i) {
-        pdf_envmap[w * j + i] = envMap->data[w * j + i].illum() * sin(PI * (j + .5) / h);
+        pdf_envmap[w * j + i] = envMap->weights[w * j + i];
         sum += pdf_envmap[w * j + i];
       }
     }
@@ -41,6 +113,15 @@ namespace CGL { namespace SceneObjects {
 
 
 
+    // Alias tables for importance sampling, reused from the sidecar cache
+    // when the environment map file has not changed.
+    uint64_t file_hash = 0;
+    bool hashed = !envmap_path.empty() && fingerprint_file(envmap_path, &file_hash);
+    if (!hashed || !load_alias_tables(file_hash)) {
+      build_alias_tables();
+      if (hashed) save_alias_tables(file_hash);
+    }
+
     if (true)
       std::cout << "Saving out probability_debug image for debug." << std::endl;
     save_probability_debug();
@@ -48,6 +129,103 @@ namespace CGL { namespace SceneObjects {
     std::cout << "done." << std::endl;
   }
 
+  // Alias tables
+
+  double EnvironmentLight::alias_weight(size_t x, size_t y) const {
+    return envMap->weights[envMap->w * y + x];
+  }
+
+  void EnvironmentLight::build_alias_tables() {
+    size_t w = envMap->w, h = envMap->h;
+    conds_alias.resize(h);
+    std::vector<double> row_sums(h);
+
+    // rows are independent; the weights were computed when the map was
+    // loaded
+    parallel_for(h, std::thread::hardware_concurrency(), [&](size_t y) {
+      row_sums[y] = conds_alias[y].build(&envMap->weights[w * y], w);
+    });
+
+    alias_total = marginal_alias.build(&row_sums[0], h);
+  }
+
+  bool EnvironmentLight::load_alias_tables(uint64_t file_hash) {
+    std::string cache_path = envmap_path + ".alias";
+    FILE* file = fopen(cache_path.c_str(), "rb");
+    if (!file) return false;
+
+    char magic[8];
+    uint32_t version, w, h;
+    uint64_t hash;
+    double total;
+    bool ok = fread(magic, sizeof(magic), 1, file) == 1 &&
+              fread(&version, sizeof(version), 1, file) == 1 &&
+              fread(&hash, sizeof(hash), 1, file) == 1 &&
+              fread(&w, sizeof(w), 1, file) == 1 &&
+              fread(&h, sizeof(h), 1, file) == 1 &&
+              fread(&total, sizeof(total), 1, file) == 1 &&
+              memcmp(magic, ALIAS_CACHE_MAGIC, sizeof(magic)) == 0 &&
+              version == ALIAS_CACHE_VERSION && hash == file_hash &&
+              w == envMap->w && h == envMap->h;
+
+    // a damaged file must not make sample_L index outside the map
+    if (ok) {
+      marginal_alias.entries.resize(h);
+      ok = fread(&marginal_alias.entries[0], sizeof(AliasTable::Entry), h, file) == h &&
+           marginal_alias.is_valid() && total >= 0;
+      conds_alias.resize(h);
+      for (uint32_t y = 0; ok && y < h; ++y) {
+        conds_alias[y].entries.resize(w);
+        ok = fread(&conds_alias[y].entries[0], sizeof(AliasTable::Entry), w, file) == w &&
+             conds_alias[y].is_valid();
+      }
+    }
+    fclose(file);
+
+    if (!ok) {
+      marginal_alias.entries.clear();
+      conds_alias.clear();
+      return false;
+    }
+
+    alias_total = total;
+    std::cout << "loaded alias tables from " << cache_path << "...";
+    return true;
+  }
+
+  void EnvironmentLight::save_alias_tables(uint64_t file_hash) const {
+    std::string cache_path = envmap_path + ".alias";
+
+    // render workers load the same map, and may all be writing its tables
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%d.tmp", (int) getpid());
+    std::string tmp_path = cache_path + suffix;
+    FILE* file = fopen(tmp_path.c_str(), "wb");
+    if (!file) return;
+
+    uint32_t w = envMap->w, h = envMap->h;
+    fwrite(ALIAS_CACHE_MAGIC, sizeof(ALIAS_CACHE_MAGIC), 1, file);
+    fwrite(&ALIAS_CACHE_VERSION, sizeof(ALIAS_CACHE_VERSION), 1, file);
+    fwrite(&file_hash, sizeof(file_hash), 1, file);
+    fwrite(&w, sizeof(w), 1, file);
+    fwrite(&h, sizeof(h), 1, file);
+    fwrite(&alias_total, sizeof(alias_total), 1, file);
+    fwrite(&marginal_alias.entries[0], sizeof(AliasTable::Entry), h, file);
+    for (uint32_t y = 0; y < h; ++y) {
+      fwrite(&conds_alias[y].entries[0], sizeof(AliasTable::Entry), w, file);
+    }
+    bool ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+
+#ifdef _WIN32
+    // rename does not replace existing files here
+    if (ok) remove(cache_path.c_str());
+#endif
+    if (!ok || rename(tmp_path.c_str(), cache_path.c_str()) != 0) {
+      remove(tmp_path.c_str());
+    }
+  }
+
   // Helper functions
 
   void EnvironmentLight::save_probability_debug() {
@@ -117,8 +295,8 @@ namespace CGL { namespace SceneObjects {
     else v1 = v - xy.y + .5;
     auto bottom = envMap->w * v, top = bottom - envMap->w;
     auto u0 = 1 - u1;
-    return (envMap->data[top + left] * u1 + envMap->data[top + right] * u0) * v1 +
-      (envMap->data[bottom + left] * u1 + envMap->data[bottom + right] * u0) * (1 - v1);
+    return (envMap->pixel(top + left) * u1 + envMap->pixel(top + right) * u0) * v1 +
+      (envMap->pixel(bottom + left) * u1 + envMap->pixel(bottom + right) * u0) * (1 - v1);
   }
 
 
@@ -129,6 +307,23 @@ namespace CGL { namespace SceneObjects {
     // First implement uniform sphere sampling for the environment light
     // Later implement full importance sampling
 
+    // Importance sampling through the alias tables: pick a row, then a
+    // pixel within it, then a point within the pixel.
+    if (alias_total > 0) {
+      uint32_t w = envMap->w, h = envMap->h;
+      size_t y = marginal_alias.sample(random_uniform());
+      size_t x = conds_alias[y].sample(random_uniform());
+      Vector2D xy(x + random_uniform(), y + random_uniform());
+      Vector2D theta_phi = xy_to_theta_phi(xy);
+      double sin_theta = sin(theta_phi.x);
+
+      *wi = theta_phi_to_dir(theta_phi);
+      *distToLight = INF_D;
+      *pdf = sin_theta <= 0 ? 0 : alias_weight(x, y) / alias_total * w * h /
+                                  (2 * PI * PI * sin_theta);
+      return bilerp(xy);
+    }
+
     // Uniform
     *wi = sampler_uniform_sphere.get_sample();
     *distToLight = INF_D;
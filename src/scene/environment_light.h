@@ -3,8 +3,12 @@
 
 #include "pathtracer/sampler.h"
 #include "util/image.h"
+#include "util/alias_table.h"
 #include "scene.h"
 
+#include <string>
+#include <vector>
+
 namespace CGL { namespace SceneObjects {
 
 // An environment light can be thought of as an infinitely big sphere centered
@@ -14,7 +18,14 @@ namespace CGL { namespace SceneObjects {
 // model in the scene.
 class EnvironmentLight : public SceneLight {
 public:
-  EnvironmentLight(const HDRImageBuffer* envMap);
+  /**
+   * If envmap_path is given, the importance sampling tables are cached in a
+   * sidecar file next to it (envmap_path + ".alias") and reused on later
+   * launches while the environment map file keeps its size, modification
+   * time and the contents of the blocks sampled to key the cache.
+   */
+  EnvironmentLight(const EnvironmentMap* envMap,
+                   const std::string& envmap_path = "");
   ~EnvironmentLight();
   /**
     * In addition to the work done by sample_dir, this function also has to
@@ -44,13 +55,26 @@ public:
   Vector3D sample_dir(const Ray& r) const;
 
 private:
-  const HDRImageBuffer* envMap;
+  const EnvironmentMap* envMap;
   UniformGridSampler2D sampler_uniform2d;
   UniformSphereSampler3D sampler_uniform_sphere;
 
   void init();
   double* pdf_envmap, * marginal_y, * conds_y;
 
+  // Alias tables for O(1) importance sampling: a marginal table over rows
+  // and one conditional table per row. Sampling pdfs are evaluated from the
+  // pixel weights directly, pdf(x, y) = alias_weight(x, y) / alias_total.
+  std::string envmap_path;
+  AliasTable marginal_alias;
+  std::vector<AliasTable> conds_alias;
+  double alias_total;
+
+  double alias_weight(size_t x, size_t y) const;
+  void build_alias_tables();
+  bool load_alias_tables(uint64_t file_hash);
+  void save_alias_tables(uint64_t file_hash) const;
+
   Vector2D dir_to_theta_phi(const Vector3D dir) const;
   Vector3D theta_phi_to_dir(const Vector2D& theta_phi) const;
 
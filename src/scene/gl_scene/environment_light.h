@@ -12,7 +12,7 @@ namespace CGL { namespace GLScene {
 class EnvironmentLight : public SceneLight {
  public:
 
-  EnvironmentLight(HDRImageBuffer* envmap) : envmap(envmap) { }
+  EnvironmentLight(EnvironmentMap* envmap) : envmap(envmap) { }
 
   SceneObjects::SceneLight *get_static_light() const {
     SceneObjects::EnvironmentLight* l = 
@@ -23,14 +23,14 @@ class EnvironmentLight : public SceneLight {
   void render_debugger_node() {
     if (ImGui::TreeNode(this, "Environment Light 0x%x", this))
     {
-      ImGui::Text("HDRI Image Buffer (%dx%d): 0x%x", envmap->w, envmap->h, envmap);
+      ImGui::Text("Environment Map (%dx%d): 0x%x", envmap->w, envmap->h, envmap);
       ImGui::TreePop();
     }
   }
 
  private:
 
-  HDRImageBuffer* envmap;
+  EnvironmentMap* envmap;
 
 };
 
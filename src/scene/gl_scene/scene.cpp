@@ -4,6 +4,8 @@ using std::cout;
 using std::endl;
 
 #include "application/visual_debugger.h"
+#include "scene/light.h"
+#include "util/startup_profiler.h"
 
 namespace CGL { namespace GLScene {
 
@@ -156,6 +158,7 @@ void Scene::resample_selected_mesh() {
 }
 
 SceneObjects::Scene *Scene::get_static_scene() {
+  ProfilePhase phase("Static scene conversion");
   std::vector<SceneObjects::SceneObject *> staticObjects;
   std::vector<SceneObjects::SceneLight *> staticLights;
 
@@ -166,6 +169,12 @@ SceneObjects::Scene *Scene::get_static_scene() {
     staticLights.push_back(light->get_static_light());
   }
 
+  // emissive objects are sampled as lights too
+  std::vector<SceneObjects::SceneLight *> emissiveLights =
+      SceneObjects::create_emissive_lights(staticObjects, staticLights);
+  staticLights.insert(staticLights.end(), emissiveLights.begin(),
+                      emissiveLights.end());
+
   return new SceneObjects::Scene(staticObjects, staticLights);
 }
 
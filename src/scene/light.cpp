@@ -3,6 +3,7 @@
 #include <iostream>
 
 #include "pathtracer/sampler.h"
+#include "pathtracer/bsdf.h"
 
 namespace CGL { namespace SceneObjects {
 
@@ -56,6 +57,13 @@ Vector3D PointLight::sample_L(const Vector3D p, Vector3D* wi,
   return radiance;
 }
 
+bool PointLight::get_light_bounds(LightBounds* bounds) const {
+  // emits uniformly in all directions
+  *bounds = LightBounds(BBox(position), Vector3D(0, 0, 1),
+                        4 * PI * radiance.illum(), cos(PI), cos(PI / 2), false);
+  return true;
+}
+
 
 // Spot Light //
 
@@ -92,28 +100,228 @@ Vector3D AreaLight::sample_L(const Vector3D p, Vector3D* wi,
   return cosTheta < 0 ? radiance : Vector3D();
 };
 
+bool AreaLight::get_light_bounds(LightBounds* bounds) const {
+  BBox bb;
+  bb.expand(position + 0.5 * dim_x + 0.5 * dim_y);
+  bb.expand(position + 0.5 * dim_x - 0.5 * dim_y);
+  bb.expand(position - 0.5 * dim_x + 0.5 * dim_y);
+  bb.expand(position - 0.5 * dim_x - 0.5 * dim_y);
+
+  // one-sided diffuse emitter facing along direction
+  *bounds = LightBounds(bb, direction.unit(), PI * area * radiance.illum(),
+                        cos(0.0), cos(PI / 2), false);
+  return true;
+}
 
-// Sphere Light //
 
-SphereLight::SphereLight(const Vector3D rad, const SphereObject* sphere) {
+// Sphere Light //
 
-}
+SphereLight::SphereLight(const Vector3D rad, const SphereObject* sphere)
+  : sphere(sphere), radiance(rad) { }
 
 Vector3D SphereLight::sample_L(const Vector3D p, Vector3D* wi, 
                                double* distToLight, double* pdf) const {
 
-  return Vector3D();
+  Vector3D d = sphere->o - p;
+  double dist2 = d.norm2();
+  double r2 = sphere->r * sphere->r;
+  if (dist2 <= r2) {
+    *pdf = 0;
+    return Vector3D();
+  }
+
+  // sample the cone of directions subtended by the sphere uniformly
+  double dist = sqrt(dist2);
+  double cos_theta_max = sqrt(std::max(0.0, 1 - r2 / dist2));
+  double cos_theta = 1 - random_uniform() * (1 - cos_theta_max);
+  double sin_theta = sqrt(std::max(0.0, 1 - cos_theta * cos_theta));
+  double phi = 2.0 * PI * random_uniform();
+
+  Matrix3x3 o2w;
+  make_coord_space(o2w, d / dist);
+  *wi = o2w * Vector3D(cos(phi) * sin_theta, sin(phi) * sin_theta, cos_theta);
+
+  // distance to the near intersection with the sphere along wi
+  double b = dist * cos_theta;
+  *distToLight = b - sqrt(std::max(0.0, r2 - dist2 + b * b));
+  *pdf = 1.0 / (2.0 * PI * (1 - cos_theta_max));
+  return radiance;
 }
 
-// Mesh Light
+bool SphereLight::get_light_bounds(LightBounds* bounds) const {
+  Vector3D r(sphere->r, sphere->r, sphere->r);
+  double area = 4 * PI * sphere->r * sphere->r;
+  *bounds = LightBounds(BBox(sphere->o - r, sphere->o + r), Vector3D(0, 0, 1),
+                        PI * area * radiance.illum(), cos(PI), cos(PI / 2),
+                        false);
+  return true;
+}
 
-MeshLight::MeshLight(const Vector3D rad, const Mesh* mesh) {
+// Mesh Light
 
+MeshLight::MeshLight(const Vector3D rad, const Mesh* mesh)
+  : mesh(mesh), radiance(rad), area(0), total_weight(0) {
+
+  const size_t* indices = mesh->get_indices();
+  size_t num_triangles = mesh->num_indices() / 3;
+
+  // radiance is uniform over the mesh, so power is proportional to area
+  areas.resize(num_triangles);
+  vector<double> weights(num_triangles);
+  for (size_t i = 0; i < num_triangles; ++i) {
+    const Vector3D& p1 = mesh->positions[indices[3 * i]];
+    const Vector3D& p2 = mesh->positions[indices[3 * i + 1]];
+    const Vector3D& p3 = mesh->positions[indices[3 * i + 2]];
+    areas[i] = 0.5 * cross(p2 - p1, p3 - p1).norm();
+    weights[i] = areas[i] * radiance.illum();
+    area += areas[i];
+  }
+
+  if (num_triangles > 0)
+    total_weight = triangles.build(&weights[0], num_triangles);
 }
 
 Vector3D MeshLight::sample_L(const Vector3D p, Vector3D* wi, 
                              double* distToLight, double* pdf) const {
-  return Vector3D();
+
+  if (total_weight <= 0) {
+    *pdf = 0;
+    return Vector3D();
+  }
+
+  size_t i = triangles.sample(random_uniform());
+  const size_t* indices = mesh->get_indices();
+  const Vector3D& p1 = mesh->positions[indices[3 * i]];
+  const Vector3D& p2 = mesh->positions[indices[3 * i + 1]];
+  const Vector3D& p3 = mesh->positions[indices[3 * i + 2]];
+
+  // uniform point on the triangle
+  double su = sqrt(random_uniform());
+  double v = random_uniform();
+  Vector3D q = p1 * (1 - su) + p2 * (su * (1 - v)) + p3 * (su * v);
+  Vector3D n = cross(p2 - p1, p3 - p1).unit();
+
+  Vector3D d = q - p;
+  double sqDist = d.norm2();
+  double dist = sqrt(sqDist);
+  double cosTheta = fabs(dot(n, d)) / dist;
+  if (dist <= 0 || cosTheta <= 0) {
+    *pdf = 0;
+    return Vector3D();
+  }
+
+  // area pdf of the point is pmf(triangle) / area(triangle), converted to
+  // solid angle at p
+  double pmf = areas[i] * radiance.illum() / total_weight;
+  *wi = d / dist;
+  *distToLight = dist;
+  *pdf = pmf / areas[i] * sqDist / cosTheta;
+  return radiance;
+}
+
+bool MeshLight::get_light_bounds(LightBounds* bounds) const {
+  const size_t* indices = mesh->get_indices();
+  size_t num_triangles = mesh->num_indices() / 3;
+  if (num_triangles == 0) return false;
+
+  // bound the positions, and the normals with a cone around their
+  // area-weighted average
+  BBox bb;
+  Vector3D axis;
+  for (size_t i = 0; i < mesh->num_indices(); ++i)
+    bb.expand(mesh->positions[indices[i]]);
+  for (size_t i = 0; i < num_triangles; ++i) {
+    const Vector3D& p1 = mesh->positions[indices[3 * i]];
+    axis += cross(mesh->positions[indices[3 * i + 1]] - p1,
+                  mesh->positions[indices[3 * i + 2]] - p1);
+  }
+
+  double cos_theta_o = -1;
+  if (axis.norm2() > 0) {
+    axis.normalize();
+    cos_theta_o = 1;
+    for (size_t i = 0; i < num_triangles; ++i) {
+      const Vector3D& p1 = mesh->positions[indices[3 * i]];
+      Vector3D n = cross(mesh->positions[indices[3 * i + 1]] - p1,
+                         mesh->positions[indices[3 * i + 2]] - p1);
+      if (n.norm2() > 0)
+        cos_theta_o = std::min(cos_theta_o, dot(axis, n.unit()));
+    }
+  } else {
+    axis = Vector3D(0, 0, 1);
+  }
+
+  *bounds = LightBounds(bb, axis, 2 * PI * area * radiance.illum(),
+                        cos_theta_o, cos(PI / 2), true);
+  return true;
+}
+
+// Emissive geometry
+
+/**
+ * Whether the mesh is the panel of area light: every vertex of its
+ * triangles lies in the plane of the light's quad, and the triangles have
+ * the quad's area and its center as their centroid. The orientation within
+ * the plane is not compared; the Cornell box scenes give the light's edges
+ * turned by 90 degrees from the panel's.
+ */
+static bool is_panel_of(const Mesh* mesh, const AreaLight* light) {
+  const size_t* indices = mesh->get_indices();
+  size_t num_triangles = mesh->num_indices() / 3;
+  if (num_triangles == 0) return false;
+
+  Vector3D n = cross(light->dim_x, light->dim_y);
+  double quad_area = n.norm();
+  if (quad_area <= 0) return false;
+  n /= quad_area;
+  double eps = 1e-3 * (light->dim_x.norm() + light->dim_y.norm());
+
+  double area = 0;
+  Vector3D centroid;
+  for (size_t i = 0; i < num_triangles; ++i) {
+    const Vector3D& p1 = mesh->positions[indices[3 * i]];
+    const Vector3D& p2 = mesh->positions[indices[3 * i + 1]];
+    const Vector3D& p3 = mesh->positions[indices[3 * i + 2]];
+    if (fabs(dot(p1 - light->position, n)) > eps ||
+        fabs(dot(p2 - light->position, n)) > eps ||
+        fabs(dot(p3 - light->position, n)) > eps) return false;
+    double a = 0.5 * cross(p2 - p1, p3 - p1).norm();
+    area += a;
+    centroid += a / 3 * (p1 + p2 + p3);
+  }
+  if (fabs(area - quad_area) > 1e-2 * quad_area) return false;
+  return (centroid / area - light->position).norm() <= eps;
+}
+
+/**
+ * Whether one of the area lights is the mesh itself, see is_panel_of.
+ */
+static bool covered_by_area_light(const Mesh* mesh,
+                                  const std::vector<SceneLight*>& lights) {
+  for (const SceneLight* light : lights) {
+    const AreaLight* area = dynamic_cast<const AreaLight*>(light);
+    if (area && is_panel_of(mesh, area)) return true;
+  }
+  return false;
+}
+
+std::vector<SceneLight*> create_emissive_lights(
+    const std::vector<SceneObject*>& objects,
+    const std::vector<SceneLight*>& explicit_lights) {
+  std::vector<SceneLight*> lights;
+  for (SceneObject* obj : objects) {
+    BSDF* bsdf = obj->get_bsdf();
+    if (!bsdf || bsdf->get_emission().norm2() == 0) continue;
+
+    if (const Mesh* mesh = dynamic_cast<const Mesh*>(obj)) {
+      if (covered_by_area_light(mesh, explicit_lights)) continue;
+      lights.push_back(new MeshLight(bsdf->get_emission(), mesh));
+    } else if (const SphereObject* sphere =
+                   dynamic_cast<const SphereObject*>(obj)) {
+      lights.push_back(new SphereLight(bsdf->get_emission(), sphere));
+    }
+  }
+  return lights;
 }
 
 } // namespace SceneObjects
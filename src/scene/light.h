@@ -8,6 +8,10 @@
 
 #include "scene.h"  // SceneLight
 #include "object.h" // Mesh, SphereObject
+#include "light_bvh.h" // LightBounds
+#include "util/alias_table.h"
+
+#include <vector>
 
 namespace CGL { namespace SceneObjects {
 
@@ -50,6 +54,7 @@ class PointLight : public SceneLight {
   Vector3D sample_L(const Vector3D p, Vector3D* wi, double* distToLight,
                     double* pdf) const;
   bool is_delta_light() const { return true; }
+  bool get_light_bounds(LightBounds* bounds) const;
 
   Vector3D radiance;
   Vector3D position;
@@ -83,6 +88,7 @@ class AreaLight : public SceneLight {
   Vector3D sample_L(const Vector3D p, Vector3D* wi, double* distToLight,
                     double* pdf) const;
   bool is_delta_light() const { return false; }
+  bool get_light_bounds(LightBounds* bounds) const;
 
   Vector3D radiance;
   Vector3D position;
@@ -102,6 +108,7 @@ class SphereLight : public SceneLight {
   Vector3D sample_L(const Vector3D p, Vector3D* wi, double* distToLight,
                     double* pdf) const;
   bool is_delta_light() const { return false; }
+  bool get_light_bounds(LightBounds* bounds) const;
 
   const SphereObject* sphere;
   Vector3D radiance;
@@ -110,6 +117,12 @@ class SphereLight : public SceneLight {
 }; // class SphereLight
 
 // Mesh Light
+//
+// Samples a point on the emissive mesh by first picking a triangle with
+// probability proportional to its power (area times emitted radiance) from an
+// alias table, then a uniform point on it. The returned pdf is with respect to
+// solid angle at the shading point. Emission is two-sided, as with hits on
+// triangles with an EmissionBSDF.
 
 class MeshLight : public SceneLight {
  public:
@@ -117,12 +130,32 @@ class MeshLight : public SceneLight {
   Vector3D sample_L(const Vector3D p, Vector3D* wi, double* distToLight,
                     double* pdf) const;
   bool is_delta_light() const { return false; }
+  bool get_light_bounds(LightBounds* bounds) const;
 
   const Mesh* mesh;
   Vector3D radiance;
 
+  std::vector<double> areas;  ///< area of each triangle
+  double area;                ///< total area of the mesh
+  double total_weight;        ///< sum of the triangle weights
+  AliasTable triangles;       ///< power-weighted triangle selection
+
 }; // class MeshLight
 
+/**
+ * Create a light for every object whose BSDF emits light (MeshLight for
+ * meshes and SphereLight for spheres), so that emissive geometry is sampled
+ * directly instead of being found only by chance hits.
+ *
+ * Scenes often stand an explicit area light in for an emissive panel, like
+ * the Cornell boxes do. An emissive mesh whose bounds hold the center of
+ * one of the given lights' areas is left to that light, or the panel would
+ * be sampled twice.
+ */
+std::vector<SceneLight*> create_emissive_lights(
+    const std::vector<SceneObject*>& objects,
+    const std::vector<SceneLight*>& lights);
+
 } // namespace SceneObjects
 } // namespace CGL
 
@@ -0,0 +1,343 @@
+#include "light_bvh.h"
+
+#include "CGL/CGL.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+namespace CGL {
+namespace SceneObjects {
+
+static const double ONE_MINUS_EPSILON = 0.99999999999999989;
+
+// Helpers for working with angles through their sines and cosines //
+
+static inline double safe_sqrt(double x) { return sqrt(std::max(0.0, x)); }
+
+// cos(max(0, a - b)) given the sines and cosines of a and b
+static inline double cos_sub_clamped(double sin_a, double cos_a,
+                                     double sin_b, double cos_b) {
+  if (cos_a > cos_b) return 1;
+  return cos_a * cos_b + sin_a * sin_b;
+}
+
+// sin(max(0, a - b)) given the sines and cosines of a and b
+static inline double sin_sub_clamped(double sin_a, double cos_a,
+                                     double sin_b, double cos_b) {
+  if (cos_a > cos_b) return 0;
+  return sin_a * cos_b - cos_a * sin_b;
+}
+
+// Rotate v by theta radians around the given axis (Rodrigues' formula).
+static Vector3D rotate(const Vector3D& v, const Vector3D& axis, double theta) {
+  Vector3D k = axis.unit();
+  double c = cos(theta), s = sin(theta);
+  return v * c + cross(k, v) * s + k * dot(k, v) * (1 - c);
+}
+
+// LightBounds //
+
+double LightBounds::importance(const Vector3D& p, const Vector3D& n) const {
+
+  // clamp the squared distance to the light so points inside the bounds
+  // do not blow up the estimate
+  Vector3D pc = bb.centroid();
+  double d2 = (p - pc).norm2();
+  d2 = std::max(d2, bb.extent.norm() / 2);
+
+  Vector3D wi = p - pc;
+  if (wi.norm2() > 0) wi.normalize();
+
+  double cos_theta_w = dot(axis, wi);
+  if (two_sided) cos_theta_w = fabs(cos_theta_w);
+  double sin_theta_w = safe_sqrt(1 - cos_theta_w * cos_theta_w);
+
+  // angle subtended by the bounds as seen from p, from their bounding sphere
+  double cos_theta_b = -1;
+  double r2 = (bb.extent / 2).norm2();
+  double dc2 = (p - pc).norm2();
+  if (dc2 > r2) cos_theta_b = safe_sqrt(1 - r2 / dc2);
+  double sin_theta_b = safe_sqrt(1 - cos_theta_b * cos_theta_b);
+
+  // smallest angle between the emission cone and the direction to p
+  double sin_theta_o = safe_sqrt(1 - cos_theta_o * cos_theta_o);
+  double cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w,
+                                       sin_theta_o, cos_theta_o);
+  double sin_theta_x = sin_sub_clamped(sin_theta_w, cos_theta_w,
+                                       sin_theta_o, cos_theta_o);
+  double cos_theta_p = cos_sub_clamped(sin_theta_x, cos_theta_x,
+                                       sin_theta_b, cos_theta_b);
+  if (cos_theta_p <= cos_theta_e) return 0;
+
+  double imp = phi * cos_theta_p / d2;
+
+  // account for the cosine at the receiving surface
+  if (n.norm2() > 0) {
+    double cos_theta_i = fabs(dot(wi, n));
+    double sin_theta_i = safe_sqrt(1 - cos_theta_i * cos_theta_i);
+    imp *= cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+  }
+
+  return std::max(imp, 0.0);
+}
+
+LightBounds union_bounds(const LightBounds& a, const LightBounds& b) {
+  if (a.phi == 0) return b;
+  if (b.phi == 0) return a;
+
+  LightBounds u;
+  u.bb = a.bb;
+  u.bb.expand(b.bb);
+  u.phi = a.phi + b.phi;
+  u.cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+  u.two_sided = a.two_sided || b.two_sided;
+
+  // union of the two normal cones
+  double theta_a = acos(clamp(a.cos_theta_o, -1.0, 1.0));
+  double theta_b = acos(clamp(b.cos_theta_o, -1.0, 1.0));
+  double theta_d = acos(clamp(dot(a.axis, b.axis), -1.0, 1.0));
+
+  if (std::min(theta_d + theta_b, PI) <= theta_a) {
+    u.axis = a.axis;
+    u.cos_theta_o = a.cos_theta_o;
+  } else if (std::min(theta_d + theta_a, PI) <= theta_b) {
+    u.axis = b.axis;
+    u.cos_theta_o = b.cos_theta_o;
+  } else {
+    double theta_o = (theta_a + theta_d + theta_b) / 2;
+    Vector3D wr = cross(a.axis, b.axis);
+    if (theta_o >= PI || wr.norm2() == 0) {
+      u.axis = a.axis;
+      u.cos_theta_o = -1;
+    } else {
+      u.axis = rotate(a.axis, wr, theta_o - theta_a).unit();
+      u.cos_theta_o = cos(theta_o);
+    }
+  }
+
+  return u;
+}
+
+// LightBVH //
+
+LightBVH::LightBVH(const std::vector<SceneLight*>& lights) {
+
+  std::vector<std::pair<size_t, LightBounds> > bvh_lights;
+  for (SceneLight* light : lights) {
+    LightBounds bounds;
+    if (!light->get_light_bounds(&bounds)) {
+      infinite_lights.push_back(light);
+    } else if (bounds.phi > 0) {
+      bvh_lights.push_back(make_pair(bounded_lights.size(), bounds));
+      bounded_lights.push_back(light);
+    }
+  }
+
+  if (!bvh_lights.empty())
+    construct(bvh_lights, 0, bvh_lights.size(), 0, 0);
+}
+
+double LightBVH::evaluate_cost(const LightBounds& b, const BBox& bounds,
+                               int dim) const {
+  double theta_o = acos(clamp(b.cos_theta_o, -1.0, 1.0));
+  double theta_e = acos(clamp(b.cos_theta_e, -1.0, 1.0));
+  double theta_w = std::min(theta_o + theta_e, PI);
+  double sin_theta_o = safe_sqrt(1 - b.cos_theta_o * b.cos_theta_o);
+  double m_omega = 2 * PI * (1 - b.cos_theta_o) +
+                   PI / 2 * (2 * theta_w * sin_theta_o
+                             - cos(theta_o - 2 * theta_w)
+                             - 2 * theta_o * sin_theta_o + b.cos_theta_o);
+
+  // penalize splitting thin slabs along their short axis
+  double max_extent = std::max(bounds.extent.x,
+                               std::max(bounds.extent.y, bounds.extent.z));
+  double kr = max_extent / bounds.extent[dim];
+
+  return b.phi * m_omega * kr * b.bb.surface_area();
+}
+
+size_t LightBVH::construct(std::vector<std::pair<size_t, LightBounds> >& lights,
+                           size_t start, size_t end,
+                           uint64_t bit_trail, int depth) {
+
+  if (end - start == 1) {
+    size_t node_index = nodes.size();
+    LightBVHNode node;
+    node.bounds = lights[start].second;
+    node.index = lights[start].first;
+    node.is_leaf = true;
+    nodes.push_back(node);
+    light_to_bit_trail[bounded_lights[node.index]] = bit_trail;
+    return node_index;
+  }
+
+  BBox bounds, centroid_bounds;
+  for (size_t i = start; i < end; ++i) {
+    bounds.expand(lights[i].second.bb);
+    centroid_bounds.expand(lights[i].second.centroid());
+  }
+
+  // find the cheapest bucketed split along any axis
+  const int num_buckets = 12;
+  double min_cost = INF_D;
+  int min_cost_bucket = -1, min_cost_dim = -1;
+
+  for (int dim = 0; dim < 3; ++dim) {
+    if (centroid_bounds.max[dim] == centroid_bounds.min[dim]) continue;
+
+    LightBounds buckets[num_buckets];
+    for (size_t i = start; i < end; ++i) {
+      double c = lights[i].second.centroid()[dim];
+      int b = num_buckets * (c - centroid_bounds.min[dim]) /
+              centroid_bounds.extent[dim];
+      b = clamp(b, 0, num_buckets - 1);
+      buckets[b] = union_bounds(buckets[b], lights[i].second);
+    }
+
+    for (int i = 0; i < num_buckets - 1; ++i) {
+      LightBounds below, above;
+      for (int j = 0; j <= i; ++j) below = union_bounds(below, buckets[j]);
+      for (int j = i + 1; j < num_buckets; ++j) above = union_bounds(above, buckets[j]);
+      double cost = evaluate_cost(below, bounds, dim) +
+                    evaluate_cost(above, bounds, dim);
+      if (cost > 0 && cost < min_cost) {
+        min_cost = cost;
+        min_cost_bucket = i;
+        min_cost_dim = dim;
+      }
+    }
+  }
+
+  size_t mid;
+  if (min_cost_dim == -1) {
+    mid = (start + end) / 2;
+  } else {
+    int dim = min_cost_dim;
+    std::vector<std::pair<size_t, LightBounds> >::iterator pmid =
+      std::partition(lights.begin() + start, lights.begin() + end,
+        [=](const std::pair<size_t, LightBounds>& l) {
+          int b = num_buckets * (l.second.centroid()[dim] -
+                                 centroid_bounds.min[dim]) /
+                  centroid_bounds.extent[dim];
+          b = clamp(b, 0, num_buckets - 1);
+          return b <= min_cost_bucket;
+        });
+    mid = pmid - lights.begin();
+    if (mid == start || mid == end) mid = (start + end) / 2;
+  }
+
+  // interior node: first child follows, second child index filled in after
+  size_t node_index = nodes.size();
+  nodes.push_back(LightBVHNode());
+  construct(lights, start, mid, bit_trail, depth + 1);
+  uint64_t right_trail = depth < 64 ? bit_trail | (uint64_t(1) << depth)
+                                     : bit_trail;
+  size_t second = construct(lights, mid, end, right_trail, depth + 1);
+
+  nodes[node_index].bounds = union_bounds(nodes[node_index + 1].bounds,
+                                          nodes[second].bounds);
+  nodes[node_index].index = second;
+  nodes[node_index].is_leaf = false;
+  return node_index;
+}
+
+const SceneLight* LightBVH::sample(const Vector3D& p, const Vector3D& n,
+                                   double u, double* pmf) const {
+
+  // choose between the infinite lights and the tree
+  size_t num_infinite = infinite_lights.size();
+  double p_infinite = double(num_infinite) /
+                      double(num_infinite + (nodes.empty() ? 0 : 1));
+
+  if (u < p_infinite) {
+    size_t i = std::min(size_t(u / p_infinite * num_infinite), num_infinite - 1);
+    *pmf = p_infinite / num_infinite;
+    return infinite_lights[i];
+  }
+
+  if (nodes.empty()) {
+    *pmf = 0;
+    return NULL;
+  }
+
+  u = std::min((u - p_infinite) / (1 - p_infinite), ONE_MINUS_EPSILON);
+  double node_pmf = 1 - p_infinite;
+  size_t node_index = 0;
+
+  while (true) {
+    const LightBVHNode& node = nodes[node_index];
+    if (node.is_leaf) {
+      if (node_index > 0 || node.bounds.importance(p, n) > 0) {
+        *pmf = node_pmf;
+        return bounded_lights[node.index];
+      }
+      *pmf = 0;
+      return NULL;
+    }
+
+    double c0 = nodes[node_index + 1].bounds.importance(p, n);
+    double c1 = nodes[node.index].bounds.importance(p, n);
+    if (c0 == 0 && c1 == 0) {
+      *pmf = 0;
+      return NULL;
+    }
+
+    // descend into a child with probability proportional to its importance
+    // and remap u so it can be reused at the next level
+    double p0 = c0 / (c0 + c1);
+    if (u < p0) {
+      u = std::min(u / p0, ONE_MINUS_EPSILON);
+      node_pmf *= p0;
+      node_index = node_index + 1;
+    } else {
+      u = std::min((u - p0) / (1 - p0), ONE_MINUS_EPSILON);
+      node_pmf *= 1 - p0;
+      node_index = node.index;
+    }
+  }
+}
+
+double LightBVH::pmf(const Vector3D& p, const Vector3D& n,
+                     const SceneLight* light) const {
+
+  size_t num_infinite = infinite_lights.size();
+  double p_infinite = double(num_infinite) /
+                      double(num_infinite + (nodes.empty() ? 0 : 1));
+
+  unordered_map<const SceneLight*, uint64_t>::const_iterator it =
+    light_to_bit_trail.find(light);
+  if (it == light_to_bit_trail.end()) {
+    if (std::find(infinite_lights.begin(), infinite_lights.end(), light)
+        != infinite_lights.end())
+      return p_infinite / num_infinite;
+    return 0;
+  }
+
+  // follow the recorded path down to the light's leaf
+  uint64_t bit_trail = it->second;
+  double node_pmf = 1 - p_infinite;
+  size_t node_index = 0;
+
+  while (!nodes[node_index].is_leaf) {
+    const LightBVHNode& node = nodes[node_index];
+    double c0 = nodes[node_index + 1].bounds.importance(p, n);
+    double c1 = nodes[node.index].bounds.importance(p, n);
+    if (c0 == 0 && c1 == 0) return 0;
+
+    if (bit_trail & 1) {
+      node_pmf *= c1 / (c0 + c1);
+      node_index = node.index;
+    } else {
+      node_pmf *= c0 / (c0 + c1);
+      node_index = node_index + 1;
+    }
+    bit_trail >>= 1;
+  }
+
+  return node_pmf;
+}
+
+} // namespace SceneObjects
+} // namespace CGL
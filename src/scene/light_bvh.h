@@ -0,0 +1,124 @@
+#ifndef CGL_LIGHT_BVH_H
+#define CGL_LIGHT_BVH_H
+
+#include "scene.h"
+#include "bbox.h"
+
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+namespace CGL { namespace SceneObjects {
+
+/**
+ * Spatial and directional bounds of the emission of a light (or of a group of
+ * lights). Emission is bounded in space by a bounding box, in direction by a
+ * cone around axis with half-angle theta_o containing all surface normals, and
+ * theta_e bounds how far past the normal cone light can be emitted (pi/2 for
+ * a diffuse emitter). phi is the total emitted power.
+ */
+struct LightBounds {
+
+  LightBounds() : axis(0, 0, 1), cos_theta_o(1), cos_theta_e(1), phi(0),
+                  two_sided(false) { }
+
+  LightBounds(const BBox& bb, const Vector3D& axis, double phi,
+              double cos_theta_o, double cos_theta_e, bool two_sided)
+    : bb(bb), axis(axis), cos_theta_o(cos_theta_o), cos_theta_e(cos_theta_e),
+      phi(phi), two_sided(two_sided) { }
+
+  /**
+   * Conservative estimate of the contribution of the bounded emitters to a
+   * shading point p with normal n. Pass a zero normal for points that are
+   * not on a surface.
+   */
+  double importance(const Vector3D& p, const Vector3D& n) const;
+
+  Vector3D centroid() const { return bb.centroid(); }
+
+  BBox bb;             ///< world space bounds of the emitters
+  Vector3D axis;       ///< principal emission direction
+  double cos_theta_o;  ///< cosine of the normal cone half-angle
+  double cos_theta_e;  ///< cosine of the emission spread past the cone
+  double phi;          ///< total emitted power
+  bool two_sided;      ///< emission on both sides of the surface
+
+};
+
+/**
+ * Union of two light bounds. Bounds with zero power are treated as empty.
+ */
+LightBounds union_bounds(const LightBounds& a, const LightBounds& b);
+
+/**
+ * Bounding Volume Hierarchy over the lights of a scene, used to pick a light
+ * for a shading point with probability roughly proportional to its
+ * contribution at that point. Picking a light costs O(log n) in the number of
+ * lights, instead of the O(n) of looping over scene->lights.
+ *
+ * Lights that cannot be bounded in space (directional, environment, ...) are
+ * kept out of the tree and chosen uniformly against the tree as a whole.
+ * Like BVHAccel, nodes are stored in one flat vector: a node's first child
+ * directly follows it, and the second child is found by index.
+ */
+class LightBVH {
+ public:
+
+  /**
+   * Build a light BVH from the given lights. The lights are referenced, not
+   * owned.
+   */
+  LightBVH(const std::vector<SceneLight*>& lights);
+
+  /**
+   * Pick a light for the shading point p with surface normal n.
+   * \param p point being shaded
+   * \param n surface normal at p
+   * \param u uniform random number in [0, 1)
+   * \param pmf address to store the probability of picking the light
+   * \return the chosen light, or NULL if no light contributes at p
+   */
+  const SceneLight* sample(const Vector3D& p, const Vector3D& n,
+                           double u, double* pmf) const;
+
+  /**
+   * Probability that sample() picks the given light at p with normal n.
+   */
+  double pmf(const Vector3D& p, const Vector3D& n,
+             const SceneLight* light) const;
+
+  size_t num_lights() const { return bounded_lights.size() + infinite_lights.size(); }
+  size_t num_nodes() const { return nodes.size(); }
+
+ private:
+
+  struct LightBVHNode {
+    LightBounds bounds;  ///< bounds of all lights below the node
+    size_t index;        ///< light index for leaves, second child otherwise
+    bool is_leaf;
+  };
+
+  /**
+   * Build the subtree over lights[start, end), pairs of an index into
+   * bounded_lights and its bounds, and return the index of its root node. bit_trail and depth record the path from the root,
+   * one bit per level, for pmf().
+   */
+  size_t construct(std::vector<std::pair<size_t, LightBounds> >& lights,
+                   size_t start, size_t end, uint64_t bit_trail, int depth);
+
+  /**
+   * Surface area orientation heuristic cost of a node with the given bounds.
+   */
+  double evaluate_cost(const LightBounds& b, const BBox& bounds, int dim) const;
+
+  std::vector<LightBVHNode> nodes;
+  std::vector<const SceneLight*> bounded_lights;
+  std::vector<const SceneLight*> infinite_lights;
+  std::unordered_map<const SceneLight*, uint64_t> light_to_bit_trail;
+
+};
+
+} // namespace SceneObjects
+} // namespace CGL
+
+#endif // CGL_LIGHT_BVH_H
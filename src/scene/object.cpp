@@ -1,6 +1,5 @@
 #include "object.h"
-#include "sphere.h"
-#include "triangle.h"
+#include "primitive_arena.h"
 
 #include <vector>
 #include <iostream>
@@ -26,6 +25,7 @@ Mesh::Mesh(const HalfedgeMesh& mesh, BSDF* bsdf) {
     vertexI++;
   }
 
+  numVertices = vertexI;
   positions = new Vector3D[vertexI];
   normals   = new Vector3D[vertexI];
   for (int i = 0; i < vertexI; i++) {
@@ -33,28 +33,53 @@ Mesh::Mesh(const HalfedgeMesh& mesh, BSDF* bsdf) {
     normals[i]   = verts[i]->normal;
   }
 
+  numIndices = 3 * mesh.nFaces();
+  indices = new size_t[numIndices];
+  size_t i = 0;
   for (FaceCIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++) {
     HalfedgeCIter h = f->halfedge();
-    indices.push_back(vertexLabels[&*h->vertex()]);
-    indices.push_back(vertexLabels[&*h->next()->vertex()]);
-    indices.push_back(vertexLabels[&*h->next()->next()->vertex()]);
+    indices[i++] = vertexLabels[&*h->vertex()];
+    indices[i++] = vertexLabels[&*h->next()->vertex()];
+    indices[i++] = vertexLabels[&*h->next()->next()->vertex()];
   }
 
   this->bsdf = bsdf;
+  this->ownsArrays = true;
 
 }
 
-vector<Primitive*> Mesh::get_primitives() const {
+Mesh::Mesh(Vector3D* positions, Vector3D* normals, size_t num_vertices,
+           size_t* indices, size_t num_indices, BSDF* bsdf,
+           bool owns_arrays) {
 
-  vector<Primitive*> primitives;
-  size_t num_triangles = indices.size() / 3;
+  this->positions = positions;
+  this->normals = normals;
+  this->numVertices = num_vertices;
+  this->indices = indices;
+  this->numIndices = num_indices;
+  this->bsdf = bsdf;
+  this->ownsArrays = owns_arrays;
+
+}
+
+Mesh::~Mesh() {
+  if (!ownsArrays) return;
+  delete[] positions;
+  delete[] normals;
+  delete[] indices;
+}
+
+void Mesh::get_primitives(PrimitiveArena* arena, vector<Primitive*>* primitives) const {
+
+  size_t num_triangles = numIndices / 3;
+  arena->triangles.reserve(num_triangles);
+  primitives->reserve(primitives->size() + num_triangles);
   for (size_t i = 0; i < num_triangles; ++i) {
-    Triangle* tri = new Triangle(this, indices[i * 3],
-                                       indices[i * 3 + 1],
-                                       indices[i * 3 + 2]);
-    primitives.push_back(tri);
+    Triangle* tri = arena->triangles.create(this, indices[i * 3],
+                                                  indices[i * 3 + 1],
+                                                  indices[i * 3 + 2]);
+    primitives->push_back(tri);
   }
-  return primitives;
 }
 
 BSDF* Mesh::get_bsdf() const {
@@ -71,10 +96,9 @@ SphereObject::SphereObject(const Vector3D o, double r, BSDF* bsdf) {
   
 }
 
-std::vector<Primitive*> SphereObject::get_primitives() const {
-  std::vector<Primitive*> primitives;
-  primitives.push_back(new Sphere(this,o,r));
-  return primitives;
+void SphereObject::get_primitives(PrimitiveArena* arena,
+                                  std::vector<Primitive*>* primitives) const {
+  primitives->push_back(arena->spheres.create(this, o, r));
 }
 
 BSDF* SphereObject::get_bsdf() const {
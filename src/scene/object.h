@@ -21,11 +21,23 @@ class Mesh : public SceneObject {
   Mesh(const HalfedgeMesh& mesh, BSDF* bsdf);
 
   /**
-   * Get all the primitives (Triangle) in the mesh.
-   * Note that Triangle reference the mesh for the actual data.
-   * \return all the primitives in the mesh
+   * Constructor.
+   * Construct a static mesh on world-space vertex arrays and triangle
+   * indices that are already laid out for rendering, e.g. in a mapped
+   * scene cache. The arrays are used in place, not copied. If owns_arrays
+   * is set they were allocated with new[] and the mesh deletes them,
+   * otherwise they must outlive the mesh.
+   */
+  Mesh(Vector3D* positions, Vector3D* normals, size_t num_vertices,
+       size_t* indices, size_t num_indices, BSDF* bsdf,
+       bool owns_arrays = false);
+
+  ~Mesh();
+
+  /**
+   * Create the primitives (Triangle) of the mesh, one per triangle.
    */
-  vector<Primitive*> get_primitives() const;
+  void get_primitives(PrimitiveArena* arena, vector<Primitive*>* primitives) const;
 
   /**
    * Get the BSDF of the surface material of the mesh.
@@ -33,6 +45,18 @@ class Mesh : public SceneObject {
    */
   BSDF* get_bsdf() const;
 
+  /**
+   * Get the triangle vertex indices, three per triangle, into positions and
+   * normals.
+   */
+  const size_t* get_indices() const { return indices; }
+  size_t num_indices() const { return numIndices; }
+
+  /**
+   * Get the number of entries in positions and normals.
+   */
+  size_t num_vertices() const { return numVertices; }
+
   Vector3D *positions;  ///< position array
   Vector3D *normals;    ///< normal array
 
@@ -40,7 +64,10 @@ class Mesh : public SceneObject {
 
   BSDF* bsdf; ///< BSDF of surface material
 
-  vector<size_t> indices;  ///< triangles defined by indices
+  size_t* indices;    ///< triangles defined by indices
+  size_t numIndices;  ///< three per triangle
+  size_t numVertices; ///< size of positions and normals
+  bool ownsArrays;    ///< delete the arrays with the mesh
 
 };
 
@@ -57,11 +84,11 @@ class SphereObject : public SceneObject {
   SphereObject(const Vector3D o, double r, BSDF* bsdf);
 
   /**
-  * Get all the primitives (Sphere) in the sphere object.
+  * Create the primitive (Sphere) of the sphere object.
   * Note that Sphere reference the sphere object for the actual data.
-  * \return all the primitives in the sphere object
   */
-  std::vector<Primitive*> get_primitives() const;
+  void get_primitives(PrimitiveArena* arena,
+                      std::vector<Primitive*>* primitives) const;
 
   /**
    * Get the BSDF of the surface material of the sphere.
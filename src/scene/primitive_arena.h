@@ -0,0 +1,89 @@
+#ifndef CGL_STATICSCENE_PRIMITIVE_ARENA_H
+#define CGL_STATICSCENE_PRIMITIVE_ARENA_H
+
+#include "triangle.h"
+#include "sphere.h"
+
+#include <cstdio>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+namespace CGL { namespace SceneObjects {
+
+/**
+ * Storage for the primitives of one type. Primitives are placed one after
+ * another in blocks that are never reallocated, so pointers to them stay
+ * valid as the pool grows. Reserving room for an object's primitives
+ * before creating them keeps them in one block.
+ */
+template <typename T>
+class PrimitivePool {
+ public:
+
+  /**
+   * Make room for n more primitives in the current block.
+   */
+  void reserve(size_t n) {
+    if (!blocks.empty() && blocks.back().capacity() - blocks.back().size() >= n) {
+      return;
+    }
+    // large meshes get a block of their own, small objects share one
+    blocks.push_back(std::vector<T>());
+    blocks.back().reserve(std::max(n, (size_t) 256));
+  }
+
+  template <typename... Args>
+  T* create(Args&&... args) {
+    reserve(1);
+    blocks.back().emplace_back(std::forward<Args>(args)...);
+    return &blocks.back().back();
+  }
+
+  size_t size() const {
+    size_t n = 0;
+    for (size_t i = 0; i < blocks.size(); ++i) n += blocks[i].size();
+    return n;
+  }
+
+  /**
+   * Bytes held, including room reserved but not used yet.
+   */
+  size_t bytes() const {
+    size_t n = 0;
+    for (size_t i = 0; i < blocks.size(); ++i) n += blocks[i].capacity() * sizeof(T);
+    return n;
+  }
+
+ private:
+  std::vector<std::vector<T> > blocks;
+};
+
+/**
+ * Owns all the primitives of a scene, contiguous per type. They are
+ * created by SceneObject::get_primitives and freed in one go with the
+ * scene.
+ */
+class PrimitiveArena {
+ public:
+
+  PrimitivePool<Triangle> triangles;
+  PrimitivePool<Sphere> spheres;
+
+  size_t bytes() const { return triangles.bytes() + spheres.bytes(); }
+
+  /**
+   * Print the memory held per primitive type.
+   */
+  void print_report() const {
+    fprintf(stdout, "[PathTracer] Primitive memory: %zu triangles %.2f MB, "
+                    "%zu spheres %.2f MB, %.2f MB in all\n",
+            triangles.size(), triangles.bytes() / 1048576.0,
+            spheres.size(), spheres.bytes() / 1048576.0, bytes() / 1048576.0);
+  }
+};
+
+} // namespace SceneObjects
+} // namespace CGL
+
+#endif // CGL_STATICSCENE_PRIMITIVE_ARENA_H
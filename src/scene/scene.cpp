@@ -0,0 +1,24 @@
+#include "scene.h"
+#include "primitive_arena.h"
+
+namespace CGL { namespace SceneObjects {
+
+Scene::~Scene() {
+  // lights first, mesh lights refer to their meshes
+  for (size_t i = 0; i < lights.size(); ++i) delete lights[i];
+  delete arena;
+  for (size_t i = 0; i < objects.size(); ++i) delete objects[i];
+}
+
+const std::vector<Primitive*>& Scene::get_primitives() {
+  if (arena) return primitives;
+
+  arena = new PrimitiveArena();
+  for (size_t i = 0; i < objects.size(); ++i) {
+    objects[i]->get_primitives(arena, &primitives);
+  }
+  return primitives;
+}
+
+} // namespace SceneObjects
+} // namespace CGL
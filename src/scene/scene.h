@@ -8,17 +8,24 @@
 
 namespace CGL { namespace SceneObjects {
 
+struct LightBounds;
+class PrimitiveArena;
+
 /**
  * Interface for objects in the scene.
  */
 class SceneObject {
  public:
 
+  virtual ~SceneObject() { }
+
   /**
-   * Get all the primitives in the scene object.
-   * \return a vector of all the primitives in the scene object
+   * Create the primitives of the scene object.
+   * \param arena the arena the primitives are created in, which owns them
+   * \param primitives vector the primitives are appended to
    */
-  virtual std::vector<Primitive*> get_primitives() const = 0;
+  virtual void get_primitives(PrimitiveArena* arena,
+                              std::vector<Primitive*>* primitives) const = 0;
 
   /**
    * Get the surface BSDF of the object's surface.
@@ -34,46 +41,63 @@ class SceneObject {
  */
 class SceneLight {
  public:
+  virtual ~SceneLight() { }
+
   virtual Vector3D sample_L(const Vector3D p, Vector3D* wi,
                             double* distToLight, double* pdf) const = 0;
   virtual bool is_delta_light() const = 0;
 
+  /**
+   * Get the spatial and directional bounds of the light's emission, used to
+   * place the light in a LightBVH.
+   * \param bounds address to store the bounds
+   * \return false if the light cannot be bounded in space (e.g. directional
+   *         or environment lights), true otherwise
+   */
+  virtual bool get_light_bounds(LightBounds* bounds) const { return false; }
+
 };
 
 
 /**
  * Represents a scene in a raytracer-friendly format. To speed up raytracing,
- * all data is already transformed to world space.
+ * all data is already transformed to world space. The scene owns its
+ * objects, its lights and the primitives made from the objects, and frees
+ * them all when it is deleted.
  */
 struct Scene {
   Scene(const std::vector<SceneObject *>& objects,
         const std::vector<SceneLight *>& lights)
-    : objects(objects), lights(lights) { }
+    : objects(objects), lights(lights), arena(NULL) { }
+
+  ~Scene();
+
+  /**
+   * The primitives of all the objects, in object order. They are created
+   * on first use and live as long as the scene.
+   */
+  const std::vector<Primitive*>& get_primitives();
+
+  /**
+   * The arena holding the primitives, NULL until they are created.
+   */
+  const PrimitiveArena* get_arena() const { return arena; }
 
   // kept to make sure they don't get deleted, in case the
   //  primitives depend on them (e.g. Mesh Triangles).
   std::vector<SceneObject*> objects;
 
-  // for sake of consistency of the scene object Interface
+  // for sake of consistency of the scene object Interface. Objects with an
+  //  emissive BSDF are also registered here as mesh and sphere lights (see
+  //  create_emissive_lights) so light sampling applies to them.
   std::vector<SceneLight*> lights;
 
-  // TODO (sky) :
-  // Adding object with emission BSDFs as mesh lights and sphere lights so 
-  // that light sampling configurations also applies to mesh lights. 
-//  for (SceneObjects *obj : objects) {
-//    if (obj->get_material().emit != Vector3D()) {
-//      
-//      // mesh light
-//      if (dynamic_cast<Mesh*>(obj)) {
-//        staticLights.push_back()
-//      }
-//      
-//      // sphere light
-//      if (dynamic_cast<Sphere*>(obj)) {
-//
-//      }
-//  }
+ private:
+  Scene(const Scene&);
+  Scene& operator=(const Scene&);
 
+  PrimitiveArena* arena;
+  std::vector<Primitive*> primitives;
 };
 
 } // namespace SceneObjects
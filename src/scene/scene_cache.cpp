@@ -0,0 +1,423 @@
+#include "scene_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <climits>
+#include <unistd.h>
+#endif
+
+namespace CGL {
+
+static const char scene_cache_magic[8] = { 'P', 'T', 'S', 'C', 'E', 'N', 'E', 0 };
+static const uint32_t scene_cache_version = 3;
+
+/**
+ * Revision of the code that builds what the cache holds, which the build
+ * sets to a hash of the scene loader and Collada parser sources. Caches of
+ * any other revision are stale, so loader changes need no version bump.
+ */
+#ifndef CGL_SCENE_BUILDER_REVISION
+#define CGL_SCENE_BUILDER_REVISION 0
+#endif
+static const uint64_t scene_builder_revision = CGL_SCENE_BUILDER_REVISION;
+
+/**
+ * Every section starts on this boundary, so its arrays are aligned in the
+ * mapping as they would be in memory.
+ */
+static const size_t scene_cache_align = 64;
+
+static size_t align_up(size_t offset) {
+  return (offset + scene_cache_align - 1) & ~(scene_cache_align - 1);
+}
+
+static bool source_stamp(const std::string& source, uint64_t* size, int64_t* mtime) {
+  struct stat st;
+  if (stat(source.c_str(), &st) != 0) return false;
+  *size = (uint64_t) st.st_size;
+  *mtime = (int64_t) st.st_mtime;
+  return true;
+}
+
+/**
+ * Create directory path and its missing parents. Failures show when the
+ * file in it is opened.
+ */
+static void make_directories(const std::string& path) {
+  for (size_t i = 1; i <= path.size(); ++i) {
+    if (i < path.size() && path[i] != '/' && path[i] != '\\') continue;
+    std::string dir = path.substr(0, i);
+    struct stat st;
+    if (stat(dir.c_str(), &st) == 0) continue;
+#ifdef _WIN32
+    _mkdir(dir.c_str());
+#else
+    mkdir(dir.c_str(), 0755);
+#endif
+  }
+}
+
+/**
+ * Serializes fields one at a time, so only their bytes reach the file and
+ * never the padding between them.
+ */
+class FieldWriter {
+ public:
+  template <typename T>
+  void put(const T& v) {
+    const char* p = (const char*) &v;
+    bytes.insert(bytes.end(), p, p + sizeof(T));
+  }
+
+  void put(const Vector3D& v) { put(v.x); put(v.y); put(v.z); }
+
+  std::vector<char> bytes;
+};
+
+/**
+ * Reads back the fields of a FieldWriter. Reading past the end clears ok.
+ */
+class FieldReader {
+ public:
+  FieldReader(const char* data, size_t size)
+    : data(data), size(size), offset(0), ok(true) { }
+
+  template <typename T>
+  void get(T* v) {
+    if (!ok || size - offset < sizeof(T)) {
+      ok = false;
+      return;
+    }
+    memcpy(v, data + offset, sizeof(T));
+    offset += sizeof(T);
+  }
+
+  void get(Vector3D* v) { get(&v->x); get(&v->y); get(&v->z); }
+
+  const char* data;
+  size_t size;
+  size_t offset;
+  bool ok;
+};
+
+/**
+ * Writes sections, padding each to the section alignment.
+ */
+class SectionWriter {
+ public:
+  SectionWriter(FILE* file) : file(file), offset(0), ok(true) { }
+
+  void write(const void* p, size_t bytes) {
+    append(p, bytes);
+    pad();
+  }
+
+  /**
+   * Add bytes to the current section.
+   */
+  void append(const void* p, size_t bytes) {
+    if (!ok) return;
+    if (bytes && fwrite(p, 1, bytes, file) != bytes) ok = false;
+    offset += bytes;
+  }
+
+  /**
+   * End the current section.
+   */
+  void pad() {
+    static const char zeros[scene_cache_align] = { 0 };
+    if (!ok) return;
+    size_t pad = align_up(offset) - offset;
+    if (pad && fwrite(zeros, 1, pad, file) != pad) ok = false;
+    offset += pad;
+  }
+
+  FILE* file;
+  size_t offset;
+  bool ok;
+};
+
+/**
+ * Hands out sections of the mapped file, in the order SectionWriter wrote
+ * them.
+ */
+class SectionReader {
+ public:
+  SectionReader(char* data, size_t size) : data(data), size(size), offset(0) { }
+
+  /**
+   * \return the next count elements of elem_size bytes, NULL past the end
+   */
+  char* read(uint64_t count, size_t elem_size) {
+    if (count > (size - offset) / elem_size) return NULL;
+    char* p = data + offset;
+    skip(count * elem_size);
+    return p;
+  }
+
+  /**
+   * Move past a section of bytes read some other way.
+   */
+  void skip(size_t bytes) {
+    offset = std::min(align_up(offset + bytes), size);
+  }
+
+  char* data;
+  size_t size;
+  size_t offset;
+};
+
+/**
+ * Write n vectors in the in-memory layout of Vector3D, with any padding a
+ * SIMD build adds after z zeroed rather than copied from memory.
+ */
+static void write_vectors(SectionWriter& writer, const Vector3D* v, size_t n) {
+  static const size_t batch = 4096;
+  std::vector<char> buffer;
+  for (size_t i = 0; i < n; i += batch) {
+    size_t m = std::min(batch, n - i);
+    buffer.assign(m * sizeof(Vector3D), 0);
+    for (size_t j = 0; j < m; ++j) {
+      memcpy(&buffer[j * sizeof(Vector3D)], &v[i + j].x, 3 * sizeof(double));
+    }
+    writer.append(&buffer[0], buffer.size());
+  }
+  writer.pad();
+}
+
+SceneCache::SceneCache() : camera(), hasBounds(false) { }
+
+std::string SceneCache::default_path(const std::string& source) {
+  std::string dir;
+#ifdef _WIN32
+  const char* local = getenv("LOCALAPPDATA");
+  if (local && *local) dir = std::string(local) + "\\pathtracer";
+  char full[_MAX_PATH];
+  std::string absolute = _fullpath(full, source.c_str(), _MAX_PATH) ? full : source;
+#else
+  const char* xdg = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+  if (xdg && *xdg) dir = std::string(xdg) + "/pathtracer";
+  else if (home && *home) dir = std::string(home) + "/.cache/pathtracer";
+  char full[PATH_MAX];
+  std::string absolute = realpath(source.c_str(), full) ? full : source;
+#endif
+  if (dir.empty()) return "";
+
+  // FNV-1a, so scenes of the same name in different directories differ
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < absolute.size(); ++i) {
+    hash = (hash ^ (unsigned char) absolute[i]) * 1099511628211ULL;
+  }
+  std::string name = absolute.substr(absolute.find_last_of("/\\") + 1);
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), "-%016llx.cache", (unsigned long long) hash);
+  return dir + "/" + name + suffix;
+}
+
+bool SceneCache::load(const std::string& path, const std::string& source) {
+  file.close();
+  uint64_t source_size;
+  int64_t source_mtime;
+  if (!source_stamp(source, &source_size, &source_mtime)) return false;
+
+  // writable, since meshes take non-const arrays; nothing is written back
+  if (!file.open(path, true)) return false;
+
+  // the header, then the materials, lights and objects, field by field
+  FieldReader fields(file.data(), file.size());
+  char magic[8];
+  uint32_t version = 0, vector_size = 0, index_size = 0;
+  uint64_t revision = 0;
+  uint32_t num_materials = 0, num_lights = 0, num_objects = 0;
+  uint64_t size = 0;
+  int64_t mtime = 0;
+  for (size_t i = 0; i < 8; ++i) fields.get(&magic[i]);
+  fields.get(&version);
+  fields.get(&revision);
+  fields.get(&vector_size);
+  fields.get(&index_size);
+  fields.get(&num_materials);
+  fields.get(&num_lights);
+  fields.get(&num_objects);
+  fields.get(&size);
+  fields.get(&mtime);
+  // counts past the file size are corrupt; do not allocate for them
+  if (!fields.ok || memcmp(magic, scene_cache_magic, 8) != 0 ||
+      version != scene_cache_version || revision != scene_builder_revision ||
+      vector_size != sizeof(Vector3D) || index_size != sizeof(size_t) ||
+      size != source_size || mtime != source_mtime ||
+      num_materials > file.size() || num_lights > file.size() ||
+      num_objects > file.size()) {
+    file.close();
+    return false;
+  }
+
+  uint32_t has_bounds = 0;
+  fields.get(&camera.present);
+  fields.get(&camera.hFov);
+  fields.get(&camera.vFov);
+  fields.get(&camera.nClip);
+  fields.get(&camera.fClip);
+  fields.get(&camera.view_dir);
+  fields.get(&has_bounds);
+  fields.get(&boundsMin);
+  fields.get(&boundsMax);
+  hasBounds = has_bounds != 0;
+
+  materials.assign(num_materials, Collada::MaterialParams());
+  for (size_t i = 0; i < materials.size(); ++i) {
+    Collada::MaterialParams& material = materials[i];
+    uint32_t type = 0;
+    fields.get(&type);
+    material.type = (Collada::MaterialParams::Type) type;
+    fields.get(&material.spectrum);
+    fields.get(&material.spectrum2);
+    fields.get(&material.roughness);
+    fields.get(&material.ior);
+  }
+  lights.assign(num_lights, Light());
+  for (size_t i = 0; i < lights.size(); ++i) {
+    Light& light = lights[i];
+    fields.get(&light.type);
+    fields.get(&light.spectrum);
+    fields.get(&light.position);
+    fields.get(&light.direction);
+    fields.get(&light.dim_x);
+    fields.get(&light.dim_y);
+  }
+  objects.assign(num_objects, Object());
+  for (size_t i = 0; i < objects.size(); ++i) {
+    Object& object = objects[i];
+    fields.get(&object.type);
+    fields.get(&object.material);
+    fields.get(&object.num_vertices);
+    fields.get(&object.num_indices);
+    fields.get(&object.center);
+    fields.get(&object.radius);
+  }
+  if (!fields.ok) {
+    file.close();
+    return false;
+  }
+
+  SectionReader reader(file.data(), file.size());
+  reader.skip(fields.offset);
+  meshes.assign(objects.size(), MeshArrays());
+  for (size_t i = 0; i < objects.size(); ++i) {
+    const Object& object = objects[i];
+    if (object.material >= (int32_t) materials.size()) {
+      file.close();
+      return false;
+    }
+    if (object.type != Object::MESH) continue;
+
+    MeshArrays& mesh = meshes[i];
+    mesh.positions = (Vector3D*) reader.read(object.num_vertices, sizeof(Vector3D));
+    mesh.normals = (Vector3D*) reader.read(object.num_vertices, sizeof(Vector3D));
+    mesh.indices = (size_t*) reader.read(object.num_indices, sizeof(size_t));
+    bool valid = mesh.positions && mesh.normals && mesh.indices;
+    for (size_t j = 0; valid && j < object.num_indices; ++j) {
+      valid = mesh.indices[j] < object.num_vertices;
+    }
+    if (!valid) {
+      file.close();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SceneCache::save(const std::string& path, const std::string& source) const {
+  uint64_t source_size;
+  int64_t source_mtime;
+  if (!source_stamp(source, &source_size, &source_mtime)) return false;
+
+  FieldWriter fields;
+  for (size_t i = 0; i < 8; ++i) fields.put(scene_cache_magic[i]);
+  fields.put(scene_cache_version);
+  fields.put(scene_builder_revision);
+  fields.put((uint32_t) sizeof(Vector3D));
+  fields.put((uint32_t) sizeof(size_t));
+  fields.put((uint32_t) materials.size());
+  fields.put((uint32_t) lights.size());
+  fields.put((uint32_t) objects.size());
+  fields.put(source_size);
+  fields.put(source_mtime);
+  fields.put(camera.present);
+  fields.put(camera.hFov);
+  fields.put(camera.vFov);
+  fields.put(camera.nClip);
+  fields.put(camera.fClip);
+  fields.put(camera.view_dir);
+  fields.put((uint32_t) hasBounds);
+  fields.put(boundsMin);
+  fields.put(boundsMax);
+  for (size_t i = 0; i < materials.size(); ++i) {
+    const Collada::MaterialParams& material = materials[i];
+    fields.put((uint32_t) material.type);
+    fields.put(material.spectrum);
+    fields.put(material.spectrum2);
+    fields.put(material.roughness);
+    fields.put(material.ior);
+  }
+  for (size_t i = 0; i < lights.size(); ++i) {
+    const Light& light = lights[i];
+    fields.put(light.type);
+    fields.put(light.spectrum);
+    fields.put(light.position);
+    fields.put(light.direction);
+    fields.put(light.dim_x);
+    fields.put(light.dim_y);
+  }
+  for (size_t i = 0; i < objects.size(); ++i) {
+    const Object& object = objects[i];
+    fields.put(object.type);
+    fields.put(object.material);
+    fields.put(object.num_vertices);
+    fields.put(object.num_indices);
+    fields.put(object.center);
+    fields.put(object.radius);
+  }
+
+  size_t slash = path.find_last_of("/\\");
+  if (slash != std::string::npos && slash > 0) make_directories(path.substr(0, slash));
+
+  // other processes (e.g. render workers) may be writing the same cache
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%d.tmp", (int) getpid());
+  std::string tmp_path = path + suffix;
+  FILE* out = fopen(tmp_path.c_str(), "wb");
+  if (!out) return false;
+
+  SectionWriter writer(out);
+  writer.write(fields.bytes.data(), fields.bytes.size());
+  for (size_t i = 0; i < objects.size(); ++i) {
+    if (objects[i].type != Object::MESH) continue;
+    write_vectors(writer, meshes[i].positions, objects[i].num_vertices);
+    write_vectors(writer, meshes[i].normals, objects[i].num_vertices);
+    writer.write(meshes[i].indices, objects[i].num_indices * sizeof(size_t));
+  }
+  bool ok = fclose(out) == 0 && writer.ok;
+
+#ifdef _WIN32
+  // rename does not replace existing files here
+  if (ok) remove(path.c_str());
+#endif
+  if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    remove(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+} // namespace CGL
@@ -0,0 +1,115 @@
+#ifndef CGL_SCENE_CACHE_H
+#define CGL_SCENE_CACHE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "CGL/vector3D.h"
+#include "scene/collada/material_info.h"
+#include "util/mapped_file.h"
+
+namespace CGL {
+
+/**
+ * Binary cache of the static scene load_static_scene builds from a Collada
+ * file, so later runs skip parsing the XML and rebuilding the meshes through
+ * HalfedgeMesh. It holds the world-space mesh vertices, normals and triangle
+ * indices, the spheres, materials, lights and camera.
+ *
+ * The file is memory-mapped (copy-on-write) and meshes created from it use
+ * its arrays in place. The arrays are stored in the in-memory layout of
+ * Vector3D and size_t, checked on load, so a cache is only read back by a
+ * build with the same layout; any other cache is treated as stale. The
+ * smaller records are written field by field, so no padding bytes reach
+ * the file.
+ */
+class SceneCache {
+ public:
+
+  /**
+   * A light, by the world-space arguments of its constructor.
+   */
+  struct Light {
+    uint32_t type;          ///< Collada::LightType::T
+    Vector3D spectrum;
+    Vector3D position;
+    Vector3D direction;
+    Vector3D dim_x, dim_y;  ///< extent of area lights
+  };
+
+  struct Object {
+    enum Type {
+      MESH,
+      SPHERE
+    };
+    uint32_t type;
+    int32_t material;       ///< index into materials, -1 for the default
+    uint64_t num_vertices;  ///< meshes
+    uint64_t num_indices;   ///< meshes, three per triangle
+    Vector3D center;        ///< spheres
+    double radius;          ///< spheres
+  };
+
+  /**
+   * Arrays of a mesh object, in the mapped file once loaded.
+   */
+  struct MeshArrays {
+    MeshArrays() : positions(NULL), normals(NULL), indices(NULL) { }
+    Vector3D* positions;
+    Vector3D* normals;
+    size_t* indices;
+  };
+
+  struct CameraParams {
+    uint32_t present;       ///< the scene has a camera; else the default one
+    float hFov, vFov, nClip, fClip;
+    Vector3D view_dir;      ///< world-space view direction
+  };
+
+  SceneCache();
+
+  /**
+   * Where the cache of the scene file source goes by default: a file named
+   * after the scene and a hash of its absolute path, in
+   * $XDG_CACHE_HOME/pathtracer or ~/.cache/pathtracer (%LOCALAPPDATA% on
+   * Windows), so nothing is written next to the scene.
+   * \return the path, empty if there is no cache directory
+   */
+  static std::string default_path(const std::string& source);
+
+  /**
+   * Map the cache at path.
+   * \param source the scene file; the cache is stale unless it was written
+   *               for the source's current size and modification time, by
+   *               a build of the same scene loader
+   * \return false if there is no usable cache
+   */
+  bool load(const std::string& path, const std::string& source);
+
+  /**
+   * Write the cache for source to path, creating its directory if needed,
+   * through a temporary file so processes loading it concurrently never see
+   * it half written.
+   */
+  bool save(const std::string& path, const std::string& source) const;
+
+  CameraParams camera;
+  bool hasBounds;           ///< bounds are set (the scene has objects)
+  Vector3D boundsMin, boundsMax;
+
+  std::vector<Collada::MaterialParams> materials;
+  std::vector<Light> lights;
+  std::vector<Object> objects;
+  std::vector<MeshArrays> meshes;  ///< parallel to objects
+
+ private:
+
+  MappedFile file;          ///< unmapped on destruction, so the meshes
+                            ///< loaded from it must be gone by then
+
+}; // class SceneCache
+
+} // namespace CGL
+
+#endif // CGL_SCENE_CACHE_H
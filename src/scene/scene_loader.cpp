@@ -0,0 +1,429 @@
+#include "scene_loader.h"
+
+#include "scene/object.h"
+#include "scene/light.h"
+#include "pathtracer/bsdf.h"
+#include "CGL/timer.h"
+#include "util/parallel_for.h"
+#include "util/startup_profiler.h"
+
+#include <map>
+#include <thread>
+#include <algorithm>
+
+using std::vector;
+
+using Collada::CameraInfo;
+using Collada::LightInfo;
+using Collada::MaterialInfo;
+using Collada::MaterialParams;
+using Collada::PolymeshInfo;
+using Collada::SphereInfo;
+
+namespace CGL {
+
+/**
+ * The world-space constructor arguments of a light.
+ */
+static SceneCache::Light light_params(const LightInfo& light,
+                                      const Matrix4x4& transform) {
+  SceneCache::Light params = SceneCache::Light();
+  params.type = light.light_type;
+  params.spectrum = light.spectrum;
+  params.position = (transform * Vector4D(light.position, 1)).to3D();
+
+  switch(light.light_type) {
+    case Collada::LightType::DIRECTIONAL:
+      params.direction = -(transform * Vector4D(light.direction, 1)).to3D();
+      params.direction.normalize();
+      break;
+    case Collada::LightType::AREA:
+      params.direction = (transform * Vector4D(light.direction, 1)).to3D() - params.position;
+      params.direction.normalize();
+      params.dim_x = cross(light.up, light.direction);
+      params.dim_y = light.up;
+      params.dim_x = (transform * Vector4D(params.dim_x, 1)).to3D() - params.position;
+      params.dim_y = (transform * Vector4D(params.dim_y, 1)).to3D() - params.position;
+      break;
+    case Collada::LightType::SPOT:
+      params.direction = (transform * Vector4D(light.direction, 1)).to3D() - params.position;
+      params.direction.normalize();
+      break;
+    default:
+      break;
+  }
+  return params;
+}
+
+static SceneObjects::SceneLight *create_light(const SceneCache::Light& light) {
+  switch(light.type) {
+    case Collada::LightType::AMBIENT:
+      return new SceneObjects::InfiniteHemisphereLight(light.spectrum);
+    case Collada::LightType::DIRECTIONAL:
+      return new SceneObjects::DirectionalLight(light.spectrum, light.direction);
+    case Collada::LightType::AREA:
+      return new SceneObjects::AreaLight(light.spectrum, light.position,
+                                         light.direction, light.dim_x, light.dim_y);
+    case Collada::LightType::POINT:
+      return new SceneObjects::PointLight(light.spectrum, light.position);
+    case Collada::LightType::SPOT:
+      return new SceneObjects::SpotLight(light.spectrum, light.position,
+                                         light.direction, PI * .5f);
+    default:
+      break;
+  }
+  return NULL;
+}
+
+/**
+ * Build the mesh's world-space vertex and index buffers directly, without
+ * the HalfedgeMesh the editor builds. Polygons are split into fans of
+ * triangles around their last vertex, so triangles come out as
+ * Mesh(const HalfedgeMesh&) emits them. Polygons with fewer than three
+ * vertices or invalid indices are dropped.
+ *
+ * Vertex normals are those of HalfedgeMesh::build (Vertex::computeNormal):
+ * an interior vertex sums the corner triangles (v, next, next-next) of its
+ * polygons. A boundary vertex v sums, around the vertex x before it on the
+ * boundary, the triangles (v, x, s) for each s following x in a polygon or
+ * on the boundary. Scenes rely on this: open meshes, such as the walls of
+ * the Cornell box, come out facing against their winding.
+ */
+static SceneObjects::Mesh *load_polymesh(const PolymeshInfo& polymesh,
+                                          const Matrix4x4& transform,
+                                          BBox *bbox) {
+  size_t num_vertices = polymesh.vertices.size();
+  Vector3D *positions = new Vector3D[num_vertices];
+  Vector3D *normals = new Vector3D[num_vertices];
+  for (size_t i = 0; i < num_vertices; i++) {
+    positions[i] = (transform * Vector4D(polymesh.vertices[i], 1)).projectTo3D();
+    bbox->expand(positions[i]);
+  }
+
+  vector<bool> valid(polymesh.polygons.size());
+  size_t num_triangles = 0;
+  vector<size_t> out_start(num_vertices + 1, 0);
+  for (size_t i = 0; i < polymesh.polygons.size(); i++) {
+    const vector<size_t>& polygon = polymesh.polygons[i].vertex_indices;
+    valid[i] = polygon.size() >= 3;
+    for (size_t j = 0; valid[i] && j < polygon.size(); j++) {
+      valid[i] = polygon[j] < num_vertices;
+    }
+    if (!valid[i]) continue;
+    num_triangles += polygon.size() - 2;
+    for (size_t j = 0; j < polygon.size(); j++) out_start[polygon[j] + 1]++;
+  }
+
+  // directed polygon edges, grouped by their first vertex
+  for (size_t i = 0; i < num_vertices; i++) out_start[i + 1] += out_start[i];
+  vector<size_t> out_end(out_start.begin(), out_start.end() - 1);
+  vector<size_t> out(out_start[num_vertices]);
+
+  size_t *indices = new size_t[3 * num_triangles];
+  size_t k = 0;
+  for (size_t i = 0; i < polymesh.polygons.size(); i++) {
+    if (!valid[i]) continue;
+    const vector<size_t>& polygon = polymesh.polygons[i].vertex_indices;
+    size_t n = polygon.size();
+    for (size_t j = 0; j + 2 < n; j++) {
+      indices[k++] = polygon[n - 1];
+      indices[k++] = polygon[j];
+      indices[k++] = polygon[j + 1];
+    }
+    for (size_t j = 0; j < n; j++) {
+      size_t a = polygon[j], b = polygon[(j + 1) % n], c = polygon[(j + 2) % n];
+      out[out_end[a]++] = b;
+      normals[a] += cross(positions[b] - positions[a], positions[c] - positions[a]);
+    }
+  }
+
+  // an edge a->b without b->a is on the boundary; b's boundary predecessor is a
+  const size_t none = (size_t) -1;
+  vector<size_t> boundary_prev(num_vertices, none);
+  for (size_t a = 0; a < num_vertices; a++) {
+    for (size_t e = out_start[a]; e < out_end[a]; e++) {
+      size_t b = out[e];
+      if (std::find(&out[out_start[b]], &out[out_end[b]], a) == &out[out_end[b]]) {
+        boundary_prev[b] = a;
+      }
+    }
+  }
+  for (size_t v = 0; v < num_vertices; v++) {
+    size_t x = boundary_prev[v];
+    if (x == none) continue;
+    Vector3D xv = positions[x] - positions[v];
+    Vector3D normal;
+    for (size_t e = out_start[x]; e < out_end[x]; e++) {
+      normal += cross(xv, positions[out[e]] - positions[v]);
+    }
+    if (boundary_prev[x] != none) {
+      normal += cross(xv, positions[boundary_prev[x]] - positions[v]);
+    }
+    normals[v] = normal;
+  }
+
+  for (size_t i = 0; i < num_vertices; i++) {
+    if (normals[i].norm2() > 0) normals[i].normalize();
+  }
+
+  BSDF *bsdf = polymesh.material ? polymesh.material->bsdf
+                                 : Collada::create_bsdf(MaterialParams());
+  return new SceneObjects::Mesh(positions, normals, num_vertices,
+                                indices, 3 * num_triangles, bsdf, true);
+}
+
+/**
+ * Build the meshes of all polymesh nodes, several at a time.
+ * \param bboxes set to the world-space bounds of each mesh
+ */
+static vector<SceneObjects::Mesh *> load_polymeshes(
+    const vector<Collada::Node *>& nodes, vector<BBox> *bboxes) {
+  vector<SceneObjects::Mesh *> meshes(nodes.size());
+  bboxes->assign(nodes.size(), BBox());
+  if (nodes.empty()) return meshes;
+
+  ProfilePhase phase("Mesh build");
+  fprintf(stdout, "[PathTracer] Building %zu meshes... ", nodes.size());
+  fflush(stdout);
+  Timer timer;
+  timer.start();
+
+  parallel_for(nodes.size(), std::thread::hardware_concurrency(), [&](size_t i) {
+    const PolymeshInfo& info = static_cast<PolymeshInfo&>(*nodes[i]->instance);
+    meshes[i] = load_polymesh(info, nodes[i]->transform, &(*bboxes)[i]);
+  });
+
+  size_t num_triangles = 0;
+  for (size_t i = 0; i < meshes.size(); i++) {
+    num_triangles += meshes[i]->num_indices() / 3;
+  }
+  timer.stop();
+  fprintf(stdout, "Done! (%.4f sec, %zu triangles)\n", timer.duration(), num_triangles);
+  return meshes;
+}
+
+/**
+ * As in Application::init_sphere, the transform is assumed to scale
+ * uniformly.
+ */
+static SceneObjects::SphereObject *load_sphere(const SphereInfo& sphere,
+                                               const Matrix4x4& transform,
+                                               BBox *bbox) {
+  Vector3D position = (transform * Vector4D(0, 0, 0, 1)).projectTo3D();
+  double scale = (transform * Vector4D(1, 0, 0, 0)).to3D().norm();
+  double r = sphere.radius * scale;
+  bbox->expand(BBox(position - Vector3D(r, r, r), position + Vector3D(r, r, r)));
+
+  BSDF *bsdf = sphere.material ? sphere.material->bsdf
+                               : Collada::create_bsdf(MaterialParams());
+  return new SceneObjects::SphereObject(position, r, bsdf);
+}
+
+/**
+ * Index of material in the cache's materials, adding it if need be.
+ */
+static int32_t cache_material(SceneCache *cache,
+                              std::map<const MaterialInfo*, int32_t>& indices,
+                              const MaterialInfo *material) {
+  if (!material) return -1;
+  std::map<const MaterialInfo*, int32_t>::iterator it = indices.find(material);
+  if (it != indices.end()) return it->second;
+  cache->materials.push_back(material->params);
+  return indices[material] = cache->materials.size() - 1;
+}
+
+static CameraInfo default_camera() {
+  // as in Application::init
+  CameraInfo camera;
+  camera.hFov = 50;
+  camera.vFov = 35;
+  camera.nClip = 0.01;
+  camera.fClip = 100;
+  return camera;
+}
+
+/**
+ * Place the camera like the interactive viewer does: looking along c_dir at
+ * the center of the scene, far enough back to see all of it.
+ */
+static void place_camera(Camera *camera, const Vector3D& c_dir, const BBox& bbox) {
+  if (!camera || bbox.empty()) return;
+  Vector3D target = bbox.centroid();
+  double canonical_view_distance = bbox.extent.norm() / 2 * 1.5;
+  camera->place(target,
+                acos(c_dir.y),
+                atan2(c_dir.x, c_dir.z),
+                canonical_view_distance * 2,
+                canonical_view_distance / 10.0,
+                canonical_view_distance * 20.0);
+}
+
+SceneObjects::Scene *load_static_scene(Collada::SceneInfo *sceneInfo,
+                                       Camera *camera,
+                                       size_t screen_w, size_t screen_h,
+                                       SceneCache *cache) {
+  ProfilePhase phase("Static scene conversion");
+  vector<SceneObjects::SceneObject *> objects;
+  vector<SceneObjects::SceneLight *> lights;
+  BBox bbox;
+  std::map<const MaterialInfo*, int32_t> materials;
+
+  if (camera) camera->configure(default_camera(), screen_w, screen_h);
+  Vector3D c_dir;
+
+  // the meshes are built up front, in parallel
+  vector<Collada::Node *> mesh_nodes;
+  for (Collada::Node& node : sceneInfo->nodes) {
+    if (node.instance->type == Collada::Instance::POLYMESH) {
+      mesh_nodes.push_back(&node);
+    }
+  }
+  vector<BBox> mesh_bboxes;
+  vector<SceneObjects::Mesh *> meshes = load_polymeshes(mesh_nodes, &mesh_bboxes);
+  size_t next_mesh = 0;
+
+  for (Collada::Node& node : sceneInfo->nodes) {
+    Collada::Instance *instance = node.instance;
+    const Matrix4x4& transform = node.transform;
+
+    switch(instance->type) {
+      case Collada::Instance::CAMERA:
+      {
+        CameraInfo *c = static_cast<CameraInfo*>(instance);
+        c_dir = (transform * Vector4D(c->view_dir,1)).to3D().unit();
+        if (camera) camera->configure(*c, screen_w, screen_h);
+        if (cache) {
+          SceneCache::CameraParams& params = cache->camera;
+          params.present = 1;
+          params.hFov = c->hFov;
+          params.vFov = c->vFov;
+          params.nClip = c->nClip;
+          params.fClip = c->fClip;
+        }
+        break;
+      }
+      case Collada::Instance::LIGHT:
+      {
+        SceneCache::Light params =
+          light_params(static_cast<LightInfo&>(*instance), transform);
+        SceneObjects::SceneLight *light = create_light(params);
+        if (!light) break;
+        lights.push_back(light);
+        if (cache) cache->lights.push_back(params);
+        break;
+      }
+      case Collada::Instance::SPHERE:
+      {
+        const SphereInfo& info = static_cast<SphereInfo&>(*instance);
+        SceneObjects::SphereObject *sphere = load_sphere(info, transform, &bbox);
+        objects.push_back(sphere);
+        if (cache) {
+          SceneCache::Object object = SceneCache::Object();
+          object.type = SceneCache::Object::SPHERE;
+          object.material = cache_material(cache, materials, info.material);
+          object.center = sphere->o;
+          object.radius = sphere->r;
+          cache->objects.push_back(object);
+          cache->meshes.push_back(SceneCache::MeshArrays());
+        }
+        break;
+      }
+      case Collada::Instance::POLYMESH:
+      {
+        const PolymeshInfo& info = static_cast<PolymeshInfo&>(*instance);
+        SceneObjects::Mesh *mesh = meshes[next_mesh];
+        bbox.expand(mesh_bboxes[next_mesh++]);
+        objects.push_back(mesh);
+        if (cache) {
+          SceneCache::Object object = SceneCache::Object();
+          object.type = SceneCache::Object::MESH;
+          object.material = cache_material(cache, materials, info.material);
+          object.num_vertices = mesh->num_vertices();
+          object.num_indices = mesh->num_indices();
+          cache->objects.push_back(object);
+
+          SceneCache::MeshArrays arrays;
+          arrays.positions = mesh->positions;
+          arrays.normals = mesh->normals;
+          arrays.indices = const_cast<size_t*>(mesh->get_indices());
+          cache->meshes.push_back(arrays);
+        }
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+  if (cache) {
+    cache->camera.view_dir = c_dir;
+    cache->hasBounds = !bbox.empty();
+    cache->boundsMin = bbox.min;
+    cache->boundsMax = bbox.max;
+  }
+
+  // emissive objects are sampled as lights too
+  vector<SceneObjects::SceneLight *> emissiveLights =
+      SceneObjects::create_emissive_lights(objects, lights);
+  lights.insert(lights.end(), emissiveLights.begin(), emissiveLights.end());
+
+  place_camera(camera, c_dir, bbox);
+
+  return new SceneObjects::Scene(objects, lights);
+}
+
+SceneObjects::Scene *load_static_scene(const SceneCache& cache,
+                                       Camera *camera,
+                                       size_t screen_w, size_t screen_h) {
+  ProfilePhase phase("Static scene conversion");
+  vector<SceneObjects::SceneObject *> objects;
+  vector<SceneObjects::SceneLight *> lights;
+
+  if (camera) {
+    CameraInfo info = default_camera();
+    if (cache.camera.present) {
+      info.hFov = cache.camera.hFov;
+      info.vFov = cache.camera.vFov;
+      info.nClip = cache.camera.nClip;
+      info.fClip = cache.camera.fClip;
+    }
+    camera->configure(info, screen_w, screen_h);
+  }
+
+  // objects sharing a material share its BSDF, as they do when parsed
+  vector<BSDF *> bsdfs;
+  for (const MaterialParams& params : cache.materials) {
+    bsdfs.push_back(Collada::create_bsdf(params));
+  }
+
+  for (size_t i = 0; i < cache.objects.size(); ++i) {
+    const SceneCache::Object& object = cache.objects[i];
+    BSDF *bsdf = object.material >= 0 ? bsdfs[object.material]
+                                      : Collada::create_bsdf(MaterialParams());
+    if (object.type == SceneCache::Object::MESH) {
+      const SceneCache::MeshArrays& arrays = cache.meshes[i];
+      objects.push_back(new SceneObjects::Mesh(
+          arrays.positions, arrays.normals, object.num_vertices,
+          arrays.indices, object.num_indices, bsdf));
+    } else {
+      objects.push_back(new SceneObjects::SphereObject(object.center, object.radius, bsdf));
+    }
+  }
+
+  for (const SceneCache::Light& params : cache.lights) {
+    SceneObjects::SceneLight *light = create_light(params);
+    if (light) lights.push_back(light);
+  }
+
+  vector<SceneObjects::SceneLight *> emissiveLights =
+      SceneObjects::create_emissive_lights(objects, lights);
+  lights.insert(lights.end(), emissiveLights.begin(), emissiveLights.end());
+
+  BBox bbox;
+  if (cache.hasBounds) bbox = BBox(cache.boundsMin, cache.boundsMax);
+  place_camera(camera, cache.camera.view_dir, bbox);
+
+  return new SceneObjects::Scene(objects, lights);
+}
+
+} // namespace CGL
@@ -0,0 +1,37 @@
+#ifndef CGL_SCENE_LOADER_H
+#define CGL_SCENE_LOADER_H
+
+#include "scene/scene.h"
+#include "scene/scene_cache.h"
+#include "scene/collada/collada.h"
+#include "pathtracer/camera.h"
+
+namespace CGL {
+
+/**
+ * Build the raytracing scene straight from a parsed Collada scene, without
+ * going through the OpenGL scene used for editing: meshes are triangulated
+ * into vertex and index buffers directly rather than through HalfedgeMesh,
+ * otherwise the conversion is that of GLScene::Scene::get_static_scene.
+ *
+ * \param camera if not NULL, configured for a screen_w x screen_h image and
+ *               placed like the interactive viewer places its camera
+ * \param cache  if not NULL, filled with what the scene was built from, to be
+ *               saved while the scene is alive
+ */
+SceneObjects::Scene *load_static_scene(Collada::SceneInfo *sceneInfo,
+                                       Camera *camera,
+                                       size_t screen_w, size_t screen_h,
+                                       SceneCache *cache = NULL);
+
+/**
+ * Build the same scene from a loaded scene cache. Its meshes use the
+ * cache's arrays, so the cache must outlive the scene.
+ */
+SceneObjects::Scene *load_static_scene(const SceneCache& cache,
+                                       Camera *camera,
+                                       size_t screen_w, size_t screen_h);
+
+} // namespace CGL
+
+#endif // CGL_SCENE_LOADER_H
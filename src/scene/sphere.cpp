@@ -44,7 +44,9 @@ bool Sphere::intersect(const Ray &r, Intersection *i) const {
 }
 
 void Sphere::draw(const Color &c, float alpha) const {
+#ifndef CGL_HEADLESS
   Misc::draw_sphere_opengl(o, r, c);
+#endif
 }
 
 void Sphere::drawOutline(const Color &c, float alpha) const {
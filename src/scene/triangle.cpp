@@ -1,7 +1,9 @@
 #include "triangle.h"
 
 #include "CGL/CGL.h"
+#ifndef CGL_HEADLESS
 #include "GL/glew.h"
+#endif
 
 namespace CGL {
 namespace SceneObjects {
@@ -45,21 +47,25 @@ bool Triangle::intersect(const Ray &r, Intersection *isect) const {
 }
 
 void Triangle::draw(const Color &c, float alpha) const {
+#ifndef CGL_HEADLESS
   glColor4f(c.r, c.g, c.b, alpha);
   glBegin(GL_TRIANGLES);
   glVertex3d(p1.x, p1.y, p1.z);
   glVertex3d(p2.x, p2.y, p2.z);
   glVertex3d(p3.x, p3.y, p3.z);
   glEnd();
+#endif
 }
 
 void Triangle::drawOutline(const Color &c, float alpha) const {
+#ifndef CGL_HEADLESS
   glColor4f(c.r, c.g, c.b, alpha);
   glBegin(GL_LINE_LOOP);
   glVertex3d(p1.x, p1.y, p1.z);
   glVertex3d(p2.x, p2.y, p2.z);
   glVertex3d(p3.x, p3.y, p3.z);
   glEnd();
+#endif
 }
 
 } // namespace SceneObjects
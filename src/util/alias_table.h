@@ -0,0 +1,115 @@
+#ifndef CGL_ALIAS_TABLE_H
+#define CGL_ALIAS_TABLE_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+namespace CGL {
+
+/**
+ * Walker alias table for drawing samples from a discrete distribution in O(1).
+ * Each of the n slots holds a threshold q and an alias: a sample picks a slot
+ * uniformly and returns the slot itself if the leftover of the random number is
+ * below q, and the alias otherwise. Built in O(n) with Vose's method.
+ *
+ * The table does not keep the probabilities themselves; callers already hold
+ * the weights and can evaluate pmf(i) = weight[i] / sum.
+ */
+class AliasTable {
+ public:
+
+  struct Entry {
+    float q;         ///< probability of keeping the slot
+    uint32_t alias;  ///< slot returned otherwise
+  };
+
+  AliasTable() { }
+
+  /**
+   * Build the table from n non-negative weights.
+   * If all weights are zero, the table samples uniformly.
+   * \return the sum of the weights
+   */
+  double build(const double* weights, size_t n) {
+    entries.resize(n);
+    if (n == 0) return 0;
+
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i) sum += weights[i];
+
+    if (sum <= 0) {
+      for (size_t i = 0; i < n; ++i) {
+        entries[i].q = 1;
+        entries[i].alias = i;
+      }
+      return sum;
+    }
+
+    // scaled probabilities average to 1; partition into under and over full
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> small, large;
+    small.reserve(n);
+    large.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+      scaled[i] = weights[i] * n / sum;
+      if (scaled[i] < 1) small.push_back(i);
+      else large.push_back(i);
+    }
+
+    while (!small.empty() && !large.empty()) {
+      uint32_t s = small.back(); small.pop_back();
+      uint32_t l = large.back(); large.pop_back();
+      entries[s].q = scaled[s];
+      entries[s].alias = l;
+      scaled[l] = (scaled[l] + scaled[s]) - 1;
+      if (scaled[l] < 1) small.push_back(l);
+      else large.push_back(l);
+    }
+
+    // whatever is left is full up to round-off
+    for (size_t i = 0; i < large.size(); ++i) {
+      entries[large[i]].q = 1;
+      entries[large[i]].alias = large[i];
+    }
+    for (size_t i = 0; i < small.size(); ++i) {
+      entries[small[i]].q = 1;
+      entries[small[i]].alias = small[i];
+    }
+
+    return sum;
+  }
+
+  /**
+   * Draw a slot index using a uniform random number u in [0, 1).
+   */
+  size_t sample(double u) const {
+    size_t n = entries.size();
+    double scaled = u * n;
+    size_t i = std::min(size_t(scaled), n - 1);
+    return (scaled - i) < entries[i].q ? i : entries[i].alias;
+  }
+
+  size_t size() const { return entries.size(); }
+
+  /**
+   * Whether every threshold is in [0, 1] and every alias a slot of the
+   * table, so that sample() stays in range. For tables read from a file.
+   */
+  bool is_valid() const {
+    for (size_t i = 0; i < entries.size(); ++i) {
+      const Entry& e = entries[i];
+      if (!(e.q >= 0 && e.q <= 1) || e.alias >= entries.size()) return false;
+    }
+    return true;
+  }
+
+  bool empty() const { return entries.empty(); }
+
+  std::vector<Entry> entries;  ///< one entry per slot
+
+}; // class AliasTable
+
+} // namespace CGL
+
+#endif // CGL_ALIAS_TABLE_H
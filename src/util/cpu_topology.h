@@ -0,0 +1,116 @@
+#ifndef __CPU_TOPOLOGY_H__
+#define __CPU_TOPOLOGY_H__
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#endif
+
+/**
+ * CPUs this process may run on, grouped by NUMA node. Read from sysfs on
+ * Linux and restricted to the process' affinity mask, so it respects
+ * taskset and container CPU limits. Elsewhere, one node with
+ * hardware_concurrency() CPUs.
+ */
+struct CPUTopology {
+
+  std::vector<std::vector<int> > nodes;  ///< CPU ids of each NUMA node
+
+  size_t num_cpus() const {
+    size_t n = 0;
+    for (size_t i = 0; i < nodes.size(); ++i) n += nodes[i].size();
+    return n;
+  }
+
+  static CPUTopology detect() {
+    CPUTopology topology;
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool have_mask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    for (int node = 0; ; ++node) {
+      char path[64];
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+      FILE* file = fopen(path, "r");
+      if (!file) break;
+      char line[4096] = "";
+      if (!fgets(line, sizeof(line), file)) line[0] = 0;
+      fclose(file);
+
+      std::vector<int> cpus;
+      std::vector<int> listed = parse_cpu_list(line);
+      for (size_t i = 0; i < listed.size(); ++i) {
+        if (!have_mask || (listed[i] < CPU_SETSIZE && CPU_ISSET(listed[i], &allowed))) {
+          cpus.push_back(listed[i]);
+        }
+      }
+      if (!cpus.empty()) topology.nodes.push_back(cpus);
+    }
+
+    // no sysfs node information, e.g. NUMA disabled in the kernel
+    if (topology.nodes.empty() && have_mask) {
+      std::vector<int> cpus;
+      for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+      }
+      if (!cpus.empty()) topology.nodes.push_back(cpus);
+    }
+#endif
+    if (topology.nodes.empty()) {
+      std::vector<int> cpus(std::max(std::thread::hardware_concurrency(), 1u));
+      for (size_t i = 0; i < cpus.size(); ++i) cpus[i] = (int) i;
+      topology.nodes.push_back(cpus);
+    }
+    return topology;
+  }
+
+  /**
+   * Parse a sysfs CPU list such as "0-7,16-23".
+   */
+  static std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    const char* p = list.c_str();
+    while (*p) {
+      char* end;
+      long first = strtol(p, &end, 10);
+      if (end == p) break;
+      long last = first;
+      p = end;
+      if (*p == '-') {
+        last = strtol(p + 1, &end, 10);
+        p = end;
+      }
+      for (long cpu = first; cpu <= last; ++cpu) cpus.push_back((int) cpu);
+      if (*p == ',') ++p;
+    }
+    return cpus;
+  }
+};
+
+/**
+ * Restrict the calling thread to the given CPUs.
+ * \return false if pinning is not supported or failed
+ */
+inline bool pin_current_thread(const std::vector<int>& cpus) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (size_t i = 0; i < cpus.size(); ++i) {
+    if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE) CPU_SET(cpus[i], &set);
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void) cpus;
+  return false;
+#endif
+}
+
+#endif  // __CPU_TOPOLOGY_H__
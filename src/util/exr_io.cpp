@@ -0,0 +1,506 @@
+#include "exr_io.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+
+// ahead of tinyexr, whose miniz includes sys/stat.h inside its namespace
+#include "util/mapped_file.h"
+
+#define TINYEXR_IMPLEMENTATION
+#include "CGL/tinyexr.h"
+
+#include "util/parallel_for.h"
+#include "util/startup_profiler.h"
+
+namespace CGL {
+
+// exr files are little endian throughout
+static uint32_t read_u32(const unsigned char* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint64_t read_u64(const unsigned char* p) {
+  return read_u32(p) | ((uint64_t) read_u32(p + 4) << 32);
+}
+
+/**
+ * What load_envmap needs of a scanline exr header.
+ */
+struct EXRLayout {
+  std::vector<std::string> channel_names;  ///< in file order, i.e. sorted
+  std::vector<int> pixel_types;            ///< TINYEXR_PIXELTYPE_*
+  bool subsampled;                         ///< a channel has x or y sampling
+  int compression;
+  int x0, y0, x1, y1;                      ///< data window, inclusive
+  const unsigned char* offsets;            ///< the block offset table
+};
+
+static bool parse_exr_header(const unsigned char* data, size_t size,
+                             EXRLayout* layout) {
+  const unsigned char magic[4] = { 0x76, 0x2f, 0x31, 0x01 };
+  if (size < 8 || memcmp(data, magic, 4) != 0) return false;
+
+  // single part scanline images only, not tiled, deep or multipart
+  uint32_t version = read_u32(data + 4);
+  if ((version & 0xff) != 2 || (version & 0x1a00)) return false;
+
+  layout->subsampled = false;
+  layout->compression = -1;
+  layout->x0 = layout->y0 = 0;
+  layout->x1 = layout->y1 = -1;
+
+  const unsigned char* p = data + 8;
+  const unsigned char* end = data + size;
+  while (true) {
+    if (p == end) return false;
+    if (*p == 0) break;
+    const char* name = (const char*) p;
+    p = (const unsigned char*) memchr(p, 0, end - p);
+    if (!p) return false;
+    p = (const unsigned char*) memchr(p + 1, 0, end - p - 1);  // type
+    if (!p || end - ++p < 4) return false;
+    uint32_t length = read_u32(p);
+    p += 4;
+    if (length > (size_t) (end - p)) return false;
+    const unsigned char* value = p;
+    const unsigned char* value_end = p + length;
+    p = value_end;
+
+    if (strcmp(name, "channels") == 0) {
+      while (value < value_end && *value) {
+        const unsigned char* name_end =
+            (const unsigned char*) memchr(value, 0, value_end - value);
+        if (!name_end || value_end - name_end < 17) return false;
+        layout->channel_names.push_back(std::string((const char*) value,
+                                                    (const char*) name_end));
+        layout->pixel_types.push_back(read_u32(name_end + 1));
+        if (read_u32(name_end + 9) != 1 || read_u32(name_end + 13) != 1) {
+          layout->subsampled = true;
+        }
+        value = name_end + 17;
+      }
+    } else if (strcmp(name, "compression") == 0 && length >= 1) {
+      layout->compression = value[0];
+    } else if (strcmp(name, "dataWindow") == 0 && length >= 16) {
+      layout->x0 = (int32_t) read_u32(value);
+      layout->y0 = (int32_t) read_u32(value + 4);
+      layout->x1 = (int32_t) read_u32(value + 8);
+      layout->y1 = (int32_t) read_u32(value + 12);
+    }
+  }
+
+  layout->offsets = p + 1;
+  return !layout->channel_names.empty() &&
+         layout->x1 >= layout->x0 && layout->y1 >= layout->y0;
+}
+
+/**
+ * Where the channels go in an RGB pixel, -1 for channels that are not
+ * used. \return false if there is no R, G or B channel
+ */
+static bool rgb_components(const std::vector<std::string>& names,
+                           std::vector<int>& components) {
+  components.assign(names.size(), -1);
+  bool found[3] = { false, false, false };
+  for (size_t c = 0; c < names.size(); ++c) {
+    for (int i = 0; i < 3; ++i) {
+      if (names[c] == std::string(1, "RGB"[i])) {
+        components[c] = i;
+        found[i] = true;
+      }
+    }
+  }
+  return found[0] && found[1] && found[2];
+}
+
+/**
+ * Undo RLE or deflate compression of a block, including the byte
+ * predictor and the split into even and odd bytes both are applied after.
+ */
+static bool decompress_block(int compression, const unsigned char* src,
+                             size_t size, unsigned char* dst, size_t expected,
+                             std::vector<unsigned char>& scratch) {
+  scratch.resize(expected);
+  unsigned char* t = scratch.data();
+
+  if (compression == EXRWriteOptions::ZIPS || compression == EXRWriteOptions::ZIP) {
+    miniz::mz_ulong length = expected;
+    if (miniz::mz_uncompress(t, &length, src, size) != miniz::MZ_OK ||
+        length != expected) {
+      return false;
+    }
+  } else {
+    // runs: a negative count n is followed by -n literal bytes, a
+    // non-negative count n by one byte repeated n + 1 times
+    const unsigned char* end = src + size;
+    size_t n = 0;
+    while (src < end) {
+      int count = (signed char) *src++;
+      if (count < 0) {
+        count = -count;
+        if (end - src < count || expected - n < (size_t) count) return false;
+        memcpy(t + n, src, count);
+        src += count;
+        n += count;
+      } else {
+        if (src == end || expected - n < (size_t) count + 1) return false;
+        memset(t + n, *src++, count + 1);
+        n += count + 1;
+      }
+    }
+    if (n != expected) return false;
+  }
+
+  for (size_t i = 1; i < expected; ++i) t[i] = t[i - 1] + t[i] - 128;
+  const unsigned char* even = t;
+  const unsigned char* odd = t + (expected + 1) / 2;
+  for (size_t i = 0; i < expected; ++i) dst[i] = i & 1 ? *odd++ : *even++;
+  return true;
+}
+
+/**
+ * Copy one scanline, the channels one after another, into row y.
+ */
+static void convert_scanline(const unsigned char* line, const EXRLayout& layout,
+                             const std::vector<int>& components,
+                             EnvironmentMap* envmap, size_t y) {
+  size_t w = envmap->w;
+  for (size_t c = 0; c < components.size(); ++c) {
+    int type = layout.pixel_types[c];
+    size_t bytes = type == TINYEXR_PIXELTYPE_HALF ? 2 : 4;
+    if (components[c] >= 0) {
+      float* out = &envmap->rgb[3 * y * w + components[c]];
+      for (size_t x = 0; x < w; ++x) {
+        const unsigned char* v = line + bytes * x;
+        if (type == TINYEXR_PIXELTYPE_HALF) {
+          FP16 half;
+          half.u = v[0] | (v[1] << 8);
+          out[3 * x] = half_to_float(half).f;
+        } else if (type == TINYEXR_PIXELTYPE_FLOAT) {
+          uint32_t bits = read_u32(v);
+          memcpy(&out[3 * x], &bits, sizeof(float));
+        } else {
+          out[3 * x] = (float) read_u32(v);
+        }
+      }
+    }
+    line += bytes * w;
+  }
+}
+
+/**
+ * Anything load_envmap does not decode itself, e.g. PIZ compression,
+ * goes through tinyexr.
+ */
+static EnvironmentMap *load_envmap_tinyexr(const unsigned char* data,
+                                           const char* file_path) {
+  const char *err = "";
+  EXRImage exr;
+  InitEXRImage(&exr);
+  if (ParseMultiChannelEXRHeaderFromMemory(&exr, data, &err) != 0) {
+    fprintf(stderr, "[PathTracer] Error parsing OpenEXR file %s: %s\n", file_path, err);
+    return NULL;
+  }
+  for (int i = 0; i < exr.num_channels; i++) {
+    if (exr.pixel_types[i] == TINYEXR_PIXELTYPE_HALF) {
+      exr.requested_pixel_types[i] = TINYEXR_PIXELTYPE_FLOAT;
+    }
+  }
+  if (LoadMultiChannelEXRFromMemory(&exr, data, &err) != 0) {
+    fprintf(stderr, "[PathTracer] Error loading OpenEXR file %s: %s\n", file_path, err);
+    FreeEXRImage(&exr);
+    return NULL;
+  }
+
+  std::vector<std::string> names(exr.channel_names, exr.channel_names + exr.num_channels);
+  std::vector<int> components;
+  if (!rgb_components(names, components)) {
+    fprintf(stderr, "[PathTracer] OpenEXR file %s has no R, G and B channels\n", file_path);
+    FreeEXRImage(&exr);
+    return NULL;
+  }
+
+  EnvironmentMap *envmap = new EnvironmentMap();
+  envmap->resize(exr.width, exr.height);
+  size_t pixels = envmap->w * envmap->h;
+  for (int c = 0; c < exr.num_channels; ++c) {
+    if (components[c] < 0) continue;
+    float* out = &envmap->rgb[components[c]];
+    for (size_t i = 0; i < pixels; ++i) {
+      out[3 * i] = exr.pixel_types[c] == TINYEXR_PIXELTYPE_UINT
+                   ? (float) ((unsigned int*) exr.images[c])[i]
+                   : ((float*) exr.images[c])[i];
+    }
+  }
+  envmap->compute_weights(0, envmap->h);
+
+  FreeEXRImage(&exr);
+  return envmap;
+}
+
+EnvironmentMap *load_envmap(const char *file_path) {
+
+  ProfilePhase phase("EXR load");
+
+  // blocks are read straight from the mapping, with no copy of the file
+  MappedFile file;
+  if (!file.open(file_path)) {
+    fprintf(stderr, "[PathTracer] Cannot open OpenEXR file %s\n", file_path);
+    return NULL;
+  }
+  const unsigned char* data = (const unsigned char*) file.data();
+  size_t size = file.size();
+
+  EXRLayout layout;
+  if (!parse_exr_header(data, size, &layout)) {
+    fprintf(stderr, "[PathTracer] Error parsing OpenEXR file %s: not a "
+                    "scanline image\n", file_path);
+    return NULL;
+  }
+  if (layout.subsampled) {
+    fprintf(stderr, "[PathTracer] OpenEXR file %s has subsampled channels, "
+                    "which are not supported\n", file_path);
+    return NULL;
+  }
+  if (layout.compression < EXRWriteOptions::NONE ||
+      layout.compression > EXRWriteOptions::ZIP) {
+    return load_envmap_tinyexr(data, file_path);
+  }
+
+  std::vector<int> components;
+  if (!rgb_components(layout.channel_names, components)) {
+    fprintf(stderr, "[PathTracer] OpenEXR file %s has no R, G and B channels\n", file_path);
+    return NULL;
+  }
+
+  size_t w = layout.x1 - layout.x0 + 1;
+  size_t h = layout.y1 - layout.y0 + 1;
+  size_t bytes_per_line = 0;
+  for (size_t c = 0; c < layout.pixel_types.size(); ++c) {
+    bytes_per_line += (layout.pixel_types[c] == TINYEXR_PIXELTYPE_HALF ? 2 : 4) * w;
+  }
+  size_t lines_per_block = layout.compression == EXRWriteOptions::ZIP ? 16 : 1;
+  size_t num_blocks = (h + lines_per_block - 1) / lines_per_block;
+  if ((size_t) (data + size - layout.offsets) / 8 < num_blocks) {
+    fprintf(stderr, "[PathTracer] OpenEXR file %s is truncated\n", file_path);
+    return NULL;
+  }
+
+  EnvironmentMap *envmap = new EnvironmentMap();
+  envmap->resize(w, h);
+
+  // decode the blocks in parallel, each into its own rows, and weigh the
+  // rows for importance sampling while they are still in cache
+  size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::vector<unsigned char> > raws(parallel_threads(num_blocks, num_threads));
+  std::vector<std::vector<unsigned char> > scratches(raws.size());
+  std::atomic<bool> failed(false);
+  parallel_for_slots(num_blocks, num_threads, [&](size_t b, size_t slot) {
+    if (failed) return;
+    std::vector<unsigned char>& raw = raws[slot];
+    std::vector<unsigned char>& scratch = scratches[slot];
+    uint64_t offset = read_u64(layout.offsets + 8 * b);
+    if (offset > size || size - offset < 8) {
+      failed = true;
+      return;
+    }
+    const unsigned char* block = data + offset;
+    int64_t line = (int32_t) read_u32(block) - (int64_t) layout.y0;
+    uint64_t length = read_u32(block + 4);
+    if (line < 0 || line >= (int64_t) h || line % lines_per_block != 0 ||
+        length > size - offset - 8) {
+      failed = true;
+      return;
+    }
+    size_t y = line;
+
+    // blocks that did not shrink are stored uncompressed
+    size_t lines = std::min(lines_per_block, h - y);
+    size_t expected = lines * bytes_per_line;
+    const unsigned char* pixels = block + 8;
+    if (length < expected && layout.compression != EXRWriteOptions::NONE) {
+      raw.resize(expected);
+      if (!decompress_block(layout.compression, pixels, length,
+                            raw.data(), expected, scratch)) {
+        failed = true;
+        return;
+      }
+      pixels = raw.data();
+    } else if (length != expected) {
+      failed = true;
+      return;
+    }
+
+    for (size_t l = 0; l < lines; ++l) {
+      convert_scanline(pixels + l * bytes_per_line, layout, components, envmap, y + l);
+    }
+    envmap->compute_weights(y, y + lines);
+  });
+
+  if (failed) {
+    fprintf(stderr, "[PathTracer] OpenEXR file %s is corrupt\n", file_path);
+    delete envmap;
+    return NULL;
+  }
+  return envmap;
+}
+
+static void append_u32(std::vector<unsigned char>& out, uint32_t v) {
+  for (int i = 0; i < 4; ++i) out.push_back((v >> (8 * i)) & 0xff);
+}
+
+static void append_u64(std::vector<unsigned char>& out, uint64_t v) {
+  for (int i = 0; i < 8; ++i) out.push_back((v >> (8 * i)) & 0xff);
+}
+
+static void append_float(std::vector<unsigned char>& out, float f) {
+  uint32_t v;
+  memcpy(&v, &f, sizeof(v));
+  append_u32(out, v);
+}
+
+static void append_attribute(std::vector<unsigned char>& out,
+                             const char* name, const char* type,
+                             const std::vector<unsigned char>& value) {
+  out.insert(out.end(), name, name + strlen(name) + 1);
+  out.insert(out.end(), type, type + strlen(type) + 1);
+  append_u32(out, value.size());
+  out.insert(out.end(), value.begin(), value.end());
+}
+
+/**
+ * Pixels of scanlines [y0, y1) as stored in a block: each scanline holds
+ * the channels one after another.
+ */
+static void pack_scanlines(const std::vector<const EXRChannel*>& channels, size_t w,
+                           size_t y0, size_t y1, std::vector<unsigned char>& out) {
+  out.clear();
+  for (size_t y = y0; y < y1; ++y) {
+    for (size_t c = 0; c < channels.size(); ++c) {
+      const float* row = &channels[c]->data[y * w];
+      if (!channels[c]->half) {
+        for (size_t x = 0; x < w; ++x) append_float(out, row[x]);
+        continue;
+      }
+      for (size_t x = 0; x < w; ++x) {
+        FP32 f;
+        f.f = row[x];
+        uint16_t v = float_to_half_full(f).u;
+        out.push_back(v & 0xff);
+        out.push_back(v >> 8);
+      }
+    }
+  }
+}
+
+bool save_exr(const std::string& filename, const std::vector<EXRChannel>& unsorted,
+              size_t w, size_t h, const EXRWriteOptions& options) {
+  // the file lists the channels by name; sort pointers, not the pixels
+  std::vector<const EXRChannel*> channels(unsorted.size());
+  for (size_t c = 0; c < unsorted.size(); ++c) channels[c] = &unsorted[c];
+  std::sort(channels.begin(), channels.end(),
+            [](const EXRChannel* a, const EXRChannel* b) { return *a < *b; });
+
+  std::vector<unsigned char> header;
+  const unsigned char magic[8] = { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 };
+  header.insert(header.end(), magic, magic + 8);
+
+  std::vector<unsigned char> value;
+  for (size_t c = 0; c < channels.size(); ++c) {
+    const std::string& name = channels[c]->name;
+    value.insert(value.end(), name.begin(), name.end());
+    value.push_back(0);
+    append_u32(value, channels[c]->half ? TINYEXR_PIXELTYPE_HALF
+                                       : TINYEXR_PIXELTYPE_FLOAT);
+    append_u32(value, 0);  // pLinear and reserved
+    append_u32(value, 1);  // x sampling
+    append_u32(value, 1);  // y sampling
+  }
+  value.push_back(0);
+  append_attribute(header, "channels", "chlist", value);
+
+  value.assign(1, (unsigned char) options.compression);
+  append_attribute(header, "compression", "compression", value);
+
+  value.clear();
+  append_u32(value, 0);
+  append_u32(value, 0);
+  append_u32(value, w - 1);
+  append_u32(value, h - 1);
+  append_attribute(header, "dataWindow", "box2i", value);
+  append_attribute(header, "displayWindow", "box2i", value);
+
+  value.assign(1, 0);  // increasing y
+  append_attribute(header, "lineOrder", "lineOrder", value);
+
+  value.clear();
+  append_float(value, 1);
+  append_attribute(header, "pixelAspectRatio", "float", value);
+
+  value.clear();
+  append_float(value, 0);
+  append_float(value, 0);
+  append_attribute(header, "screenWindowCenter", "v2f", value);
+
+  value.clear();
+  append_float(value, 1);
+  append_attribute(header, "screenWindowWidth", "float", value);
+  header.push_back(0);
+
+  size_t lines_per_block = options.compression == EXRWriteOptions::ZIP ? 16 : 1;
+  size_t num_blocks = (h + lines_per_block - 1) / lines_per_block;
+
+  // compress the blocks in parallel, each into its own buffer
+  std::vector<std::vector<unsigned char> > blocks(num_blocks);
+  std::vector<std::vector<unsigned char> > raws(parallel_threads(num_blocks, options.num_threads));
+  std::vector<std::vector<unsigned char> > packs(raws.size());
+  parallel_for_slots(num_blocks, options.num_threads, [&](size_t b, size_t slot) {
+    std::vector<unsigned char>& raw = raws[slot];
+    std::vector<unsigned char>& packed = packs[slot];
+    size_t y0 = b * lines_per_block;
+    pack_scanlines(channels, w, y0, std::min(y0 + lines_per_block, h), raw);
+
+    std::vector<unsigned char>& block = blocks[b];
+    append_u32(block, y0);
+    if (options.compression != EXRWriteOptions::NONE) {
+      packed.resize(miniz::mz_compressBound(raw.size()));
+      unsigned long long size = 0;
+      CompressZip(packed.data(), size, raw.data(), raw.size());
+      // blocks that do not shrink are stored as they are
+      if (size < raw.size()) {
+        append_u32(block, size);
+        block.insert(block.end(), packed.begin(), packed.begin() + size);
+        return;
+      }
+    }
+    append_u32(block, raw.size());
+    block.insert(block.end(), raw.begin(), raw.end());
+  });
+
+  // the offset table points at each block from the start of the file
+  uint64_t offset = header.size() + 8 * num_blocks;
+  for (size_t b = 0; b < num_blocks; ++b) {
+    append_u64(header, offset);
+    offset += blocks[b].size();
+  }
+
+  FILE* file = fopen(filename.c_str(), "wb");
+  if (!file) {
+    fprintf(stderr, "Failed! (cannot open %s)\n", filename.c_str());
+    return false;
+  }
+  bool ok = fwrite(header.data(), 1, header.size(), file) == header.size();
+  for (size_t b = 0; ok && b < num_blocks; ++b) {
+    ok = fwrite(blocks[b].data(), 1, blocks[b].size(), file) == blocks[b].size();
+  }
+  ok = fclose(file) == 0 && ok;
+  if (!ok) fprintf(stderr, "Failed! (error writing %s)\n", filename.c_str());
+  return ok;
+}
+
+} // namespace CGL
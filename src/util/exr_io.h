@@ -0,0 +1,62 @@
+#ifndef CGL_EXR_IO_H
+#define CGL_EXR_IO_H
+
+#include <string>
+#include <vector>
+
+#include "util/image.h"
+
+namespace CGL {
+
+/**
+ * One channel of an image to save, e.g. "R" or "depth.Z".
+ */
+struct EXRChannel {
+  EXRChannel(const std::string& name, size_t size, bool half = false)
+    : name(name), data(size), half(half) { }
+
+  bool operator<(const EXRChannel& other) const { return name < other.name; }
+
+  std::string name;
+  std::vector<float> data;  ///< w x h values, top row first
+  bool half;                ///< store as 16 bit float instead of 32 bit
+};
+
+/**
+ * How save_exr writes the pixels.
+ */
+struct EXRWriteOptions {
+  enum Compression {
+    NONE = 0,
+    ZIPS = 2,  ///< deflate, one scanline per block
+    ZIP = 3    ///< deflate, 16 scanlines per block
+  };
+
+  EXRWriteOptions() : compression(ZIP), num_threads(1) { }
+
+  Compression compression;
+  size_t num_threads;  ///< threads compressing scanline blocks
+};
+
+/**
+ * Load an RGB OpenEXR image as an environment map. Scanline files that
+ * are uncompressed or RLE or ZIP compressed are decoded straight from a
+ * mapping of the file, a block per thread at a time, computing the
+ * sampling weights of the rows as they are decoded. Other files are
+ * loaded through tinyexr.
+ * \return the map, or NULL (after printing why) if it cannot be loaded
+ */
+EnvironmentMap *load_envmap(const char *file_path);
+
+/**
+ * Save w x h channels to a scanline OpenEXR file. The file lists them
+ * sorted by name, as exr readers expect; channels keeps its order.
+ * \return false (after printing why) if the file cannot be written
+ */
+bool save_exr(const std::string& filename, const std::vector<EXRChannel>& channels,
+              size_t w, size_t h,
+              const EXRWriteOptions& options = EXRWriteOptions());
+
+} // namespace CGL
+
+#endif // CGL_EXR_IO_H
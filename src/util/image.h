@@ -216,6 +216,47 @@ struct HDRImageBuffer {
 
 }; // class HDRImageBuffer
 
+/**
+ * Environment map in linear float RGB, together with the importance
+ * sampling weight of each pixel: its luminance times sin(theta) of its
+ * row, the pixel's share of the sphere. The weights are filled in as the
+ * rows are loaded, so the environment light can build its sampling
+ * tables without touching the pixels again.
+ */
+struct EnvironmentMap {
+
+  EnvironmentMap() : w(0), h(0) { }
+
+  void resize(size_t w, size_t h) {
+    this->w = w;
+    this->h = h;
+    rgb.assign(3 * w * h, 0.f);
+    weights.assign(w * h, 0.);
+  }
+
+  Vector3D pixel(size_t i) const {
+    return Vector3D(rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2]);
+  }
+
+  /**
+   * Compute the weights of rows [y0, y1) from their pixels.
+   */
+  void compute_weights(size_t y0, size_t y1) {
+    for (size_t y = y0; y < y1; ++y) {
+      double sin_theta = sin(PI * (y + .5) / h);
+      for (size_t i = y * w; i < (y + 1) * w; ++i) {
+        weights[i] = pixel(i).illum() * sin_theta;
+      }
+    }
+  }
+
+  size_t w; ///< width
+  size_t h; ///< height
+  std::vector<float> rgb;       ///< w x h RGB triples, top row first
+  std::vector<double> weights;  ///< w x h importance sampling weights
+
+}; // struct EnvironmentMap
+
 
 } // namespace CGL
 
@@ -0,0 +1,97 @@
+#ifndef __MAPPED_FILE_H__
+#define __MAPPED_FILE_H__
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/**
+ * A whole file mapped into memory. Pages are read in as they are touched
+ * and can be dropped again by the OS, so large files cost address space
+ * rather than resident memory. The mapping is private: with writable set
+ * the contents may be modified in memory, never on disk. Where mmap is
+ * unavailable the file is read into a heap buffer instead.
+ */
+class MappedFile {
+ public:
+
+  MappedFile() : bytes(NULL), length(0) { }
+  ~MappedFile() { close(); }
+
+  /**
+   * \return false if the file cannot be opened, is empty or cannot be mapped
+   */
+  bool open(const std::string& path, bool writable = false) {
+    close();
+#ifdef _WIN32
+    (void) writable;
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+    fseek(file, 0, SEEK_END);
+    long end = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (end > 0 && (bytes = (char*) malloc(end))) {
+      length = end;
+      if (fread(bytes, 1, length, file) != length) close();
+    }
+    fclose(file);
+    return bytes != NULL;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+      ::close(fd);
+      return false;
+    }
+    int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void* p = mmap(NULL, st.st_size, prot, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return false;
+    bytes = (char*) p;
+    length = st.st_size;
+    return true;
+#endif
+  }
+
+  void close() {
+    if (!bytes) return;
+#ifdef _WIN32
+    free(bytes);
+#else
+    munmap(bytes, length);
+#endif
+    bytes = NULL;
+    length = 0;
+  }
+
+  /**
+   * Tell the OS the file will be read front to back, so it reads ahead.
+   */
+  void advise_sequential() const {
+#if !defined(_WIN32) && defined(MADV_SEQUENTIAL)
+    if (bytes) madvise(bytes, length, MADV_SEQUENTIAL);
+#endif
+  }
+
+  char* data() const { return bytes; }
+  size_t size() const { return length; }
+
+ private:
+
+  // not copyable
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+
+  char* bytes;
+  size_t length;
+};
+
+#endif  // __MAPPED_FILE_H__
@@ -0,0 +1,61 @@
+#ifndef __PARALLEL_FOR_H__
+#define __PARALLEL_FOR_H__
+
+#include <atomic>
+#include <future>
+#include <algorithm>
+
+#include "util/thread_pool.h"
+
+namespace CGL {
+
+/**
+ * Number of threads parallel_for runs count items on, given up to
+ * num_threads: the calling thread and workers of ThreadPool::shared().
+ * Calls from a shared worker run on that worker alone.
+ */
+inline size_t parallel_threads(size_t count, size_t num_threads) {
+  ThreadPool& pool = ThreadPool::shared();
+  if (pool.is_worker()) return std::min(count, (size_t) 1);
+  num_threads = std::min(std::max(num_threads, (size_t) 1), pool.size() + 1);
+  return std::min(num_threads, count);
+}
+
+/**
+ * Run body(i, slot) for every i in [0, count), on parallel_threads(count,
+ * num_threads) threads that take the next item as they finish one, so
+ * items of uneven cost balance. slot is below parallel_threads() and no
+ * two threads share one, for per thread scratch buffers. Returns once
+ * every item is done.
+ */
+template <typename F>
+void parallel_for_slots(size_t count, size_t num_threads, const F& body) {
+  size_t threads = parallel_threads(count, num_threads);
+  std::atomic<size_t> next(0);
+  auto run_items = [&](size_t slot) {
+    size_t i;
+    while ((i = next++) < count) body(i, slot);
+  };
+  if (threads <= 1) {
+    run_items(0);
+    return;
+  }
+
+  std::future<void> helpers = ThreadPool::shared().run([&](size_t worker_id) {
+    if (worker_id + 1 < threads) run_items(worker_id + 1);
+  });
+  run_items(0);
+  helpers.wait();
+}
+
+/**
+ * Run body(i) for every i in [0, count), as parallel_for_slots.
+ */
+template <typename F>
+void parallel_for(size_t count, size_t num_threads, const F& body) {
+  parallel_for_slots(count, num_threads, [&](size_t i, size_t) { body(i); });
+}
+
+} // namespace CGL
+
+#endif  // __PARALLEL_FOR_H__
@@ -2,23 +2,38 @@
 #define CGL_RANDOMUTIL_H
 
 #include <random>
+#include <cstdint>
 
 // #define XORSHIFT_RAND
 
 namespace CGL {
 
-static std::mersenne_twister_engine<std::uint_fast32_t, 32, 624, 397, 31, 0x9908b0df,
+typedef std::mersenne_twister_engine<std::uint_fast32_t, 32, 624, 397, 31, 0x9908b0df,
                              11, 0xffffffff, 7, 0x9d2c5680, 15, 0xefc60000, 18,
-                             1812433253> minstd_engine;
+                             1812433253> random_engine_type;
 
-static double rmax = 1.0 / (minstd_engine.max() - minstd_engine.min());
+/**
+ * The calling thread's random engine. Every thread has its own, so render
+ * threads never share (and race on) engine state.
+ */
+inline random_engine_type& random_engine() {
+  static thread_local random_engine_type engine;
+  return engine;
+}
 
+/**
+ * Restart the calling thread's random stream from seed.
+ */
+inline void seed_random(uint32_t seed) {
+  random_engine().seed(seed);
+}
 
 /**
  * Returns a number distributed uniformly over [0, 1].
  */
 inline double random_uniform() {
-  return clamp(double(minstd_engine() - minstd_engine.min()) * rmax, 0.0000001, 0.99999999);
+  static const double rmax = 1.0 / (random_engine_type::max() - random_engine_type::min());
+  return clamp(double(random_engine()() - random_engine_type::min()) * rmax, 0.0000001, 0.99999999);
 }
 
 /**
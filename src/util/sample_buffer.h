@@ -0,0 +1,114 @@
+#ifndef CGL_SAMPLE_BUFFER_H
+#define CGL_SAMPLE_BUFFER_H
+
+#include <vector>
+
+#include "CGL/vector3D.h"
+#include "util/image.h"
+
+namespace CGL {
+
+/**
+ * Radiance estimates of the image being rendered, with the number of
+ * samples behind each. A pixel is four floats, linear RGB and the sample
+ * count, 16 byte aligned so it is one SSE load: 16 bytes against the 36 of
+ * an HDRImageBuffer pixel and its count, which at 8K is 530 MB instead of
+ * 1.2 GB. ToneMapper converts it for display.
+ *
+ * With set_high_precision the radiance is also accumulated in doubles, in
+ * an HDRImageBuffer, for renders of so many passes that blending them in
+ * float would lose precision. The float pixels then hold its rounded copy
+ * for display.
+ */
+struct SampleBuffer {
+
+  struct alignas(16) Pixel {
+    float r, g, b;
+    float w;  ///< samples behind the estimate
+  };
+
+  SampleBuffer() : w(0), h(0), high_precision(false) { }
+
+  /**
+   * Accumulate in doubles from the next resize on.
+   */
+  void set_high_precision(bool on) { high_precision = on; }
+  bool is_high_precision() const { return high_precision; }
+
+  /**
+   * Resize the buffer, clearing it.
+   */
+  void resize(size_t w, size_t h) {
+    this->w = w;
+    this->h = h;
+    data.assign(w * h, Pixel());
+    precise.resize(high_precision ? w : 0, high_precision ? h : 0);
+  }
+
+  bool is_empty() const { return w == 0 && h == 0; }
+
+  /**
+   * Clear all estimates and sample counts.
+   */
+  void clear() {
+    data.assign(w * h, Pixel());
+    precise.clear();
+  }
+
+  Vector3D radiance(size_t i) const {
+    if (high_precision) return precise.data[i];
+    return Vector3D(data[i].r, data[i].g, data[i].b);
+  }
+
+  int count(size_t i) const { return (int) data[i].w; }
+
+  /**
+   * Store the estimate of pixel i and the number of samples behind it.
+   */
+  void set(size_t i, const Vector3D& s, int num_samples) {
+    if (high_precision) precise.data[i] = s;
+    Pixel p = { (float) s.r, (float) s.g, (float) s.b, (float) num_samples };
+    data[i] = p;
+  }
+
+  void update_pixel(const Vector3D& s, int num_samples, size_t x, size_t y) {
+    set(x + y * w, s, num_samples);
+  }
+
+  /**
+   * Average the estimate s of num_samples more samples into pixel i,
+   * weighted by sample counts.
+   */
+  void blend(size_t i, const Vector3D& s, int num_samples) {
+    Pixel& p = data[i];
+    float total = p.w + num_samples;
+    if (total > 0) {
+      float r = num_samples / total;
+      if (high_precision) {
+        Vector3D& d = precise.data[i];
+        d = s * r + (1 - r) * d;
+        p.r = d.r; p.g = d.g; p.b = d.b;
+      } else {
+        p.r += ((float) s.r - p.r) * r;
+        p.g += ((float) s.g - p.g) * r;
+        p.b += ((float) s.b - p.b) * r;
+      }
+    }
+    p.w = total;
+  }
+
+  size_t w; ///< width
+  size_t h; ///< height
+  std::vector<Pixel> data;  ///< pixel buffer
+  HDRImageBuffer precise;   ///< double radiance, sized only in high precision
+
+ private:
+  bool high_precision;
+
+}; // struct SampleBuffer
+
+static_assert(sizeof(SampleBuffer::Pixel) == 16, "a pixel is one SSE register");
+
+} // namespace CGL
+
+#endif // CGL_SAMPLE_BUFFER_H
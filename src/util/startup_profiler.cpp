@@ -0,0 +1,194 @@
+#include "startup_profiler.h"
+
+#include <chrono>
+#include <atomic>
+#include <cstdio>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+using std::string;
+using std::vector;
+
+namespace CGL {
+
+// initialized with the other statics, before main
+static const std::chrono::steady_clock::time_point process_start =
+    std::chrono::steady_clock::now();
+
+static double seconds_since_start() {
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - process_start).count();
+}
+
+static std::atomic<size_t> next_thread_id(0);
+static thread_local size_t thread_id = StartupProfiler::none;
+static thread_local vector<size_t> open_phases;  ///< innermost last
+
+StartupProfiler& StartupProfiler::instance() {
+  static StartupProfiler profiler;
+  return profiler;
+}
+
+StartupProfiler::StartupProfiler() : finished(false) { }
+
+void StartupProfiler::set_output(const string& path) {
+  std::lock_guard<std::mutex> lk(m);
+  output = path;
+}
+
+long StartupProfiler::peak_rss_kb() {
+#ifdef _WIN32
+  return 0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;  // bytes here
+#else
+  return usage.ru_maxrss;
+#endif
+#endif
+}
+
+size_t StartupProfiler::begin(const char* name) {
+  if (thread_id == none) thread_id = next_thread_id++;
+
+  Phase phase;
+  phase.name = name;
+  phase.parent = open_phases.empty() ? none : open_phases.back();
+  phase.thread = thread_id;
+  phase.duration = -1;
+  phase.peak_rss_start = peak_rss_kb();
+  phase.peak_rss_end = 0;
+  phase.start = seconds_since_start();
+
+  std::lock_guard<std::mutex> lk(m);
+  if (finished) return none;
+  phases.push_back(phase);
+  open_phases.push_back(phases.size() - 1);
+  return phases.size() - 1;
+}
+
+void StartupProfiler::end(size_t index) {
+  if (index == none) return;
+  double now = seconds_since_start();
+  long rss = peak_rss_kb();
+
+  std::lock_guard<std::mutex> lk(m);
+  if (!open_phases.empty() && open_phases.back() == index) open_phases.pop_back();
+  if (finished) return;
+  phases[index].duration = now - phases[index].start;
+  phases[index].peak_rss_end = rss;
+}
+
+void StartupProfiler::finish() {
+  double total = seconds_since_start();
+  long rss = peak_rss_kb();
+
+  std::lock_guard<std::mutex> lk(m);
+  if (finished) return;
+  finished = true;
+  if (output.empty()) return;
+
+  // phases still running are cut off at the first pixel
+  for (size_t i = 0; i < phases.size(); ++i) {
+    if (phases[i].duration < 0) {
+      phases[i].duration = total - phases[i].start;
+      phases[i].peak_rss_end = rss;
+    }
+  }
+
+  print_report(total);
+  if (write_trace(total)) {
+    fprintf(stdout, "[PathTracer] Startup profile saved to %s\n", output.c_str());
+  } else {
+    fprintf(stderr, "[PathTracer] Could not write startup profile %s\n", output.c_str());
+  }
+}
+
+void StartupProfiler::print_report(double total) const {
+  fprintf(stdout, "[PathTracer] Startup profile, %.4f sec to first pixel:\n", total);
+  fprintf(stdout, "[PathTracer]   %-36s %10s %10s %12s\n",
+          "phase", "start", "time", "peak RSS");
+  print_children(none, 0);
+}
+
+/**
+ * Phases of the same name under the same parent, e.g. one per material,
+ * are reported as one line with their total time.
+ */
+void StartupProfiler::print_children(size_t parent, int depth) const {
+  vector<bool> printed(phases.size(), false);
+  for (size_t i = 0; i < phases.size(); ++i) {
+    if (phases[i].parent != parent || printed[i]) continue;
+
+    size_t count = 0;
+    double duration = 0;
+    long rss = 0;
+    for (size_t j = i; j < phases.size(); ++j) {
+      if (phases[j].parent != parent || phases[j].name != phases[i].name) continue;
+      printed[j] = true;
+      count++;
+      duration += phases[j].duration;
+      rss = std::max(rss, phases[j].peak_rss_end);
+    }
+
+    string name = string(2 * depth, ' ') + phases[i].name;
+    if (count > 1) {
+      char times[32];
+      snprintf(times, sizeof(times), " (x%zu)", count);
+      name += times;
+    }
+    fprintf(stdout, "[PathTracer]   %-36s %9.4fs %9.4fs %9.1f MB\n",
+            name.c_str(), phases[i].start, duration, rss / 1024.0);
+
+    // children of repeated phases are listed under the first of them
+    print_children(i, depth + 1);
+  }
+}
+
+static string json_string(const string& s) {
+  string out = "\"";
+  for (size_t i = 0; i < s.size(); ++i) {
+    char c = s[i];
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((unsigned char) c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+bool StartupProfiler::write_trace(double total) const {
+  FILE* file = fopen(output.c_str(), "w");
+  if (!file) return false;
+
+  // complete events for the phases, with a peak RSS counter track
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (size_t i = 0; i < phases.size(); ++i) {
+    const Phase& p = phases[i];
+    fprintf(file, "{\"name\":%s,\"cat\":\"startup\",\"ph\":\"X\",\"pid\":1,"
+                  "\"tid\":%zu,\"ts\":%.1f,\"dur\":%.1f,"
+                  "\"args\":{\"peak_rss_kb\":%ld,\"peak_rss_growth_kb\":%ld}},\n",
+            json_string(p.name).c_str(), p.thread, p.start * 1e6, p.duration * 1e6,
+            p.peak_rss_end, p.peak_rss_end - p.peak_rss_start);
+    fprintf(file, "{\"name\":\"peak RSS\",\"ph\":\"C\",\"pid\":1,\"ts\":%.1f,"
+                  "\"args\":{\"MB\":%.1f}},\n",
+            (p.start + p.duration) * 1e6, p.peak_rss_end / 1024.0);
+  }
+  fprintf(file, "{\"name\":\"first pixel\",\"cat\":\"startup\",\"ph\":\"i\",\"s\":\"g\","
+                "\"pid\":1,\"tid\":0,\"ts\":%.1f}\n]}\n", total * 1e6);
+
+  return fclose(file) == 0;
+}
+
+} // namespace CGL
@@ -0,0 +1,86 @@
+#ifndef CGL_STARTUP_PROFILER_H
+#define CGL_STARTUP_PROFILER_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+namespace CGL {
+
+/**
+ * Times the phases of startup, from process start to the first rendered
+ * pixel. Phases are recorded by ProfilePhase scopes and nest by scope on
+ * each thread. Recording always happens, it is a handful of clock reads
+ * per phase; once rendering starts, finish() ends the profile and, if an
+ * output file was set, prints the phase tree and writes it as a Chrome
+ * trace (chrome://tracing, Perfetto) with the peak RSS after each phase.
+ */
+class StartupProfiler {
+ public:
+
+  struct Phase {
+    std::string name;
+    size_t parent;        ///< index of the enclosing phase, or none
+    size_t thread;        ///< small id of the recording thread
+    double start;         ///< seconds since process start
+    double duration;      ///< seconds, negative while running
+    long peak_rss_start;  ///< peak resident set size in KB when it began
+    long peak_rss_end;    ///< and when it ended
+  };
+
+  static const size_t none = (size_t) -1;
+
+  static StartupProfiler& instance();
+
+  /**
+   * Print the report and write the Chrome trace to path on finish().
+   */
+  void set_output(const std::string& path);
+
+  size_t begin(const char* name);
+  void end(size_t index);
+
+  /**
+   * The first pixel is being rendered: stop recording and report. Only
+   * the first call does anything.
+   */
+  void finish();
+
+  /**
+   * Peak resident set size of the process in KB, 0 where unknown.
+   */
+  static long peak_rss_kb();
+
+ private:
+
+  StartupProfiler();
+
+  void print_report(double total) const;
+  void print_children(size_t parent, int depth) const;
+  bool write_trace(double total) const;
+
+  std::mutex m;
+  std::vector<Phase> phases;
+  std::string output;
+  bool finished;
+};
+
+/**
+ * Records the enclosing scope as a startup phase.
+ */
+class ProfilePhase {
+ public:
+  ProfilePhase(const char* name)
+    : index(StartupProfiler::instance().begin(name)) { }
+  ~ProfilePhase() { StartupProfiler::instance().end(index); }
+
+ private:
+  ProfilePhase(const ProfilePhase&);
+  ProfilePhase& operator=(const ProfilePhase&);
+
+  size_t index;
+};
+
+} // namespace CGL
+
+#endif // CGL_STARTUP_PROFILER_H
@@ -0,0 +1,144 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <mutex>
+#include <thread>
+#include <future>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+
+/**
+ * Fixed set of worker threads that stay parked between jobs, so repeated
+ * renders do not pay thread creation and keep their thread-local state.
+ *
+ * A job runs once on every worker, fork-join style. The worker that finishes
+ * last runs the job's completion callback and then makes the job's future
+ * ready. One job runs at a time; run() waits for the previous job to finish.
+ *
+ * shared() is a process-wide pool for short parallel loops, see
+ * util/parallel_for.h.
+ */
+class ThreadPool {
+ public:
+
+  ThreadPool(size_t num_threads) : generation(0), remaining(0), shutdown(false) {
+    num_threads = std::max(num_threads, (size_t) 1);
+    for (size_t i = 0; i < num_threads; ++i) {
+      threads.push_back(std::thread(&ThreadPool::worker_loop, this, i));
+    }
+  }
+
+  /**
+   * Waits for the current job, if any, then stops and joins the workers.
+   */
+  ~ThreadPool() {
+    {
+      std::unique_lock<std::mutex> lk(lock);
+      idle.wait(lk, [this]{ return remaining == 0; });
+      shutdown = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < threads.size(); ++i) threads[i].join();
+  }
+
+  size_t size() const { return threads.size(); }
+
+  /**
+   * Pool for short parallel loops, with a worker per hardware thread
+   * besides the caller's. Created on first use.
+   */
+  static ThreadPool& shared() {
+    static ThreadPool pool(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+    return pool;
+  }
+
+  /**
+   * Whether the calling thread is one of this pool's workers. A worker
+   * that waited on a job of its own pool would wait forever.
+   */
+  bool is_worker() const { return current_pool() == this; }
+
+  /**
+   * Run job(worker_id) on every worker, then done() on the last worker to
+   * finish.
+   * \return future that becomes ready once done() has returned
+   */
+  std::future<void> run(const std::function<void(size_t)>& job,
+                        const std::function<void()>& done = std::function<void()>()) {
+    std::unique_lock<std::mutex> lk(lock);
+    idle.wait(lk, [this]{ return remaining == 0; });
+
+    this->job = job;
+    this->done = done;
+    promise = std::promise<void>();
+    std::future<void> result = promise.get_future();
+    remaining = threads.size();
+    generation++;
+    lk.unlock();
+
+    wake.notify_all();
+    return result;
+  }
+
+ private:
+
+  static ThreadPool*& current_pool() {
+    static thread_local ThreadPool* pool = nullptr;
+    return pool;
+  }
+
+  void worker_loop(size_t worker_id) {
+    current_pool() = this;
+    size_t seen = 0;
+    while (true) {
+      std::function<void(size_t)> current;
+      {
+        std::unique_lock<std::mutex> lk(lock);
+        wake.wait(lk, [&]{ return shutdown || generation != seen; });
+        if (shutdown) return;
+        seen = generation;
+        current = job;
+      }
+
+      current(worker_id);
+
+      // the last worker out completes the job
+      std::function<void()> on_done;
+      std::promise<void> finished;
+      {
+        std::lock_guard<std::mutex> lk(lock);
+        if (remaining > 1) {
+          remaining--;
+          continue;
+        }
+        on_done = done;
+        finished = std::move(promise);
+      }
+
+      if (on_done) on_done();
+      finished.set_value();
+
+      {
+        std::lock_guard<std::mutex> lk(lock);
+        remaining = 0;
+      }
+      idle.notify_all();
+    }
+  }
+
+  std::vector<std::thread> threads;
+  std::mutex lock;
+  std::condition_variable wake;   ///< workers wait here for the next job
+  std::condition_variable idle;   ///< run() and ~ThreadPool wait for the job to end
+
+  std::function<void(size_t)> job;
+  std::function<void()> done;
+  std::promise<void> promise;
+  size_t generation;              ///< bumped for every job
+  size_t remaining;               ///< workers still busy with the job (or its completion)
+  bool shutdown;
+};
+
+#endif  // __THREAD_POOL_H__
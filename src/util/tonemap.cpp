@@ -0,0 +1,251 @@
+#include "tonemap.h"
+
+#include <cmath>
+#include <algorithm>
+#include <emmintrin.h>
+
+#include "util/parallel_for.h"
+
+using std::vector;
+
+namespace CGL {
+
+static const size_t lut_steps = 65535;
+static const size_t band_rows = 16;  ///< rows handed to a thread at a time
+
+ToneMapper::ToneMapper()
+  : level(1.0f), key(0.18f), white(5.0f), op(LINEAR), gamma(0), average(0) {
+  set_gamma(2.2f);
+}
+
+bool ToneMapper::parse_operator(const std::string& name, Operator* op) {
+  if (name == "linear") *op = LINEAR;
+  else if (name == "reinhard") *op = REINHARD;
+  else if (name == "aces") *op = ACES;
+  else if (name == "filmic") *op = FILMIC;
+  else return false;
+  return true;
+}
+
+void ToneMapper::set_gamma(float gamma) {
+  if (gamma == this->gamma) return;
+  this->gamma = gamma;
+
+  // truncated like ImageBuffer::update_pixel
+  lut.resize(lut_steps + 1);
+  double one_over_gamma = 1.0 / gamma;
+  for (size_t i = 0; i <= lut_steps; ++i) {
+    double v = 255 * pow((double) i / lut_steps, one_over_gamma);
+    lut[i] = (uint8_t) std::min(v, 255.0);
+  }
+}
+
+/**
+ * log2 of four positive, normal floats, to about 2e-6. With x = m 2^e and
+ * m in [1, 2), log2(m) = 2 / ln 2 atanh(z) for z = (m - 1) / (m + 1) in
+ * [0, 1/3), whose series is cut after z^9.
+ */
+static inline __m128 log2_ps(__m128 x) {
+  __m128i bits = _mm_castps_si128(x);
+  __m128i e = _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127));
+  __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)),
+                                           _mm_set1_epi32(0x3F800000)));
+  __m128 one = _mm_set1_ps(1.f);
+  __m128 z = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+  __m128 z2 = _mm_mul_ps(z, z);
+  __m128 p = _mm_set1_ps(1.f / 9);
+  p = _mm_add_ps(_mm_mul_ps(p, z2), _mm_set1_ps(1.f / 7));
+  p = _mm_add_ps(_mm_mul_ps(p, z2), _mm_set1_ps(1.f / 5));
+  p = _mm_add_ps(_mm_mul_ps(p, z2), _mm_set1_ps(1.f / 3));
+  p = _mm_add_ps(_mm_mul_ps(p, z2), one);
+  p = _mm_mul_ps(p, _mm_mul_ps(z, _mm_set1_ps((float) (2 / M_LN2))));
+  return _mm_add_ps(_mm_cvtepi32_ps(e), p);
+}
+
+bool ToneMapper::update(const SampleBuffer& buffer, size_t num_threads, float tolerance) {
+  if (!is_global() || buffer.w == 0 || buffer.h == 0) return false;
+
+  // per band sums, added up in order so the average does not depend on
+  // the number of threads
+  size_t w = buffer.w;
+  size_t num_bands = (buffer.h + band_rows - 1) / band_rows;
+  vector<double> sums(num_bands, 0.);
+  parallel_for(num_bands, num_threads, [&](size_t band) {
+    const __m128 lr = _mm_set1_ps(0.2126f);
+    const __m128 lg = _mm_set1_ps(0.7152f);
+    const __m128 lb = _mm_set1_ps(0.0722f);
+    const __m128 delta = _mm_set1_ps(0.0000001f);  // avoids the singularity at 0
+    size_t y1 = std::min(buffer.h, (band + 1) * band_rows);
+    double sum = 0;
+    for (size_t y = band * band_rows; y < y1; ++y) {
+      const SampleBuffer::Pixel* row = &buffer.data[y * w];
+      __m128 acc = _mm_setzero_ps();
+      size_t x = 0;
+      for (; x + 4 <= w; x += 4) {
+        __m128 r = _mm_load_ps(&row[x].r);
+        __m128 g = _mm_load_ps(&row[x + 1].r);
+        __m128 b = _mm_load_ps(&row[x + 2].r);
+        __m128 n = _mm_load_ps(&row[x + 3].r);
+        _MM_TRANSPOSE4_PS(r, g, b, n);
+        __m128 l = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, lr), _mm_mul_ps(g, lg)),
+                              _mm_mul_ps(b, lb));
+        acc = _mm_add_ps(acc, log2_ps(_mm_max_ps(_mm_add_ps(l, delta), delta)));
+      }
+      float lanes[4];
+      _mm_storeu_ps(lanes, acc);
+      sum += (lanes[0] + lanes[1] + lanes[2] + lanes[3]) * M_LN2;
+      for (; x < w; ++x) {
+        const SampleBuffer::Pixel& p = row[x];
+        float l = 0.2126f * p.r + 0.7152f * p.g + 0.0722f * p.b;
+        sum += log(std::max(0.0000001f + l, 0.0000001f));
+      }
+    }
+    sums[band] = sum;
+  });
+
+  double sum = 0;
+  for (size_t i = 0; i < num_bands; ++i) sum += sums[i];
+  float updated = exp(sum / (w * buffer.h));
+  if (updated == average || fabs(updated - average) <= tolerance * average) return false;
+  average = updated;
+  return true;
+}
+
+/**
+ * Hable's curve, from "Filmic Tonemapping Operators" (2010).
+ */
+static inline __m128 hable(__m128 x) {
+  const __m128 a = _mm_set1_ps(0.15f), b = _mm_set1_ps(0.50f), c = _mm_set1_ps(0.10f);
+  const __m128 d = _mm_set1_ps(0.20f), e = _mm_set1_ps(0.02f), f = _mm_set1_ps(0.30f);
+  __m128 ax = _mm_mul_ps(a, x);
+  __m128 num = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(ax, _mm_mul_ps(c, b))), _mm_mul_ps(d, e));
+  __m128 den = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(ax, b)), _mm_mul_ps(d, f));
+  return _mm_sub_ps(_mm_div_ps(num, den), _mm_div_ps(e, f));
+}
+
+/**
+ * Curve of op applied to one channel of exposed radiance.
+ */
+template <ToneMapper::Operator op>
+static inline __m128 channel_curve(__m128 c) {
+  switch (op) {
+  case ToneMapper::ACES: {
+    // Narkowicz, "ACES Filmic Tone Mapping Curve" (2016)
+    __m128 num = _mm_mul_ps(c, _mm_add_ps(_mm_mul_ps(c, _mm_set1_ps(2.51f)),
+                                          _mm_set1_ps(0.03f)));
+    __m128 den = _mm_add_ps(_mm_mul_ps(c, _mm_add_ps(_mm_mul_ps(c, _mm_set1_ps(2.43f)),
+                                                     _mm_set1_ps(0.59f))),
+                            _mm_set1_ps(0.14f));
+    return _mm_div_ps(num, den);
+  }
+  case ToneMapper::FILMIC: {
+    // exposure bias of 2 and a white point of 11.2, as in the talk
+    return _mm_div_ps(hable(_mm_add_ps(c, c)), hable(_mm_set1_ps(11.2f)));
+  }
+  default:
+    return c;
+  }
+}
+
+/**
+ * Tone curve of op applied to the exposed radiance of four pixels, one
+ * channel per register.
+ */
+template <ToneMapper::Operator op>
+static inline void tone_curve(__m128& r, __m128& g, __m128& b, __m128 white2) {
+  if (op == ToneMapper::REINHARD) {
+    // l (1 + l / white^2) / (1 + l), applied to the color as a whole
+    __m128 l = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(0.2126f)),
+                                     _mm_mul_ps(g, _mm_set1_ps(0.7152f))),
+                          _mm_mul_ps(b, _mm_set1_ps(0.0722f)));
+    __m128 f = _mm_div_ps(_mm_add_ps(white2, l),
+                          _mm_mul_ps(white2, _mm_add_ps(_mm_set1_ps(1.f), l)));
+    r = _mm_mul_ps(r, f);
+    g = _mm_mul_ps(g, f);
+    b = _mm_mul_ps(b, f);
+  } else if (op != ToneMapper::LINEAR) {
+    r = channel_curve<op>(r);
+    g = channel_curve<op>(g);
+    b = channel_curve<op>(b);
+  }
+}
+
+/**
+ * Map four pixels, transposed so a division serves four pixels instead of
+ * the channels of one.
+ */
+template <ToneMapper::Operator op>
+static inline void map_pixels(const SampleBuffer::Pixel* src, uint32_t* dst,
+                              __m128 scale, __m128 white2, const uint8_t* lut) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.f);
+  const __m128 steps = _mm_set1_ps((float) lut_steps);
+  __m128 r = _mm_load_ps(&src[0].r);
+  __m128 g = _mm_load_ps(&src[1].r);
+  __m128 b = _mm_load_ps(&src[2].r);
+  __m128 n = _mm_load_ps(&src[3].r);
+  _MM_TRANSPOSE4_PS(r, g, b, n);
+  r = _mm_mul_ps(r, scale);
+  g = _mm_mul_ps(g, scale);
+  b = _mm_mul_ps(b, scale);
+  tone_curve<op>(r, g, b, white2);
+
+  // max first, it turns NaN into 0
+  int32_t ir[4], ig[4], ib[4];
+  _mm_storeu_si128((__m128i*) ir, _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(r, zero), one), steps)));
+  _mm_storeu_si128((__m128i*) ig, _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(g, zero), one), steps)));
+  _mm_storeu_si128((__m128i*) ib, _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(b, zero), one), steps)));
+  for (int i = 0; i < 4; ++i) {
+    dst[i] = 0xFF000000 | ((uint32_t) lut[ib[i]] << 16) |
+             ((uint32_t) lut[ig[i]] << 8) | lut[ir[i]];
+  }
+}
+
+template <ToneMapper::Operator op>
+static void map_row(const SampleBuffer::Pixel* src, uint32_t* dst, size_t n,
+                    float scale, float white, const uint8_t* lut) {
+  const __m128 s = _mm_set1_ps(scale);
+  const __m128 white2 = _mm_set1_ps(white * white);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) map_pixels<op>(&src[i], &dst[i], s, white2, lut);
+  if (i == n) return;
+
+  // the last pixels of the row go through a block of four
+  SampleBuffer::Pixel tail[4] = {};
+  uint32_t mapped[4];
+  std::copy(src + i, src + n, tail);
+  map_pixels<op>(tail, mapped, s, white2, lut);
+  std::copy(mapped, mapped + (n - i), dst + i);
+}
+
+void ToneMapper::apply(const SampleBuffer& buffer, ImageBuffer& target,
+                       size_t x0, size_t y0, size_t x1, size_t y1) const {
+  if (x1 <= x0) return;
+
+  float scale = sqrt(pow(2, level));
+  if (op == REINHARD && average > 0) scale *= key / average;
+
+  void (*map)(const SampleBuffer::Pixel*, uint32_t*, size_t, float, float,
+              const uint8_t*) = map_row<LINEAR>;
+  switch (op) {
+  case LINEAR:   map = map_row<LINEAR>; break;
+  case REINHARD: map = map_row<REINHARD>; break;
+  case ACES:     map = map_row<ACES>; break;
+  case FILMIC:   map = map_row<FILMIC>; break;
+  }
+  for (size_t y = y0; y < y1; ++y) {
+    map(&buffer.data[x0 + y * buffer.w], &target.data[x0 + y * target.w],
+        x1 - x0, scale, white, &lut[0]);
+  }
+}
+
+void ToneMapper::apply(const SampleBuffer& buffer, ImageBuffer& target,
+                       size_t num_threads) const {
+  size_t num_bands = (buffer.h + band_rows - 1) / band_rows;
+  parallel_for(num_bands, num_threads, [&](size_t band) {
+    apply(buffer, target, 0, band * band_rows, buffer.w,
+          std::min(buffer.h, (band + 1) * band_rows));
+  });
+}
+
+} // namespace CGL
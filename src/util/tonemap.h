@@ -0,0 +1,86 @@
+#ifndef CGL_TONEMAP_H
+#define CGL_TONEMAP_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "util/image.h"
+#include "util/sample_buffer.h"
+
+namespace CGL {
+
+/**
+ * Converts the radiance of a SampleBuffer to display colors: exposure, a
+ * tone curve, clamping to [0, 1] and gamma. A pixel is processed in one SSE
+ * register, and gamma is a lookup in a table of 64K entries built when the
+ * gamma is set, instead of a pow per channel.
+ *
+ * apply() may be called from several threads at once, as the workers
+ * commit their tiles. Only update() and the setters modify the mapper.
+ */
+class ToneMapper {
+ public:
+
+  enum Operator {
+    LINEAR,    ///< exposure only, highlights clip
+    REINHARD,  ///< extended Reinhard on luminance, keyed to the log average
+    ACES,      ///< Narkowicz's fit of the ACES filmic curve
+    FILMIC     ///< Hable's filmic curve from Uncharted 2
+  };
+
+  ToneMapper();
+
+  /**
+   * Parse an operator name: linear, reinhard, aces or filmic.
+   */
+  static bool parse_operator(const std::string& name, Operator* op);
+
+  void set_operator(Operator op) { this->op = op; }
+  Operator get_operator() const { return op; }
+
+  void set_gamma(float gamma);
+  float get_gamma() const { return gamma; }
+
+  /**
+   * Whether the curve depends on the whole image, so the image has to be
+   * mapped again when its log average changes.
+   */
+  bool is_global() const { return op == REINHARD; }
+
+  /**
+   * Compute the log average luminance of buffer on num_threads threads,
+   * if the operator needs it. The average is only replaced if it moved by
+   * more than the fraction tolerance, so that changes too small to show
+   * do not call for mapping the image again.
+   * \return whether the average was replaced
+   */
+  bool update(const SampleBuffer& buffer, size_t num_threads, float tolerance = 0);
+
+  /**
+   * Map the pixels [x0, x1) x [y0, y1) of buffer into target.
+   */
+  void apply(const SampleBuffer& buffer, ImageBuffer& target,
+             size_t x0, size_t y0, size_t x1, size_t y1) const;
+
+  /**
+   * Map all of buffer into target, in bands of rows on num_threads threads.
+   */
+  void apply(const SampleBuffer& buffer, ImageBuffer& target,
+             size_t num_threads) const;
+
+  float level;  ///< exposure level, the radiance is scaled by sqrt(2^level)
+  float key;    ///< luminance the log average is mapped to (Reinhard)
+  float white;  ///< smallest luminance mapped to white (Reinhard)
+
+ private:
+  Operator op;
+  float gamma;
+  float average;             ///< log average luminance, 0 until updated
+  std::vector<uint8_t> lut;  ///< [0, 1] in 65535 steps to gamma encoded 8 bits
+
+}; // class ToneMapper
+
+} // namespace CGL
+
+#endif // CGL_TONEMAP_H
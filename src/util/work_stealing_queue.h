@@ -0,0 +1,296 @@
+#ifndef __WORK_STEALING_QUEUE_H__
+#define __WORK_STEALING_QUEUE_H__
+
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <cstdint>
+#include <algorithm>
+
+/**
+ * Chase-Lev work-stealing deque of item indices (Le et al., "Correct and
+ * Efficient Work-Stealing for Weak Memory Models", PPoPP 2013).
+ *
+ * The owning worker pushes and pops at the bottom without locks; other
+ * workers steal from the top with a single compare-and-swap. The ring buffer
+ * does not grow, so the capacity must cover everything pushed between two
+ * points where the deque is empty.
+ */
+class ChaseLevDeque {
+ public:
+
+  ChaseLevDeque() : top(0), bottom(0), mask(0) { }
+
+  /**
+   * Set the capacity (rounded up to a power of two). Only call this while no
+   * other thread uses the deque.
+   */
+  void reserve(size_t capacity) {
+    size_t n = 1;
+    while (n < capacity) n <<= 1;
+    if (n <= buffer.size()) return;
+    std::vector<std::atomic<uint32_t> > resized(n);
+    buffer.swap(resized);
+    mask = n - 1;
+  }
+
+  /**
+   * Owner only: push an index at the bottom.
+   */
+  void push(uint32_t index) {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    buffer[b & mask].store(index, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+  }
+
+  /**
+   * Owner only: pop the most recently pushed index.
+   */
+  bool pop(uint32_t* index) {
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+
+    if (t > b) {
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+
+    *index = buffer[b & mask].load(std::memory_order_relaxed);
+    if (t == b) {
+      // last item: race thieves for it
+      bool won = top.compare_exchange_strong(t, t + 1,
+                                             std::memory_order_seq_cst,
+                                             std::memory_order_relaxed);
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  /**
+   * Any thread: steal the least recently pushed index. Fails if the deque
+   * is empty or another thread won the race for the same index.
+   */
+  bool steal(uint32_t* index) {
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b) return false;
+
+    *index = buffer[t & mask].load(std::memory_order_relaxed);
+    return top.compare_exchange_strong(t, t + 1,
+                                       std::memory_order_seq_cst,
+                                       std::memory_order_relaxed);
+  }
+
+  bool is_empty() const {
+    return top.load(std::memory_order_acquire) >=
+           bottom.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Drop all indices. Only call this while no other thread uses the deque.
+   */
+  void clear() {
+    top.store(bottom.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<int64_t> top;
+  char pad[64];  // keep thieves' writes to top off the owner's cache line
+  std::atomic<int64_t> bottom;
+  std::vector<std::atomic<uint32_t> > buffer;
+  size_t mask;
+};
+
+/**
+ * Work queue for a fixed set of workers, each owning a Chase-Lev deque.
+ *
+ * reset() splits the work into one contiguous chunk per worker, so a worker
+ * handles items that were next to each other in the input (neighbouring
+ * tiles), or deals items out round-robin when the input is sorted by cost.
+ * Each worker pushes its own chunk the first time it asks for work after a
+ * reset, works through it in input order, and steals from the far end of
+ * other workers' chunks once its own is exhausted. Workers can be put in
+ * groups (e.g. by NUMA node) to steal from their own group first.
+ */
+template <class T>
+class WorkStealingQueue {
+ public:
+
+  WorkStealingQueue() : generation(0), canceled(false) { }
+
+  /**
+   * Replace the work with items, to be split among num_workers workers.
+   * Only call this while no worker is inside try_get_work, and only after
+   * all items of the previous reset were handed out.
+   * \param interleave deal items round-robin instead of in contiguous chunks
+   */
+  void reset(const std::vector<T>& items, size_t num_workers,
+             bool interleave = false) {
+    num_workers = std::max(num_workers, (size_t) 1);
+    if (workers.size() != num_workers) {
+      std::vector<Worker> resized(num_workers);
+      workers.swap(resized);
+    }
+
+    size_t chunk = (items.size() + num_workers - 1) / num_workers;
+    if (!interleave) {
+      this->items = items;
+      for (size_t i = 0; i < num_workers; ++i) {
+        workers[i].begin = std::min(i * chunk, items.size());
+        workers[i].end = std::min((i + 1) * chunk, items.size());
+      }
+    } else {
+      // store each worker's share contiguously: items i, i + n, i + 2n, ...
+      this->items.clear();
+      for (size_t i = 0; i < num_workers; ++i) {
+        workers[i].begin = this->items.size();
+        for (size_t j = i; j < items.size(); j += num_workers) {
+          this->items.push_back(items[j]);
+        }
+        workers[i].end = this->items.size();
+      }
+    }
+
+    for (size_t i = 0; i < num_workers; ++i) {
+      workers[i].deque.reserve(chunk);
+      set_victims(i);
+    }
+
+    canceled.store(false, std::memory_order_relaxed);
+    generation.fetch_add(1, std::memory_order_release);
+  }
+
+  /**
+   * Assign worker i to group groups[i]; workers steal from their own group
+   * before the others. Takes effect on the next reset().
+   */
+  void set_groups(const std::vector<size_t>& groups) {
+    this->groups = groups;
+  }
+
+  /**
+   * Hand out the same items again, e.g. for another pass over all tiles.
+   * Unlike reset(), this may be called while workers are looking for work,
+   * as long as all items of the previous round were handed out.
+   */
+  void restart() {
+    generation.fetch_add(1, std::memory_order_release);
+  }
+
+  /**
+   * Get an item for worker worker_id, from its own deque or stolen from
+   * another worker.
+   * \return false once all items have been handed out (or on cancel)
+   */
+  bool try_get_work(size_t worker_id, T* outPtr) {
+    Worker& self = workers[worker_id];
+
+    uint32_t index;
+    while (!canceled.load(std::memory_order_relaxed)) {
+      // push this worker's chunk in reverse, so pops run in input order
+      size_t gen = generation.load(std::memory_order_acquire);
+      if (self.filled.load(std::memory_order_relaxed) != gen) {
+        for (size_t i = self.end; i > self.begin; --i) {
+          self.deque.push(i - 1);
+        }
+        self.filled.store(gen, std::memory_order_release);
+      }
+
+      if (self.deque.pop(&index)) {
+        *outPtr = items[index];
+        return true;
+      }
+
+      bool pending = false;
+      for (size_t i = 0; i < self.victims.size(); ++i) {
+        Worker& victim = workers[self.victims[i]];
+        while (!victim.deque.is_empty()) {
+          if (victim.deque.steal(&index)) {
+            *outPtr = items[index];
+            return true;
+          }
+        }
+        pending |= victim.begin < victim.end &&
+                   victim.filled.load(std::memory_order_acquire) != gen;
+      }
+
+      // another worker has not pushed its chunk yet; wait for it
+      if (!pending) return false;
+      std::this_thread::yield();
+    }
+    return false;
+  }
+
+  /**
+   * True if no items are left to hand out.
+   */
+  bool is_empty() const {
+    size_t gen = generation.load(std::memory_order_acquire);
+    for (size_t i = 0; i < workers.size(); ++i) {
+      if (workers[i].filled.load(std::memory_order_acquire) != gen &&
+          workers[i].begin < workers[i].end) return false;
+      if (!workers[i].deque.is_empty()) return false;
+    }
+    return true;
+  }
+
+  /**
+   * Make try_get_work fail from now on, dropping the remaining items.
+   */
+  void cancel() {
+    canceled.store(true, std::memory_order_relaxed);
+  }
+
+  /**
+   * Drop all remaining items. Only call this while no worker is running.
+   */
+  void clear() {
+    for (size_t i = 0; i < workers.size(); ++i) {
+      workers[i].deque.clear();
+      workers[i].filled.store(generation.load());
+    }
+  }
+
+ private:
+
+  struct Worker {
+    Worker() : filled(0), begin(0), end(0) { }
+    ChaseLevDeque deque;
+    std::atomic<size_t> filled;  ///< last generation pushed into the deque
+    size_t begin, end;           ///< chunk of items owned by the worker
+    std::vector<size_t> victims; ///< other workers, in the order to steal from
+    char pad[64];
+  };
+
+  size_t group(size_t worker_id) const {
+    return worker_id < groups.size() ? groups[worker_id] : 0;
+  }
+
+  /**
+   * Steal from the next workers round-robin, own group first.
+   */
+  void set_victims(size_t worker_id) {
+    std::vector<size_t>& victims = workers[worker_id].victims;
+    victims.clear();
+    for (int pass = 0; pass < 2; ++pass) {
+      for (size_t i = 1; i < workers.size(); ++i) {
+        size_t victim = (worker_id + i) % workers.size();
+        bool same = group(victim) == group(worker_id);
+        if (same == (pass == 0)) victims.push_back(victim);
+      }
+    }
+  }
+
+  std::vector<T> items;
+  std::vector<Worker> workers;
+  std::vector<size_t> groups;  ///< group of each worker
+  std::atomic<size_t> generation;
+  std::atomic<bool> canceled;
+};
+
+#endif  // __WORK_STEALING_QUEUE_H__